@@ -1,21 +1,57 @@
 // utils
 
-
+#define _GNU_SOURCE   // sendmmsg
 #include <stdio.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <ctype.h>
 #include <sched.h>
+#include <time.h>
+#include <limits.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 #include "acast.h"
 #include "acast_channel.h"
+#include "acast_simd.h"
+#include "acast_convert.h"
 #include "g711.h"
+#include "crc32c.h"
 
 #define DEBUG
 
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103    // linux 4.18
+#endif
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61       // linux 4.19
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+#define MAX_UDP_PAYLOAD MAX_PACKET_SIZE
+#define IP_UDP_HEADER   28      // ip header (no options) + udp header
+
+// UDP_SEGMENT lets the kernel split one send into datagrams of equal
+// size. return number of segments per send that can be used on sock,
+// 1 when the kernel does not know the option
+static size_t acast_probe_segments(int sock, size_t segments)
+{
+    int val = 0;
+
+    if (segments <= 1)
+	return 1;
+    if (setsockopt(sock, SOL_UDP, UDP_SEGMENT, (void*)&val, sizeof(val)) < 0)
+	return 1;
+    return (segments > ACAST_MAX_SEGMENTS) ? ACAST_MAX_SEGMENTS : segments;
+}
+
 int acast_sender_open(char* maddr, char* ifaddr, int mport,
 		      int ttl, int loop,
 		      struct sockaddr_in* addr, socklen_t* addrlen,
-		      size_t bufsize)
+		      size_t bufsize, size_t* segments)
 {
     int sock;
     if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) >= 0) {
@@ -65,6 +101,8 @@ int acast_sender_open(char* maddr, char* ifaddr, int mport,
 	fprintf(stderr, "SNDBUF = %d\n", val);
 #endif
 	*addrlen = sizeof(*addr);
+	if (segments != NULL)
+	    *segments = acast_probe_segments(sock, *segments);
     }
     return sock;
 }
@@ -143,7 +181,7 @@ int acast_receiver_open(char* maddr, char* ifaddr, int mport,
 
 int acast_usender_open(char* uaddr, char* ifaddr, int port,
 		       struct sockaddr_in* addr, socklen_t* addrlen,
-		       size_t bufsize)
+		       size_t bufsize, size_t* segments)
 {
     int sock;
 
@@ -188,10 +226,460 @@ int acast_usender_open(char* uaddr, char* ifaddr, int port,
 	}
 	fprintf(stderr, "SNDBUF = %d\n", val);
 #endif
+	if (segments != NULL)
+	    *segments = acast_probe_segments(sock, *segments);
     }
     return sock;
 }
 
+size_t acast_probe_packet_size(char* maddr, char* ifaddr, int port)
+{
+    struct sockaddr_in addr;
+    struct in_addr laddr;
+    int mtu = 0;
+    socklen_t len = sizeof(mtu);
+    int sock;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (!inet_aton(maddr, &addr.sin_addr) || !inet_aton(ifaddr, &laddr))
+	return 0;
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	return 0;
+    // connect only looks up the route, the mtu is the one of the route
+    // or of the multicast interface
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (void*)&laddr,
+	       sizeof(laddr));
+    if ((connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) ||
+	(getsockopt(sock, IPPROTO_IP, IP_MTU, (void*)&mtu, &len) < 0))
+	mtu = 0;
+    close(sock);
+    if (mtu <= IP_UDP_HEADER)
+	return 0;
+    return (mtu - IP_UDP_HEADER > MAX_PACKET_SIZE) ?
+	MAX_PACKET_SIZE : (size_t)(mtu - IP_UDP_HEADER);
+}
+
+// struct sock_txtime, not in older kernel headers
+typedef struct
+{
+    int32_t  clockid;
+    uint32_t flags;
+} acast_sock_txtime_t;
+
+int acast_set_sndbuf(int sock, size_t bufsize)
+{
+    int val = (bufsize > INT_MAX/2) ? INT_MAX/2 : (int) bufsize;
+    socklen_t len = sizeof(val);
+
+    if (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (void*)&val, sizeof(val)) < 0)
+	return -1;
+    if (getsockopt(sock, SOL_SOCKET, SO_SNDBUF, (void*)&val, &len) < 0)
+	return -1;
+    return val;
+}
+
+int acast_set_txtime(int sock)
+{
+    acast_sock_txtime_t tx;
+
+    tx.clockid = CLOCK_MONOTONIC;  // the clock fq use
+    tx.flags = 0;
+    return setsockopt(sock, SOL_SOCKET, SO_TXTIME, (void*)&tx, sizeof(tx));
+}
+
+int acast_set_tx_timestamps(int sock)
+{
+    int val = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+	SOF_TIMESTAMPING_OPT_TSONLY | SOF_TIMESTAMPING_OPT_ID;
+    return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING,
+		      (void*)&val, sizeof(val));
+}
+
+int acast_read_tx_timestamp(int sock, uint32_t* id, uint64_t* nsec)
+{
+    union {
+	char buf[512];
+	struct cmsghdr align;
+    } control;
+    struct msghdr mh;
+    struct cmsghdr* cm;
+    int found = 0;
+
+    // an error report without a time stamp is skipped
+    while(found != 3) {
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	if (recvmsg(sock, &mh, MSG_ERRQUEUE|MSG_DONTWAIT) < 0)
+	    return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+	found = 0;
+	for (cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+	    if ((cm->cmsg_level == SOL_SOCKET) &&
+		(cm->cmsg_type == SCM_TIMESTAMPING)) {
+		// struct scm_timestamping, ts[0] is the software stamp
+		struct timespec ts;
+		memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+		*nsec = ts.tv_sec*1000000000ULL + ts.tv_nsec;
+		found |= 1;
+	    }
+	    else if ((cm->cmsg_level == SOL_IP) &&
+		     (cm->cmsg_type == IP_RECVERR)) {
+		struct sock_extended_err ee;
+		memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+		if (ee.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+		    *id = ee.ee_data;
+		    found |= 2;
+		}
+	    }
+	}
+    }
+    return 1;
+}
+
+// packets to the same address are merged into one UDP_SEGMENT send
+// when max_segments > 1. all packets in a message but the last one
+// must have the segment size
+typedef struct
+{
+    size_t nseg;               // number of packets in message
+    size_t size;               // segment size (size of first packet)
+    size_t last;               // size of last packet
+    size_t bytes;              // size of all packets
+    uint64_t txtime;           // departure time, 0 if not set
+    union {
+	char buf[CMSG_SPACE(sizeof(uint16_t))+CMSG_SPACE(sizeof(uint64_t))];
+	struct cmsghdr align;
+    } control;                 // UDP_SEGMENT and SCM_TXTIME cmsg
+} acast_segs_t;
+
+struct _acast_batch_t
+{
+    size_t max;                // max number of datagrams
+    size_t max_segments;       // max datagrams per message
+    size_t n;                  // number of queued datagrams
+    size_t nmsg;               // number of messages
+    uint64_t txtime;           // departure time of new messages
+    struct mmsghdr* msg;
+    struct iovec*   iov;       // (header,data,trailer) * max_segments per msg
+    struct sockaddr_in* addr;  // destination per message
+    acast_segs_t* seg;         // segments per message
+    int* err;                  // errno per message
+    int* item;                 // message index per datagram
+};
+
+acast_batch_t* acast_batch_new(size_t max_datagrams, size_t max_segments)
+{
+    acast_batch_t* b;
+
+    if ((b = calloc(1, sizeof(acast_batch_t))) == NULL)
+	return NULL;
+    if (max_segments < 1)
+	max_segments = 1;
+    b->max  = max_datagrams;
+    b->max_segments = max_segments;
+    b->msg  = calloc(max_datagrams, sizeof(struct mmsghdr));
+    b->iov  = calloc(3*max_segments*max_datagrams, sizeof(struct iovec));
+    b->addr = calloc(max_datagrams, sizeof(struct sockaddr_in));
+    b->seg  = calloc(max_datagrams, sizeof(acast_segs_t));
+    b->err  = calloc(max_datagrams, sizeof(int));
+    b->item = calloc(max_datagrams, sizeof(int));
+    if (!b->msg || !b->iov || !b->addr || !b->seg || !b->err || !b->item) {
+	acast_batch_free(b);
+	return NULL;
+    }
+    return b;
+}
+
+void acast_batch_free(acast_batch_t* b)
+{
+    free(b->msg);
+    free(b->iov);
+    free(b->addr);
+    free(b->seg);
+    free(b->err);
+    free(b->item);
+    free(b);
+}
+
+void acast_batch_reset(acast_batch_t* b)
+{
+    b->n = 0;
+    b->nmsg = 0;
+    b->txtime = 0;
+}
+
+void acast_batch_set_txtime(acast_batch_t* b, uint64_t nsec)
+{
+    b->txtime = nsec;
+}
+
+size_t acast_batch_segments(acast_batch_t* b)
+{
+    return b->max_segments;
+}
+
+// find the message a packet of len bytes to addr can be appended to,
+// only the latest message for addr is considered to keep packet order
+static size_t acast_batch_find(acast_batch_t* b, struct sockaddr_in* addr,
+			       size_t len)
+{
+    size_t m = b->nmsg;
+
+    if (b->max_segments <= 1)
+	return b->nmsg;
+    while(m-- > 0) {
+	if ((b->addr[m].sin_addr.s_addr == addr->sin_addr.s_addr) &&
+	    (b->addr[m].sin_port == addr->sin_port)) {
+	    acast_segs_t* sp = &b->seg[m];
+	    if ((sp->nseg < b->max_segments) && (sp->last == sp->size) &&
+		(len <= sp->size) && (sp->bytes + len <= MAX_UDP_PAYLOAD) &&
+		(sp->txtime == b->txtime))
+		return m;
+	    break;
+	}
+    }
+    return b->nmsg;
+}
+
+// fill in the control messages of mh, segment size when the message
+// holds more than one packet and departure time when set
+static void acast_batch_control(struct msghdr* mh, acast_segs_t* sp,
+				int segment)
+{
+    struct cmsghdr* cm;
+    size_t len = 0;
+
+    if (segment)
+	len += CMSG_SPACE(sizeof(uint16_t));
+    if (sp->txtime)
+	len += CMSG_SPACE(sizeof(uint64_t));
+    if (len == 0) {
+	mh->msg_control = NULL;
+	mh->msg_controllen = 0;
+	return;
+    }
+    memset(sp->control.buf, 0, sizeof(sp->control.buf));
+    mh->msg_control    = sp->control.buf;
+    mh->msg_controllen = len;
+    cm = CMSG_FIRSTHDR(mh);
+    if (segment) {
+	cm->cmsg_level = SOL_UDP;
+	cm->cmsg_type  = UDP_SEGMENT;
+	cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+	*((uint16_t*)CMSG_DATA(cm)) = sp->size;
+	cm = CMSG_NXTHDR(mh, cm);
+    }
+    if (sp->txtime) {
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type  = SCM_TXTIME;
+	cm->cmsg_len   = CMSG_LEN(sizeof(uint64_t));
+	memcpy(CMSG_DATA(cm), &sp->txtime, sizeof(uint64_t));
+    }
+}
+
+int acast_batch_add(acast_batch_t* b,
+		    struct sockaddr_in* addr, socklen_t addrlen,
+		    void* hdr, size_t hdr_len,
+		    void* data, size_t data_len,
+		    void* trailer, size_t trailer_len)
+{
+    size_t len = hdr_len + data_len + trailer_len;
+    size_t m;
+    struct msghdr* mh;
+    struct iovec* iov;
+    acast_segs_t* sp;
+
+    if (b->n >= b->max)
+	return -1;
+    m = acast_batch_find(b, addr, len);
+    mh = &b->msg[m].msg_hdr;
+    sp = &b->seg[m];
+    if (m == b->nmsg) {  // start a new message
+	b->addr[m] = *addr;
+	memset(mh, 0, sizeof(*mh));
+	mh->msg_name    = &b->addr[m];
+	mh->msg_namelen = addrlen;
+	mh->msg_iov     = &b->iov[3*b->max_segments*m];
+	sp->nseg  = 0;
+	sp->size  = len;
+	sp->bytes = 0;
+	sp->txtime = b->txtime;
+	acast_batch_control(mh, sp, 0);
+	b->err[m] = 0;
+	b->nmsg++;
+    }
+    iov = &mh->msg_iov[mh->msg_iovlen];
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = hdr_len;
+    iov[1].iov_base = data;
+    iov[1].iov_len  = data_len;
+    iov[2].iov_base = trailer;
+    iov[2].iov_len  = trailer_len;
+    mh->msg_iovlen += (trailer_len > 0) ? 3 : 2;
+    sp->nseg++;
+    sp->last = len;
+    sp->bytes += len;
+    if (sp->nseg == 2)
+	acast_batch_control(mh, sp, 1);
+    b->item[b->n] = m;
+    return b->n++;
+}
+
+// send the packets in message m one by one
+static int acast_batch_send_split(acast_batch_t* b, int sock, size_t m)
+{
+    struct msghdr mh = b->msg[m].msg_hdr;
+    struct iovec* iov = mh.msg_iov;
+    size_t iovlen = mh.msg_iovlen;
+    int failed = 0;
+
+    // keep the departure time, drop the segment size
+    acast_batch_control(&mh, &b->seg[m], 0);
+    while(iovlen > 0) {
+	size_t len = 0;
+	int r;
+
+	mh.msg_iov = iov;
+	mh.msg_iovlen = 0;
+	while((mh.msg_iovlen < iovlen) && (len < b->seg[m].size))
+	    len += iov[mh.msg_iovlen++].iov_len;
+	do {
+	    r = sendmsg(sock, &mh, 0);
+	} while((r < 0) && (errno == EINTR));
+	if (r < 0) {
+	    b->err[m] = errno;
+	    failed++;
+	}
+	iov += mh.msg_iovlen;
+	iovlen -= mh.msg_iovlen;
+    }
+    return failed;
+}
+
+int acast_batch_send(acast_batch_t* b, int sock)
+{
+    size_t m = 0;
+    int failed = 0;
+
+    while(m < b->nmsg) {
+	int r = sendmmsg(sock, &b->msg[m], b->nmsg - m, 0);
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if ((b->seg[m].nseg > 1) && ((errno == EIO) || (errno == EINVAL))) {
+		// segmentation refused by route or device, stop merging
+		b->max_segments = 1;
+		failed += acast_batch_send_split(b, sock, m++);
+		continue;
+	    }
+	    // message m failed, continue with the next one
+	    b->err[m] = errno;
+	    failed += b->seg[m++].nseg;
+	}
+	else
+	    m += r;
+    }
+    return failed;
+}
+
+int acast_batch_error(acast_batch_t* b, int i)
+{
+    if ((i < 0) || ((size_t) i >= b->n))
+	return 0;
+    return b->err[b->item[i]];
+}
+
+struct _acast_recv_batch_t
+{
+    size_t max;                // number of slots
+    size_t n;                  // number of filled slots
+    size_t slot_size;
+    uint8_t* slots;
+    struct mmsghdr* msg;
+    struct iovec*   iov;
+    struct sockaddr_in* addr;  // source address per slot
+};
+
+acast_recv_batch_t* acast_recv_batch_new(size_t max_datagrams,
+					 size_t slot_size)
+{
+    acast_recv_batch_t* b;
+    size_t i;
+
+    if ((b = calloc(1, sizeof(acast_recv_batch_t))) == NULL)
+	return NULL;
+    b->max = max_datagrams;
+    b->slot_size = slot_size;
+    b->slots = malloc(max_datagrams*slot_size);
+    b->msg = calloc(max_datagrams, sizeof(struct mmsghdr));
+    b->iov = calloc(max_datagrams, sizeof(struct iovec));
+    b->addr = calloc(max_datagrams, sizeof(struct sockaddr_in));
+    if (!b->slots || !b->msg || !b->iov || !b->addr) {
+	acast_recv_batch_free(b);
+	return NULL;
+    }
+    for (i = 0; i < max_datagrams; i++) {
+	b->iov[i].iov_base = b->slots + i*slot_size;
+	b->iov[i].iov_len  = slot_size;
+	b->msg[i].msg_hdr.msg_iov = &b->iov[i];
+	b->msg[i].msg_hdr.msg_iovlen = 1;
+	b->msg[i].msg_hdr.msg_name = &b->addr[i];
+    }
+    return b;
+}
+
+void acast_recv_batch_free(acast_recv_batch_t* b)
+{
+    free(b->slots);
+    free(b->msg);
+    free(b->iov);
+    free(b->addr);
+    free(b);
+}
+
+void acast_recv_batch_reset(acast_recv_batch_t* b)
+{
+    b->n = 0;
+}
+
+int acast_recv_batch_fill(acast_recv_batch_t* b, int sock)
+{
+    int r;
+
+    size_t i;
+
+    if (b->n >= b->max)
+	return 0;
+    for (i = b->n; i < b->max; i++)
+	b->msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    // MSG_TRUNC reports the real length of datagrams that do not fit
+    while((r = recvmmsg(sock, &b->msg[b->n], b->max - b->n,
+			MSG_DONTWAIT|MSG_TRUNC, NULL)) < 0) {
+	if (errno == EINTR)
+	    continue;
+	if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+	    return 0;
+	return -1;
+    }
+    b->n += r;
+    return r;
+}
+
+size_t acast_recv_batch_count(acast_recv_batch_t* b)
+{
+    return b->n;
+}
+
+uint8_t* acast_recv_batch_data(acast_recv_batch_t* b, size_t i, size_t* len,
+			       struct sockaddr_in* addr)
+{
+    *len = b->msg[i].msg_len;
+    if (addr != NULL)
+	*addr = b->addr[i];
+    return b->slots + i*b->slot_size;
+}
 
 void acast_clear_param(acast_params_t* in)
 {
@@ -268,12 +756,44 @@ void acast_print(FILE* f, acast_t* acast)
 }
 
 // calculate frames per packet
-snd_pcm_uframes_t acast_get_frames_per_packet(acast_params_t* pp)
+snd_pcm_uframes_t acast_get_frames_per_packet(acast_params_t* pp,
+					      size_t packet_size)
 {
-    return (BYTES_PER_PACKET - sizeof(acast_t)) /
+    return (packet_size - sizeof(acast_t)) /
 	(pp->channels_per_frame * pp->bytes_per_channel);
 }
 
+size_t acast_set_payload_crc(acast_t* packet, uint8_t* data,
+			     size_t data_len, int crc, uint32_t* pcrc)
+{
+    if (!crc) {
+	packet->magic = ACAST_MAGIC;
+	return 0;
+    }
+    packet->magic = ACAST_MAGIC_CRC;
+    *pcrc = crc32c(data, data_len);
+    return PAYLOAD_CRC_SIZE;
+}
+
+int acast_check_payload_crc(acast_t* packet, size_t len)
+{
+    uint32_t pcrc;
+    size_t data_len;
+
+    if (len < sizeof(acast_t))
+	return -1;
+    data_len = len - sizeof(acast_t);
+    if (packet->magic != ACAST_MAGIC_CRC)
+	return data_len;
+    if (data_len < PAYLOAD_CRC_SIZE)
+	return -1;
+    data_len -= PAYLOAD_CRC_SIZE;
+    memcpy(&pcrc, packet->data + data_len, PAYLOAD_CRC_SIZE);
+    if (crc32c(packet->data, data_len) != pcrc)
+	return -1;
+    return data_len;
+}
+
 
 #define SNDCALL(name, args...)						\
     do {								\
@@ -294,7 +814,7 @@ void acast_emit_error(FILE* f, char* file, int line, char* function, int err)
 // and parameters from in, return parameters set in out
 int acast_setup_param(snd_pcm_t *handle,
 		      acast_params_t* in, acast_params_t* out,
-		      snd_pcm_uframes_t* fpp)
+		      size_t packet_size, snd_pcm_uframes_t* fpp)
 {
     snd_pcm_hw_params_t *params;
     snd_pcm_sw_params_t *sparams;
@@ -339,7 +859,7 @@ int acast_setup_param(snd_pcm_t *handle,
     SNDCALL(snd_pcm_hw_params_get_rate, params, &uval, 0);
     out->sample_rate = uval;
     
-    frames_per_packet = acast_get_frames_per_packet(out);
+    frames_per_packet = acast_get_frames_per_packet(out, packet_size);
 
     buffersize = frames_per_packet*4;  // or more
     SNDCALL(snd_pcm_hw_params_set_buffer_size_near,handle,params,&buffersize);
@@ -431,19 +951,51 @@ void acast_setscheduler(void)
 
 //
 // import scatter_gather_uint8, scatter_gather_int16, scatter_gather_uint32
+// and the float/double versions
 //
 #define TYPE uint8_t
 #define TYPE2 uint16_t
+#define TYPEM float
+#define TYPE_BIASED
 #include "map.i"
 
 #define TYPE int16_t
 #define TYPE2 int32_t
+#define TYPEM float
 #include "map.i"
 
 #define TYPE int32_t
 #define TYPE2 int64_t
+#define TYPEM double
+#include "map.i"
+
+#define TYPE float
+#define TYPE2 double
+#define TYPEM float
+#define TYPE_FLOAT
+#include "map.i"
+
+#define TYPE double
+#define TYPE2 double
+#define TYPEM double
+#define TYPE_FLOAT
 #include "map.i"
 
+// sample type used to select map functions, the physical width for
+// integer samples, native float samples have their own types.
+// other float formats are moved around as integers of the same width
+#define SAMPLE_F32  33
+#define SAMPLE_F64  65
+
+static int sample_type(snd_pcm_format_t fmt)
+{
+    if (fmt == SND_PCM_FORMAT_FLOAT)
+	return SAMPLE_F32;
+    else if (fmt == SND_PCM_FORMAT_FLOAT64)
+	return SAMPLE_F64;
+    return snd_pcm_format_physical_width(fmt);
+}
+
 // rearrange interleaved channels
 // select channels by channel_map from src and put into dst
 void permute_ii(snd_pcm_format_t fmt,
@@ -452,7 +1004,9 @@ void permute_ii(snd_pcm_format_t fmt,
 		uint8_t* channel_map,
 		size_t frames)
 {
-    switch(snd_pcm_format_physical_width(fmt)) {
+    size_t n;
+    
+    switch(sample_type(fmt)) {
     case 8:
 	permute_ii_uint8_t(
 	    (uint8_t*)src, nsrc,
@@ -460,18 +1014,53 @@ void permute_ii(snd_pcm_format_t fmt,
 	    channel_map, frames);
 	break;
     case 16:
+	n = acast_permute_ii_simd(sizeof(int16_t), src, nsrc, dst, ndst,
+				  channel_map, frames);
 	permute_ii_int16_t(
-	    (int16_t*)src, nsrc,
-	    (int16_t*)dst, ndst,
-	    channel_map, frames);
+	    (int16_t*)src + n*nsrc, nsrc,
+	    (int16_t*)dst + n*ndst, ndst,
+	    channel_map, frames-n);
 	break;	
     case 32:
+	n = acast_permute_ii_simd(sizeof(int32_t), src, nsrc, dst, ndst,
+				  channel_map, frames);
 	permute_ii_int32_t(	
-	    (int32_t*)src, nsrc,
-	    (int32_t*)dst, ndst,
-	    channel_map, frames);
+	    (int32_t*)src + n*nsrc, nsrc,
+	    (int32_t*)dst + n*ndst, ndst,
+	    channel_map, frames-n);
+	break;
+    case SAMPLE_F32:
+	n = acast_permute_ii_simd(sizeof(float), src, nsrc, dst, ndst,
+				  channel_map, frames);
+	permute_ii_float(
+	    (float*)src + n*nsrc, nsrc,
+	    (float*)dst + n*ndst, ndst,
+	    channel_map, frames-n);
 	break;
+    case 64:
+    case SAMPLE_F64:
+	n = acast_permute_ii_simd(sizeof(double), src, nsrc, dst, ndst,
+				  channel_map, frames);
+	permute_ii_double(
+	    (double*)src + n*nsrc, nsrc,
+	    (double*)dst + n*ndst, ndst,
+	    channel_map, frames-n);
+	break;
+    }
+}
+
+// check if channel pointers are interleaved frames with nsrc channels
+static int is_interleaved(void** src, size_t* src_stride, size_t nsrc,
+			  size_t bytes_per_channel)
+{
+    int i;
+    for (i = 0; i < nsrc; i++) {
+	if ((uint8_t*)src[i] != (uint8_t*)src[0] + i*bytes_per_channel)
+	    return 0;
+	if (src_stride[i] != nsrc)
+	    return 0;
     }
+    return 1;
 }
 
 // interleave channels using channel map
@@ -481,7 +1070,16 @@ void permute_ni(snd_pcm_format_t fmt,
 		uint8_t* channel_map,
 		size_t frames)
 {
-    switch(snd_pcm_format_physical_width(fmt)) {
+    int width = snd_pcm_format_physical_width(fmt);
+
+    // wav files are read as interleaved frames, use the faster path
+    if (((width == 16) || (width == 32) || (width == 64)) &&
+	is_interleaved(src, src_stride, nsrc, width/8)) {
+	permute_ii(fmt, src[0], nsrc, dst, ndst, channel_map, frames);
+	return;
+    }
+    
+    switch(sample_type(fmt)) {
     case 8:
 	permute_ni_uint8_t(
 	    (uint8_t**) src, src_stride, nsrc,
@@ -500,6 +1098,19 @@ void permute_ni(snd_pcm_format_t fmt,
 	    (int32_t*) dst, ndst,
 	    channel_map, frames);
 	break;
+    case SAMPLE_F32:
+	permute_ni_float(
+	    (float**) src, src_stride, nsrc,
+	    (float*) dst, ndst,
+	    channel_map, frames);
+	break;
+    case 64:
+    case SAMPLE_F64:
+	permute_ni_double(
+	    (double**) src, src_stride, nsrc,
+	    (double*) dst, ndst,
+	    channel_map, frames);
+	break;
     }
 }
 
@@ -512,7 +1123,7 @@ void scatter_gather_ii(snd_pcm_format_t fmt,
 		       acast_op_t* map, size_t nmap,
 		       size_t frames)
 {
-    switch(snd_pcm_format_physical_width(fmt)) {
+    switch(sample_type(fmt)) {
     case 8:
 	scatter_gather_ii_uint8_t(
 	    (uint8_t*)src, src_stride,
@@ -534,6 +1145,20 @@ void scatter_gather_ii(snd_pcm_format_t fmt,
 	    map, nmap,
 	    frames);
 	break;
+    case SAMPLE_F32:
+	scatter_gather_ii_float(
+	    (float*)src, src_stride,
+	    (float*)dst, dst_stride,
+	    map, nmap,
+	    frames);
+	break;
+    case SAMPLE_F64:
+	scatter_gather_ii_double(
+	    (double*)src, src_stride,
+	    (double*)dst, dst_stride,
+	    map, nmap,
+	    frames);
+	break;
     }
 }
 
@@ -545,7 +1170,7 @@ void scatter_gather_ni(snd_pcm_format_t fmt,
 		       acast_op_t* channel_op, size_t num_ops,
 		       size_t frames)
 {
-    switch(snd_pcm_format_physical_width(fmt)) {
+    switch(sample_type(fmt)) {
     case 8:
 	scatter_gather_ni_uint8_t(
 	    (uint8_t**)src, src_stride, nsrc,
@@ -567,6 +1192,20 @@ void scatter_gather_ni(snd_pcm_format_t fmt,
 	    channel_op, num_ops,	      
 	    frames);
 	break;
+    case SAMPLE_F32:
+	scatter_gather_ni_float(
+	    (float**)src, src_stride, nsrc,
+	    (float*)dst, dst_stride,
+	    channel_op, num_ops,
+	    frames);
+	break;
+    case SAMPLE_F64:
+	scatter_gather_ni_double(
+	    (double**)src, src_stride, nsrc,
+	    (double*)dst, dst_stride,
+	    channel_op, num_ops,
+	    frames);
+	break;
     }
 }
 
@@ -576,7 +1215,7 @@ void scatter_gather_nn(snd_pcm_format_t fmt,
 		       acast_op_t* channel_op, size_t num_ops,
 		       size_t frames)
 {
-    switch(snd_pcm_format_physical_width(fmt)) {
+    switch(sample_type(fmt)) {
     case 8:
 	scatter_gather_nn_uint8_t(
 	    (uint8_t**)src, src_stride, nsrc,
@@ -598,5 +1237,407 @@ void scatter_gather_nn(snd_pcm_format_t fmt,
 	    channel_op, num_ops,	      
 	    frames);
 	break;
+    case SAMPLE_F32:
+	scatter_gather_nn_float(
+	    (float**)src, src_stride, nsrc,
+	    (float**)dst, dst_stride, ndst,
+	    channel_op, num_ops,
+	    frames);
+	break;
+    case SAMPLE_F64:
+	scatter_gather_nn_double(
+	    (double**)src, src_stride, nsrc,
+	    (double**)dst, dst_stride, ndst,
+	    channel_op, num_ops,
+	    frames);
+	break;
+    }
+}
+
+// run compiled channel program on interleaved channels
+void channel_prog_ii(snd_pcm_format_t fmt,
+		     void* src, size_t src_stride,
+		     void* dst, size_t dst_stride,
+		     acast_channel_prog_t* prog,
+		     size_t frames)
+{
+    size_t n = 0;
+    // a single block copy is already as fast as it gets
+    int use_simd = !((prog->num_ops == 1) &&
+		     (prog->op[0].op == ACAST_OP_SRC));
+
+    switch(sample_type(fmt)) {
+    case 8:
+	channel_prog_ii_uint8_t(
+	    (uint8_t*)src, src_stride,
+	    (uint8_t*)dst, dst_stride,
+	    prog, frames);
+	break;
+    case 16:
+	if (use_simd)
+	    n = acast_channel_prog_ii_simd(ACAST_SAMPLE_S16,
+					   src, src_stride, dst, dst_stride,
+					   prog, frames);
+	channel_prog_ii_int16_t(
+	    (int16_t*)src + n*src_stride, src_stride,
+	    (int16_t*)dst + n*dst_stride, dst_stride,
+	    prog, frames-n);
+	break;	
+    case 32:
+	if (use_simd)
+	    n = acast_channel_prog_ii_simd(ACAST_SAMPLE_S32,
+					   src, src_stride, dst, dst_stride,
+					   prog, frames);
+	channel_prog_ii_int32_t(
+	    (int32_t*)src + n*src_stride, src_stride,
+	    (int32_t*)dst + n*dst_stride, dst_stride,
+	    prog, frames-n);
+	break;
+    case SAMPLE_F32:
+	if (use_simd)
+	    n = acast_channel_prog_ii_simd(ACAST_SAMPLE_F32,
+					   src, src_stride, dst, dst_stride,
+					   prog, frames);
+	channel_prog_ii_float(
+	    (float*)src + n*src_stride, src_stride,
+	    (float*)dst + n*dst_stride, dst_stride,
+	    prog, frames-n);
+	break;
+    case SAMPLE_F64:
+	if (use_simd)
+	    n = acast_channel_prog_ii_simd(ACAST_SAMPLE_F64,
+					   src, src_stride, dst, dst_stride,
+					   prog, frames);
+	channel_prog_ii_double(
+	    (double*)src + n*src_stride, src_stride,
+	    (double*)dst + n*dst_stride, dst_stride,
+	    prog, frames-n);
+	break;
+    }
+}
+
+// run compiled channel program on separate channels
+void channel_prog_nn(snd_pcm_format_t fmt,
+		     void** src, size_t* src_stride, size_t nsrc,
+		     void** dst, size_t* dst_stride, size_t ndst,
+		     acast_channel_prog_t* prog,
+		     size_t frames)
+{
+    switch(sample_type(fmt)) {
+    case 8:
+	channel_prog_nn_uint8_t(
+	    (uint8_t**)src, src_stride,
+	    (uint8_t**)dst, dst_stride,
+	    prog, frames);
+	break;
+    case 16:
+	channel_prog_nn_int16_t(
+	    (int16_t**)src, src_stride,
+	    (int16_t**)dst, dst_stride,
+	    prog, frames);
+	break;	
+    case 32:
+	channel_prog_nn_int32_t(
+	    (int32_t**)src, src_stride,
+	    (int32_t**)dst, dst_stride,
+	    prog, frames);
+	break;
+    case SAMPLE_F32:
+	channel_prog_nn_float(
+	    (float**)src, src_stride,
+	    (float**)dst, dst_stride,
+	    prog, frames);
+	break;
+    case SAMPLE_F64:
+	channel_prog_nn_double(
+	    (double**)src, src_stride,
+	    (double**)dst, dst_stride,
+	    prog, frames);
+	break;
+    }
+}
+
+// run compiled channel program on separate channels in src
+// with result in interleaved channels in dst
+void channel_prog_ni(snd_pcm_format_t fmt,
+		     void** src, size_t* src_stride, size_t nsrc,
+		     void* dst, size_t dst_stride,
+		     acast_channel_prog_t* prog,
+		     size_t frames)
+{
+    int width = snd_pcm_format_physical_width(fmt);
+    void*  dst1[MAX_CHANNELS];
+    size_t dst1_stride[MAX_CHANNELS];
+    int i;
+
+    if ((width > 0) && is_interleaved(src, src_stride, nsrc, width/8)) {
+	channel_prog_ii(fmt, src[0], nsrc, dst, dst_stride, prog, frames);
+	return;
+    }
+    for (i = 0; (i < dst_stride) && (i < MAX_CHANNELS); i++) {
+	dst1[i] = (uint8_t*)dst + i*(width/8);
+	dst1_stride[i] = dst_stride;
+    }
+    channel_prog_nn(fmt, src, src_stride, nsrc,
+		    dst1, dst1_stride, i,
+		    prog, frames);
+}
+
+// matrix for at most nsrc inputs, inputs the source does not have
+// get zero gain. mx1 holds the copy when one is needed
+static acast_matrix_t* matrix_inputs(acast_matrix_t* mx, size_t nsrc,
+				     acast_matrix_t* mx1)
+{
+    if (mx->nin <= nsrc)
+	return mx;
+    *mx1 = *mx;
+    mx1->nin = nsrc;
+    return mx1;
+}
+
+// xor that makes 8 bit samples offset binary
+static uint8_t matrix_flip(snd_pcm_format_t fmt)
+{
+    return (fmt == SND_PCM_FORMAT_U8) ? 0 : 0x80;
+}
+
+// apply gain matrix on interleaved channels
+void matrix_ii(snd_pcm_format_t fmt,
+	       void* src, size_t src_stride,
+	       void* dst, size_t dst_stride,
+	       acast_matrix_t* mx,
+	       size_t frames)
+{
+    acast_matrix_t mx1;
+    size_t n;
+
+    mx = matrix_inputs(mx, src_stride, &mx1);
+    switch(sample_type(fmt)) {
+    case 8:
+	matrix_ii_uint8_t(
+	    (uint8_t*)src, src_stride,
+	    (uint8_t*)dst, dst_stride,
+	    mx, frames, matrix_flip(fmt));
+	break;
+    case 16:
+	n = acast_matrix_ii_simd(ACAST_SAMPLE_S16, src, src_stride,
+				 dst, dst_stride, mx, frames);
+	matrix_ii_int16_t(
+	    (int16_t*)src + n*src_stride, src_stride,
+	    (int16_t*)dst + n*dst_stride, dst_stride,
+	    mx, frames-n);
+	break;
+    case 32:
+	n = acast_matrix_ii_simd(ACAST_SAMPLE_S32, src, src_stride,
+				 dst, dst_stride, mx, frames);
+	matrix_ii_int32_t(
+	    (int32_t*)src + n*src_stride, src_stride,
+	    (int32_t*)dst + n*dst_stride, dst_stride,
+	    mx, frames-n);
+	break;
+    case SAMPLE_F32:
+	n = acast_matrix_ii_simd(ACAST_SAMPLE_F32, src, src_stride,
+				 dst, dst_stride, mx, frames);
+	matrix_ii_float(
+	    (float*)src + n*src_stride, src_stride,
+	    (float*)dst + n*dst_stride, dst_stride,
+	    mx, frames-n);
+	break;
+    case SAMPLE_F64:
+	n = acast_matrix_ii_simd(ACAST_SAMPLE_F64, src, src_stride,
+				 dst, dst_stride, mx, frames);
+	matrix_ii_double(
+	    (double*)src + n*src_stride, src_stride,
+	    (double*)dst + n*dst_stride, dst_stride,
+	    mx, frames-n);
+	break;
+    }
+}
+
+// apply gain matrix on separate channels in src with result in
+// interleaved channels in dst
+void matrix_ni(snd_pcm_format_t fmt,
+	       void** src, size_t* src_stride, size_t nsrc,
+	       void* dst, size_t dst_stride,
+	       acast_matrix_t* mx,
+	       size_t frames)
+{
+    int width = snd_pcm_format_physical_width(fmt);
+    acast_matrix_t mx1;
+
+    if ((width > 0) && is_interleaved(src, src_stride, nsrc, width/8)) {
+	matrix_ii(fmt, src[0], nsrc, dst, dst_stride, mx, frames);
+	return;
+    }
+    mx = matrix_inputs(mx, nsrc, &mx1);
+    switch(sample_type(fmt)) {
+    case 8:
+	matrix_ni_uint8_t(
+	    (uint8_t**)src, src_stride,
+	    (uint8_t*)dst, dst_stride,
+	    mx, frames, matrix_flip(fmt));
+	break;
+    case 16:
+	matrix_ni_int16_t(
+	    (int16_t**)src, src_stride,
+	    (int16_t*)dst, dst_stride,
+	    mx, frames);
+	break;
+    case 32:
+	matrix_ni_int32_t(
+	    (int32_t**)src, src_stride,
+	    (int32_t*)dst, dst_stride,
+	    mx, frames);
+	break;
+    case SAMPLE_F32:
+	matrix_ni_float(
+	    (float**)src, src_stride,
+	    (float*)dst, dst_stride,
+	    mx, frames);
+	break;
+    case SAMPLE_F64:
+	matrix_ni_double(
+	    (double**)src, src_stride,
+	    (double*)dst, dst_stride,
+	    mx, frames);
+	break;
+    }
+}
+
+// Map source frames for all clients in one pass over the source.
+// Frames are taken in blocks that fit in L1 cache, each block is mapped
+// for every client before moving on, so the source is read from memory
+// once however many clients there are. Output for client i is written
+// to client[i].ptr. ACAST_MAP_ID clients are skipped, they can use the
+// source as is, unless the source is converted.
+// If conv is not NULL the source is in conv->src_fmt and each block is
+// converted to fmt before it is mapped.
+#define FANOUT_BLOCK_BYTES  4096
+
+static size_t fanout_block_frames(size_t bytes_per_frame)
+{
+    size_t n = FANOUT_BLOCK_BYTES / bytes_per_frame;
+    // keep blocks a multiple of 32 frames, simd kernels do whole blocks
+    n &= ~(size_t)31;
+    return (n < 32) ? 32 : n;
+}
+
+void fanout_ii(snd_pcm_format_t fmt, acast_convert_t* conv,
+	       void* src, size_t nsrc,
+	       client_t* client, size_t nclients,
+	       size_t frames)
+{
+    size_t bytes_per_channel = snd_pcm_format_physical_width(fmt)/8;
+    size_t src_bytes_per_frame = nsrc*bytes_per_channel;
+    size_t block = fanout_block_frames(nsrc*bytes_per_channel);
+    uint64_t tmp[FANOUT_BLOCK_BYTES/8];  // converted block (32*16*4 fits)
+    size_t offs = 0;
+
+    if (conv != NULL) {
+	if (conv->convert == NULL)  // same format
+	    conv = NULL;
+	else {
+	    src_bytes_per_frame = nsrc*conv->src_bytes;
+	    if (block*nsrc*bytes_per_channel > sizeof(tmp))
+		block = sizeof(tmp) / (nsrc*bytes_per_channel);
+	    if (block == 0)
+		return;
+	}
+    }
+    // every client may have its own plan
+    acast_simd_plan_cache(nclients);
+
+    while(offs < frames) {
+	size_t n = ((frames - offs) < block) ? (frames - offs) : block;
+	uint8_t* s = (uint8_t*)src + offs*src_bytes_per_frame;
+	int i;
+
+	if (conv != NULL) {
+	    acast_convert(conv, s, tmp, n*nsrc);
+	    s = (uint8_t*) tmp;
+	}
+	for (i = 0; i < nclients; i++) {
+	    client_t* cp = &client[i];
+	    size_t ndst = cp->num_output_channels;
+	    uint8_t* d;
+
+	    if (cp->ptr == NULL)
+		continue;
+	    d = cp->ptr + offs*ndst*bytes_per_channel;
+
+	    switch(cp->chan_ctx.type) {
+	    case ACAST_MAP_PERMUTE:
+		permute_ii(fmt, s, nsrc, d, ndst,
+			   cp->chan_ctx.channel_map, n);
+		break;
+	    case ACAST_MAP_OP:
+		channel_prog_ii(fmt, s, nsrc, d, ndst,
+				&cp->chan_ctx.prog, n);
+		break;
+	    case ACAST_MAP_MATRIX:
+		matrix_ii(fmt, s, nsrc, d, ndst, &cp->chan_ctx.matrix, n);
+		break;
+	    case ACAST_MAP_ID:
+		if (conv != NULL)
+		    memcpy(d, s, n*nsrc*bytes_per_channel);
+		break;
+	    default:
+		break;
+	    }
+	}
+	offs += n;
+    }
+}
+
+// Same as fanout_ii but with separate source channels,
+// ACAST_MAP_ID clients are interleaved as well.
+void fanout_ni(snd_pcm_format_t fmt,
+	       void** src, size_t* src_stride, size_t nsrc,
+	       client_t* client, size_t nclients,
+	       size_t frames)
+{
+    size_t bytes_per_channel = snd_pcm_format_physical_width(fmt)/8;
+    size_t block = fanout_block_frames(nsrc*bytes_per_channel);
+    void* s[MAX_CHANNELS];
+    size_t offs = 0;
+    int j;
+
+    if (nsrc > MAX_CHANNELS)
+	return;
+    while(offs < frames) {
+	size_t n = ((frames - offs) < block) ? (frames - offs) : block;
+	int i;
+
+	for (j = 0; j < nsrc; j++)
+	    s[j] = (uint8_t*)src[j] + offs*src_stride[j]*bytes_per_channel;
+
+	for (i = 0; i < nclients; i++) {
+	    client_t* cp = &client[i];
+	    size_t ndst = cp->num_output_channels;
+	    uint8_t* d;
+
+	    if (cp->ptr == NULL)
+		continue;
+	    d = cp->ptr + offs*ndst*bytes_per_channel;
+
+	    switch(cp->chan_ctx.type) {
+	    case ACAST_MAP_ID:
+	    case ACAST_MAP_PERMUTE:
+		permute_ni(fmt, s, src_stride, nsrc, d, ndst,
+			   cp->chan_ctx.channel_map, n);
+		break;
+	    case ACAST_MAP_OP:
+		channel_prog_ni(fmt, s, src_stride, nsrc, d, ndst,
+				&cp->chan_ctx.prog, n);
+		break;
+	    case ACAST_MAP_MATRIX:
+		matrix_ni(fmt, s, src_stride, nsrc, d, ndst,
+			  &cp->chan_ctx.matrix, n);
+		break;
+	    default:
+		break;
+	    }
+	}
+	offs += n;
     }
 }
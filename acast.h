@@ -16,6 +16,7 @@
 #include <alsa/asoundlib.h>
 
 #include "acast_channel.h"
+#include "acast_convert.h"
 #include "tick.h"
 
 // default values
@@ -23,10 +24,18 @@
 #define MULTICAST_PORT  22402          // audio data
 #define INTERFACE_ADDR  "0.0.0.0"
 #define ACAST_MAGIC     0x41434147     // "ACAF"
+#define ACAST_MAGIC_CRC 0x41434148     // "ACAH" data followed by crc32c
+#define ACAST_MAGIC_FEC 0x41434149     // "ACAI" xor parity of packet group
+#define ACAST_MAGIC_SR  0x4143414A     // "ACAJ" sender report
 #define CONTROL_PORT    22403          // control data
 #define CONTROL_MAGIC   0x41434143     // "ACAC"
 
-#define BYTES_PER_PACKET 1472     // try avoid ip fragmentation
+#define BYTES_PER_PACKET 1472     // default, try avoid ip fragmentation
+#define MIN_PACKET_SIZE  256      // smallest packet size accepted
+#define MAX_PACKET_SIZE  65507    // 65535 - ip header - udp header
+#define PAYLOAD_CRC_SIZE 4        // crc32c trailer (ACAST_MAGIC_CRC)
+#define ACAST_MAX_SEGMENTS 64     // max packets per UDP_SEGMENT send
+#define ACAST_SR_INTERVAL 1000000 // 1s between sender reports
 
 #define MAX_CHANNELS 16
 
@@ -51,6 +60,32 @@ typedef struct
     uint8_t  data[0];        // audio data
 } acast_t;
 
+// parity packet, data is the xor of the packets seqno, seqno+stride, ...
+// (count packets) as sent, shorter packets are padded with zeros
+typedef struct
+{
+    uint32_t magic;          // ACAST_MAGIC_FEC
+    uint32_t seqno;          // sequence number of first packet in group
+    uint8_t  count;          // number of packets in group
+    uint8_t  stride;         // sequence number step within group
+    uint16_t length;         // xor of packet lengths
+    uint32_t crc;            // crc32 (seqno,count,stride,length)
+    uint8_t  data[0];        // xor of packets
+} acast_fec_t;
+
+// sender report, maps the media clock to the sender wall clock. it is
+// sent ahead of packet seqno, receivers count the media time of later
+// packets from timestamp by the num_frames of the packets in between
+typedef struct
+{
+    uint32_t magic;          // ACAST_MAGIC_SR
+    uint32_t seqno;          // packet the report refers to
+    uint64_t timestamp;      // media time of first frame in packet (frames)
+    uint64_t wallclock;      // wall clock (us) that frame was captured
+    uint32_t sample_rate;    // media clock rate
+    uint32_t crc;            // crc32 (seqno,timestamp,wallclock,sample_rate)
+} acast_sr_t;
+
 typedef struct
 {
     size_t size;                 // number of segments/channels
@@ -66,7 +101,9 @@ typedef struct
     uint32_t crc;            // crc32 (magic, mask)
 } actl_t;
 
-#define CLIENT_TIMEOUT 5000000  // 5s
+#define CLIENT_TIMEOUT 30000000 // 30s, three subscription refreshes
+#define CLIENT_EXPIRY_SLOTS 1024 // timer wheel spans 51.2s
+#define CLIENT_EXPIRY_TICK  50000 // 50ms
 
 #define CLIENT_MODE_UNICAST   1
 #define CLIENT_MODE_MULTICAST 2
@@ -85,18 +122,35 @@ typedef struct
     int                 num_output_channels;
     acast_channel_ctx_t chan_ctx;
     uint8_t*            ptr;                  // where to fill
-    uint8_t             buffer[2*BYTES_PER_BUFFER];
+    uint8_t*            buffer;               // mapped frames, or NULL
+    struct _acast_fec_enc_t* fec;             // parity encoder, or NULL
+    int                 group;                // stream group, or -1
 } client_t;
 
 extern void acast_clear_param(acast_params_t* acast);
 extern void acast_print_params(FILE* f, acast_params_t* params);
 extern void acast_print(FILE* f, acast_t* acast);
 
-extern snd_pcm_uframes_t acast_get_frames_per_packet(acast_params_t* pp);
+// frames that fit in a packet of packet_size bytes (BYTES_PER_PACKET
+// unless configured), senders with payload crc pass packet_size less
+// PAYLOAD_CRC_SIZE
+extern snd_pcm_uframes_t acast_get_frames_per_packet(acast_params_t* pp,
+						     size_t packet_size);
+
+// set packet magic, when crc is set store crc32c of the data_len bytes
+// of audio data in *pcrc, it is sent right after the data.
+// return number of trailer bytes (0 or PAYLOAD_CRC_SIZE)
+extern size_t acast_set_payload_crc(acast_t* packet, uint8_t* data,
+				    size_t data_len, int crc, uint32_t* pcrc);
+// check packet of len bytes, return number of audio data bytes or -1
+// if the payload checksum is wrong
+extern int acast_check_payload_crc(acast_t* packet, size_t len);
 
+// the device buffer is sized for packets of packet_size bytes, frames
+// per packet are returned in fpp
 extern int acast_setup_param(snd_pcm_t *handle,
 			     acast_params_t* in, acast_params_t* out,
-			     snd_pcm_uframes_t* fpp);
+			     size_t packet_size, snd_pcm_uframes_t* fpp);
 
 // bytes_per_frame = 0 => single write
 extern long acast_play(snd_pcm_t* handle, size_t bytes_per_frame,
@@ -136,11 +190,55 @@ extern void scatter_gather_ni(snd_pcm_format_t fmt,
 			      acast_op_t* channel_op, size_t num_ops,
 			      size_t frames);
 
+extern void channel_prog_ii(snd_pcm_format_t fmt,
+			    void* src, size_t src_stride,
+			    void* dst, size_t dst_stride,
+			    acast_channel_prog_t* prog,
+			    size_t frames);
+
+extern void channel_prog_ni(snd_pcm_format_t fmt,
+			    void** src, size_t* src_stride, size_t nsrc,
+			    void* dst, size_t dst_stride,
+			    acast_channel_prog_t* prog,
+			    size_t frames);
+
+extern void channel_prog_nn(snd_pcm_format_t fmt,
+			    void** src, size_t* src_stride, size_t nsrc,
+			    void** dst, size_t* dst_stride, size_t ndst,
+			    acast_channel_prog_t* prog,
+			    size_t frames);
+
+extern void matrix_ii(snd_pcm_format_t fmt,
+		      void* src, size_t src_stride,
+		      void* dst, size_t dst_stride,
+		      acast_matrix_t* mx,
+		      size_t frames);
 
+extern void matrix_ni(snd_pcm_format_t fmt,
+		      void** src, size_t* src_stride, size_t nsrc,
+		      void* dst, size_t dst_stride,
+		      acast_matrix_t* mx,
+		      size_t frames);
+
+// map source frames to client[i].ptr for all clients in a single pass
+// source is converted with conv first when conv is not NULL.
+// clients with ptr == NULL are skipped
+extern void fanout_ii(snd_pcm_format_t fmt, acast_convert_t* conv,
+		      void* src, size_t nsrc,
+		      client_t* client, size_t nclients,
+		      size_t frames);
+
+extern void fanout_ni(snd_pcm_format_t fmt,
+		      void** src, size_t* src_stride, size_t nsrc,
+		      client_t* client, size_t nclients,
+		      size_t frames);
+
+// segments is the wanted number of packets per send (UDP_SEGMENT), it
+// is set to 1 when not supported. segments may be NULL
 extern int acast_sender_open(char* maddr, char* ifaddr, int mport,
 				 int ttl, int loop,
 				 struct sockaddr_in* addr, socklen_t* addrlen,
-				 size_t bufsize);
+				 size_t bufsize, size_t* segments);
 
 extern int acast_receiver_open(char* maddr, char* ifaddr, int mport,
 				   struct sockaddr_in* addr, socklen_t* addrlen,
@@ -148,6 +246,72 @@ extern int acast_receiver_open(char* maddr, char* ifaddr, int mport,
 
 extern int acast_usender_open(char* uaddr, char* ifaddr, int port,
 			      struct sockaddr_in* addr, socklen_t* addrlen,
-			      size_t bufsize);
+			      size_t bufsize, size_t* segments);
+
+// largest packet that can be sent to maddr:port from interface ifaddr
+// without fragmentation (route mtu - ip header - udp header), return 0
+// if the mtu is unknown
+extern size_t acast_probe_packet_size(char* maddr, char* ifaddr, int port);
+
+// resize the send buffer of sock to bufsize bytes, return the size
+// the kernel set (limited by net.core.wmem_max) or -1 on error
+extern int acast_set_sndbuf(int sock, size_t bufsize);
+
+// kernel pacing: datagrams carry their departure time (SCM_TXTIME) on
+// CLOCK_MONOTONIC and the fq qdisc holds them back until then.
+// return -1 if the kernel does not support SO_TXTIME
+extern int acast_set_txtime(int sock);
+// queue software transmit time stamps on the socket error queue, the
+// stamps are numbered by the messages sent from 0
+extern int acast_set_tx_timestamps(int sock);
+// read next transmit time stamp (CLOCK_REALTIME ns) and the number of
+// its message. return 1 if one was read, 0 if the queue is empty and
+// -1 on error
+extern int acast_read_tx_timestamp(int sock, uint32_t* id, uint64_t* nsec);
+
+// batch of datagrams sent with a single system call, each datagram
+// is gathered from a header, a data part and an optional trailer.
+// with max_segments > 1 consecutive datagrams to the same address are
+// sent as one message that the kernel splits (UDP_SEGMENT)
+typedef struct _acast_batch_t acast_batch_t;
+
+extern acast_batch_t* acast_batch_new(size_t max_datagrams,
+				      size_t max_segments);
+extern void acast_batch_free(acast_batch_t* b);
+extern void acast_batch_reset(acast_batch_t* b);
+// departure time (CLOCK_MONOTONIC ns) of datagrams added after the
+// call, 0 sends at once. needs acast_set_txtime on the socket
+extern void acast_batch_set_txtime(acast_batch_t* b, uint64_t nsec);
+// current max datagrams per message, drops to 1 if segmentation fails
+extern size_t acast_batch_segments(acast_batch_t* b);
+// queue datagram, return index in batch or -1 if batch is full
+extern int acast_batch_add(acast_batch_t* b,
+			   struct sockaddr_in* addr, socklen_t addrlen,
+			   void* hdr, size_t hdr_len,
+			   void* data, size_t data_len,
+			   void* trailer, size_t trailer_len);
+// send all queued datagrams, a failing datagram does not stop the rest.
+// return number of failed datagrams. if the kernel refuse to segment a
+// message its datagrams are sent one by one and merging is turned off
+extern int acast_batch_send(acast_batch_t* b, int sock);
+// errno for datagram i after acast_batch_send, 0 if it was sent
+extern int acast_batch_error(acast_batch_t* b, int i);
+
+// ring of preallocated datagram slots filled with recvmmsg
+typedef struct _acast_recv_batch_t acast_recv_batch_t;
+
+extern acast_recv_batch_t* acast_recv_batch_new(size_t max_datagrams,
+						size_t slot_size);
+extern void acast_recv_batch_free(acast_recv_batch_t* b);
+extern void acast_recv_batch_reset(acast_recv_batch_t* b);
+// receive queued datagrams from sock into the free slots without
+// blocking, return number of datagrams added or -1 on error
+extern int acast_recv_batch_fill(acast_recv_batch_t* b, int sock);
+extern size_t acast_recv_batch_count(acast_recv_batch_t* b);
+// datagram i, its length is stored in *len and source address in *addr.
+// a datagram larger than slot_size is truncated and *len is its size
+// before truncation
+extern uint8_t* acast_recv_batch_data(acast_recv_batch_t* b, size_t i,
+				      size_t* len, struct sockaddr_in* addr);
 
 #endif
@@ -0,0 +1,1230 @@
+//
+//  acast_bench
+//
+//     time the per-packet kernels: channel maps, channel programs,
+//     gain matrix, sample format conversion, G.711, crc32, crc32c,
+//     file decode and loopback packet send with and without UDP_SEGMENT.
+//     report ns/frame and GB/s (bytes read + bytes written) and optionally
+//     write the result table as JSON for comparison between runs.
+//     the op interpreter (scatter_gather_ii) output is checked against
+//     the compiled channel programs (channel_prog_ii)
+//     with -s simulate the receiver clock control instead and check
+//     its limits
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+
+#include "acast.h"
+#include "acast_file.h"
+#include "acast_jitter.h"
+#include "acast_resample.h"
+#include "g711.h"
+#include "crc32.h"
+#include "crc32c.h"
+#include "wav.h"
+#include "tick.h"
+
+#define NUM_FRAMES   1152     // frames per call
+#define BENCH_TIME   50       // min time per benchmark in ms
+#define MAX_RESULTS  256
+#define WAV_SECONDS  10       // length of generated wav file
+#define WAV_RATE     48000
+#define WAV_CHANNELS 2
+#define NET_CLIENTS  4        // unicast destinations in send benchmark
+#define NET_SEGMENTS 16       // packets per destination and send
+#define NET_CHANNELS 16
+
+#define BUFFER_SIZE  (NUM_FRAMES*MAX_CHANNELS*sizeof(double))
+
+#define SIM_RATE     48000
+#define SIM_FRAMES   240      // frames per packet
+#define SIM_STEP     1000     // us per simulation step
+#define SIM_SETTLE   600      // s before latency is checked
+#define DRIFT_HOURS  2        // length of drift simulation
+#define SNR_TONE     1000.0   // Hz
+#define SNR_SECONDS  100
+#define SNR_MIN      80.0     // dB at any ratio
+#define SYNC_MINUTES 30       // length of sync simulation
+#define SYNC_STEP    250      // us per sync simulation step
+#define SYNC_SETTLE  120      // s before sync error is checked
+#define SYNC_MAX_SKEW 2000    // us, larger errors are stepped
+#define SYNC_DELAY   100      // ms from capture to playout
+#define SYNC_MAX_ERROR 750.0  // us after SYNC_SETTLE
+#define SYNC_SHORT   50       // every SYNC_SHORT packet is half size
+#define SYNC_HISTORY 1024     // media times kept per seqno
+
+int verbose = 0;
+
+static int channels[] = { 1, 2, 6, 8, 16 };
+#define NUM_BENCH_CHANNELS (sizeof(channels)/sizeof(channels[0]))
+
+static snd_pcm_format_t formats[] = {
+    SND_PCM_FORMAT_S16_LE,
+    SND_PCM_FORMAT_S32_LE,
+    SND_PCM_FORMAT_FLOAT_LE
+};
+#define NUM_BENCH_FORMATS (sizeof(formats)/sizeof(formats[0]))
+
+typedef struct
+{
+    snd_pcm_format_t src;
+    snd_pcm_format_t dst;
+} bench_conv_t;
+
+static bench_conv_t conversions[] = {
+    { SND_PCM_FORMAT_S16_LE,   SND_PCM_FORMAT_S16_BE },
+    { SND_PCM_FORMAT_S16_LE,   SND_PCM_FORMAT_S32_LE },
+    { SND_PCM_FORMAT_S32_LE,   SND_PCM_FORMAT_S16_LE },
+    { SND_PCM_FORMAT_U16_BE,   SND_PCM_FORMAT_S32_LE },
+    { SND_PCM_FORMAT_U8,       SND_PCM_FORMAT_S16_LE },
+    { SND_PCM_FORMAT_FLOAT_LE, SND_PCM_FORMAT_S16_LE },
+    { SND_PCM_FORMAT_S16_LE,   SND_PCM_FORMAT_FLOAT_LE },
+    { SND_PCM_FORMAT_S16_LE,   SND_PCM_FORMAT_A_LAW },
+    { SND_PCM_FORMAT_A_LAW,    SND_PCM_FORMAT_S16_LE },
+    { SND_PCM_FORMAT_S16_LE,   SND_PCM_FORMAT_MU_LAW },
+    { SND_PCM_FORMAT_MU_LAW,   SND_PCM_FORMAT_S16_LE },
+};
+#define NUM_BENCH_CONV (sizeof(conversions)/sizeof(conversions[0]))
+
+typedef struct _bench_t
+{
+    snd_pcm_format_t fmt;
+    size_t nsrc;                      // source channels
+    size_t ndst;                      // destination channels
+    size_t frames;                    // frames per call
+    uint8_t* src;
+    uint8_t* dst;
+    void*  src_ptr[MAX_CHANNELS];     // source channels (non interleaved)
+    size_t src_stride[MAX_CHANNELS];
+    void*  dst_ptr[MAX_CHANNEL_OP];   // destination channels
+    size_t dst_stride[MAX_CHANNEL_OP];
+    uint8_t channel_map[MAX_CHANNEL_MAP];
+    acast_channel_ctx_t ctx;
+    acast_convert_t conv;
+    char* filename;
+    int sock;                         // loopback send socket
+    acast_batch_t* batch;
+    struct sockaddr_in addr[NET_CLIENTS];
+    acast_t header;
+    size_t data_len;
+    void (*run)(struct _bench_t* b);
+} bench_t;
+
+typedef struct
+{
+    char group[16];
+    char name[32];
+    char format[32];
+    int  channels;
+    double ns_per_frame;
+    double gb_per_s;
+} bench_result_t;
+
+static bench_result_t result[MAX_RESULTS];
+static int num_results = 0;
+
+void help(void)
+{
+printf("usage: acast_bench [options]\n"
+"  -h, --help      print help\n"
+"  -v, --verbose   increase verbosity\n"
+"  -t, --time      min time per benchmark in ms (%d)\n"
+"  -j, --json      write results as json to file\n"
+"  -f, --file      also time decoding of audio file (wav/mp3)\n"
+"  -s, --sim       run the clock drift and sync simulations instead (slow)\n",
+       BENCH_TIME);
+}
+
+static void fill_random(uint8_t* ptr, size_t len)
+{
+    while(len--)
+	*ptr++ = rand();
+}
+
+// float samples must be in range [-1,1] and not NaN
+static void fill_samples(snd_pcm_format_t fmt, uint8_t* ptr, size_t n)
+{
+    size_t i;
+
+    switch(fmt) {
+    case SND_PCM_FORMAT_FLOAT_LE:
+	for (i = 0; i < n; i++)
+	    ((float*)ptr)[i] = (rand()*2.0/RAND_MAX) - 1.0;
+	break;
+    case SND_PCM_FORMAT_FLOAT64_LE:
+	for (i = 0; i < n; i++)
+	    ((double*)ptr)[i] = (rand()*2.0/RAND_MAX) - 1.0;
+	break;
+    default:
+	fill_random(ptr, n*snd_pcm_format_physical_width(fmt)/8);
+	break;
+    }
+}
+
+// point src_ptr at interleaved src and dst_ptr at planar dst
+static void bench_setup_ptr(bench_t* b)
+{
+    size_t bytes_per_channel = snd_pcm_format_physical_width(b->fmt)/8;
+    size_t i;
+
+    for (i = 0; i < b->nsrc; i++) {
+	b->src_ptr[i] = b->src + i*bytes_per_channel;
+	b->src_stride[i] = b->nsrc;
+    }
+    for (i = 0; i < MAX_CHANNEL_OP; i++) {
+	b->dst_ptr[i] = b->dst + i*b->frames*bytes_per_channel;
+	b->dst_stride[i] = 1;
+    }
+}
+
+// run b->run until at least bench_time us has passed, return ns per call
+static double bench_measure(bench_t* b, tick_t bench_time)
+{
+    tick_t t0, t1;
+    uint64_t calls = 0;
+    uint64_t n = 1;
+
+    (b->run)(b);  // warm up
+    t0 = time_tick_now();
+    do {
+	uint64_t i;
+	for (i = 0; i < n; i++)
+	    (b->run)(b);
+	calls += n;
+	n += n;
+	t1 = time_tick_now();
+    } while((t1 - t0) < bench_time);
+    return (1000.0*(t1 - t0)) / calls;
+}
+
+static void add_result(char* group, char* name, char* format, int nchannels,
+		       double ns_per_call, size_t frames, size_t bytes)
+{
+    bench_result_t* r;
+
+    if (num_results >= MAX_RESULTS)
+	return;
+    r = &result[num_results++];
+    snprintf(r->group, sizeof(r->group), "%s", group);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->format, sizeof(r->format), "%s", format);
+    r->channels = nchannels;
+    r->ns_per_frame = ns_per_call / frames;
+    r->gb_per_s = bytes / ns_per_call;
+    printf("%-8s %-20s %-16s %3d %10.3f %8.3f\n",
+	   r->group, r->name, r->format, r->channels,
+	   r->ns_per_frame, r->gb_per_s);
+}
+
+static void bench(char* group, char* name, char* format, bench_t* b,
+		  tick_t bench_time, size_t bytes)
+{
+    double ns = bench_measure(b, bench_time);
+    add_result(group, name, format, b->nsrc, ns, b->frames, bytes);
+}
+
+static void run_permute_ii(bench_t* b)
+{
+    permute_ii(b->fmt, b->src, b->nsrc, b->dst, b->ndst,
+	       b->channel_map, b->frames);
+}
+
+static void run_permute_ni(bench_t* b)
+{
+    permute_ni(b->fmt, b->src_ptr, b->src_stride, b->nsrc,
+	       b->dst, b->ndst, b->channel_map, b->frames);
+}
+
+static void run_scatter_gather_ii(bench_t* b)
+{
+    scatter_gather_ii(b->fmt, b->src, b->nsrc, b->dst, b->ndst,
+		      b->ctx.channel_op, b->ctx.num_channel_ops, b->frames);
+}
+
+static void run_scatter_gather_ni(bench_t* b)
+{
+    scatter_gather_ni(b->fmt, b->src_ptr, b->src_stride, b->nsrc,
+		      b->dst, b->ndst,
+		      b->ctx.channel_op, b->ctx.num_channel_ops, b->frames);
+}
+
+static void run_scatter_gather_nn(bench_t* b)
+{
+    scatter_gather_nn(b->fmt, b->src_ptr, b->src_stride, b->nsrc,
+		      b->dst_ptr, b->dst_stride, b->ndst,
+		      b->ctx.channel_op, b->ctx.num_channel_ops, b->frames);
+}
+
+static void run_channel_prog_ii(bench_t* b)
+{
+    channel_prog_ii(b->fmt, b->src, b->nsrc, b->dst, b->ndst,
+		    &b->ctx.prog, b->frames);
+}
+
+static void run_matrix_ii(bench_t* b)
+{
+    matrix_ii(b->fmt, b->src, b->nsrc, b->dst, b->ndst,
+	      &b->ctx.matrix, b->frames);
+}
+
+static void run_convert(bench_t* b)
+{
+    acast_convert(&b->conv, b->src, b->dst, b->frames*b->nsrc);
+}
+
+static void run_alaw_encode_block(bench_t* b)
+{
+    g711_alaw_encode_block((int16_t*)b->src, b->dst, b->frames);
+}
+
+static void run_alaw_decode_block(bench_t* b)
+{
+    g711_alaw_decode_block(b->src, (int16_t*)b->dst, b->frames);
+}
+
+static void run_ulaw_encode_block(bench_t* b)
+{
+    g711_ulaw_encode_block((int16_t*)b->src, b->dst, b->frames);
+}
+
+static void run_ulaw_decode_block(bench_t* b)
+{
+    g711_ulaw_decode_block(b->src, (int16_t*)b->dst, b->frames);
+}
+
+static void run_linear2alaw(bench_t* b)
+{
+    int16_t* src = (int16_t*) b->src;
+    size_t i;
+    for (i = 0; i < b->frames; i++)
+	b->dst[i] = linear2alaw(src[i]);
+}
+
+static void run_alaw2linear(bench_t* b)
+{
+    int16_t* dst = (int16_t*) b->dst;
+    size_t i;
+    for (i = 0; i < b->frames; i++)
+	dst[i] = alaw2linear(b->src[i]);
+}
+
+static void run_crc32(bench_t* b)
+{
+    *((uint32_t*)b->dst) = crc32(b->src, b->frames);
+}
+
+static void run_crc32c(bench_t* b)
+{
+    *((uint32_t*)b->dst) = crc32c(b->src, b->frames);
+}
+
+// one frame is one packet, NET_SEGMENTS packets to each client
+static void run_send(bench_t* b)
+{
+    size_t k;
+    int i;
+
+    acast_batch_reset(b->batch);
+    for (k = 0; k < NET_SEGMENTS; k++) {
+	for (i = 0; i < NET_CLIENTS; i++)
+	    acast_batch_add(b->batch, &b->addr[i], sizeof(b->addr[i]),
+			    &b->header, sizeof(acast_t),
+			    b->src, b->data_len, NULL, 0);
+    }
+    acast_batch_send(b->batch, b->sock);
+}
+
+// read the whole file, return number of frames read
+static size_t read_file(bench_t* b)
+{
+    acast_file_t* af;
+    acast_buffer_t abuf;
+    size_t frames = 0;
+    int n;
+
+    if ((af = acast_file_open(b->filename, O_RDONLY)) == NULL)
+	return 0;
+    b->nsrc = af->param.channels_per_frame;
+    b->fmt = af->param.format;
+    while((n = acast_file_read(af, &abuf, b->dst, BUFFER_SIZE,
+			       NUM_FRAMES)) > 0)
+	frames += n;
+    acast_file_close(af);
+    return frames;
+}
+
+static void run_read_file(bench_t* b)
+{
+    read_file(b);
+}
+
+static void put_u16le(uint8_t* ptr, uint16_t v)
+{
+    ptr[0] = v;
+    ptr[1] = v >> 8;
+}
+
+static void put_u32le(uint8_t* ptr, uint32_t v)
+{
+    ptr[0] = v;
+    ptr[1] = v >> 8;
+    ptr[2] = v >> 16;
+    ptr[3] = v >> 24;
+}
+
+// create a temporary S16_LE wav file filled with noise
+static int make_wav_file(char* filename, size_t num_frames)
+{
+    uint32_t bytes_per_frame = WAV_CHANNELS*2;
+    uint32_t data_len = num_frames*bytes_per_frame;
+    uint8_t hdr[44];
+    uint8_t* buf;
+    int fd;
+    int r = 0;
+
+    if ((fd = mkstemps(filename, 4)) < 0)
+	return -1;
+    memcpy(hdr, "RIFF", 4);
+    put_u32le(hdr+4, 36 + data_len);
+    memcpy(hdr+8, "WAVEfmt ", 8);
+    put_u32le(hdr+16, 16);
+    put_u16le(hdr+20, WAVE_FORMAT_PCM);
+    put_u16le(hdr+22, WAV_CHANNELS);
+    put_u32le(hdr+24, WAV_RATE);
+    put_u32le(hdr+28, WAV_RATE*bytes_per_frame);
+    put_u16le(hdr+32, bytes_per_frame);
+    put_u16le(hdr+34, 16);
+    memcpy(hdr+36, "data", 4);
+    put_u32le(hdr+40, data_len);
+
+    if ((buf = malloc(data_len)) == NULL) {
+	close(fd);
+	unlink(filename);
+	return -1;
+    }
+    fill_random(buf, data_len);
+    if ((write(fd, hdr, sizeof(hdr)) != sizeof(hdr)) ||
+	(write(fd, buf, data_len) != data_len))
+	r = -1;
+    free(buf);
+    close(fd);
+    if (r < 0)
+	unlink(filename);
+    return r;
+}
+
+static void bench_maps(bench_t* b, tick_t bench_time)
+{
+    int f, c;
+
+    for (f = 0; f < NUM_BENCH_FORMATS; f++) {
+	char* format;
+
+	b->fmt = formats[f];
+	format = (char*) snd_pcm_format_name(b->fmt);
+	for (c = 0; c < NUM_BENCH_CHANNELS; c++) {
+	    size_t bytes_per_channel = snd_pcm_format_physical_width(b->fmt)/8;
+	    size_t i;
+
+	    b->nsrc = channels[c];
+	    b->ndst = (b->nsrc < MAX_CHANNEL_MAP) ? b->nsrc : MAX_CHANNEL_MAP;
+	    b->frames = NUM_FRAMES;
+	    fill_samples(b->fmt, b->src, b->nsrc*b->frames);
+	    bench_setup_ptr(b);
+	    // reverse channel order
+	    for (i = 0; i < b->ndst; i++)
+		b->channel_map[i] = b->nsrc - 1 - i;
+
+	    b->run = run_permute_ii;
+	    bench("map", "permute_ii", format, b, bench_time,
+		  b->frames*(b->nsrc+b->ndst)*bytes_per_channel);
+	    b->run = run_permute_ni;
+	    bench("map", "permute_ni", format, b, bench_time,
+		  b->frames*(b->nsrc+b->ndst)*bytes_per_channel);
+	}
+    }
+}
+
+// generate op map "+01234.." (channel 0 and 1 mixed, the rest copied)
+// with at most MAX_CHANNEL_MAP output channels
+static int bench_op_map(char* map, int nchannels)
+{
+    int n = (nchannels <= MAX_CHANNEL_MAP) ? nchannels : MAX_CHANNEL_MAP+1;
+    int i;
+
+    if (nchannels < 2)
+	return -1;
+    *map++ = '+';
+    for (i = 0; i < n; i++)
+	*map++ = '0' + i;
+    *map = '\0';
+    return 0;
+}
+
+static int bench_ops(bench_t* b, tick_t bench_time, uint8_t* dst2)
+{
+    int errors = 0;
+    int f, c;
+
+    for (f = 0; f < NUM_BENCH_FORMATS; f++) {
+	char* format;
+
+	b->fmt = formats[f];
+	format = (char*) snd_pcm_format_name(b->fmt);
+	for (c = 0; c < NUM_BENCH_CHANNELS; c++) {
+	    size_t bytes_per_channel = snd_pcm_format_physical_width(b->fmt)/8;
+	    size_t frame_bytes;
+	    char map[16];
+	    int ndst = 0;
+
+	    if (bench_op_map(map, channels[c]) < 0)
+		continue;
+	    b->nsrc = channels[c];
+	    b->frames = NUM_FRAMES;
+	    if (parse_channel_ctx(map, &b->ctx, b->nsrc, &ndst) < 0) {
+		fprintf(stderr, "map syntax error %s\n", map);
+		exit(1);
+	    }
+	    if (verbose)
+		print_channel_ctx(stdout, &b->ctx);
+	    b->ndst = ndst;
+	    fill_samples(b->fmt, b->src, b->nsrc*b->frames);
+	    bench_setup_ptr(b);
+	    frame_bytes = (b->nsrc+b->ndst)*bytes_per_channel;
+
+	    b->run = run_scatter_gather_ii;
+	    bench("op", "scatter_gather_ii", format, b, bench_time,
+		  b->frames*frame_bytes);
+	    memcpy(dst2, b->dst, b->frames*b->ndst*bytes_per_channel);
+
+	    b->run = run_channel_prog_ii;
+	    bench("op", "channel_prog_ii", format, b, bench_time,
+		  b->frames*frame_bytes);
+	    if (memcmp(dst2, b->dst, b->frames*b->ndst*bytes_per_channel)!=0) {
+		fprintf(stderr, "%s %s: output mismatch\n", map, format);
+		errors++;
+	    }
+
+	    b->run = run_scatter_gather_ni;
+	    bench("op", "scatter_gather_ni", format, b, bench_time,
+		  b->frames*frame_bytes);
+	    b->run = run_scatter_gather_nn;
+	    bench("op", "scatter_gather_nn", format, b, bench_time,
+		  b->frames*frame_bytes);
+	}
+    }
+    return errors;
+}
+
+// downmix all channels to stereo
+static void bench_matrix(bench_t* b, tick_t bench_time)
+{
+    int f, c;
+
+    for (f = 0; f < NUM_BENCH_FORMATS; f++) {
+	char* format;
+
+	b->fmt = formats[f];
+	format = (char*) snd_pcm_format_name(b->fmt);
+	for (c = 0; c < NUM_BENCH_CHANNELS; c++) {
+	    size_t bytes_per_channel = snd_pcm_format_physical_width(b->fmt)/8;
+	    char map[2*MAX_MATRIX_IN*5+2];
+	    char* ptr = map;
+	    int i, j;
+
+	    b->nsrc = channels[c];
+	    b->ndst = 2;
+	    b->frames = NUM_FRAMES;
+	    for (i = 0; i < b->ndst; i++) {
+		for (j = 0; j < b->nsrc; j++)
+		    ptr += sprintf(ptr, "%s%s", j ? "," : (i ? "/" : ""),
+				   ((j & 1) == i) ? "0.5" : "0.1");
+	    }
+	    if (parse_channel_matrix(map, &b->ctx.matrix, b->nsrc) < 0) {
+		fprintf(stderr, "matrix syntax error %s\n", map);
+		exit(1);
+	    }
+	    fill_samples(b->fmt, b->src, b->nsrc*b->frames);
+	    b->run = run_matrix_ii;
+	    bench("matrix", "matrix_ii", format, b, bench_time,
+		  b->frames*(b->nsrc+b->ndst)*bytes_per_channel);
+	}
+    }
+}
+
+static void bench_convert(bench_t* b, tick_t bench_time)
+{
+    int i;
+
+    for (i = 0; i < NUM_BENCH_CONV; i++) {
+	char format[32];
+
+	if (acast_convert_setup(&b->conv, conversions[i].src,
+				conversions[i].dst) < 0) {
+	    fprintf(stderr, "conversion %s -> %s not supported\n",
+		    snd_pcm_format_name(conversions[i].src),
+		    snd_pcm_format_name(conversions[i].dst));
+	    continue;
+	}
+	snprintf(format, sizeof(format), "%s>%s",
+		 snd_pcm_format_name(conversions[i].src),
+		 snd_pcm_format_name(conversions[i].dst));
+	b->fmt = conversions[i].src;
+	b->nsrc = 2;
+	b->frames = NUM_FRAMES;
+	fill_samples(b->fmt, b->src, b->nsrc*b->frames);
+	b->run = run_convert;
+	bench("convert", "acast_convert", format, b, bench_time,
+	      b->frames*b->nsrc*(b->conv.src_bytes+b->conv.dst_bytes));
+    }
+}
+
+// one frame is one mono sample
+static void bench_g711(bench_t* b, tick_t bench_time)
+{
+    b->nsrc = 1;
+    b->frames = NUM_FRAMES;
+    fill_random(b->src, 2*b->frames);
+
+    b->run = run_alaw_encode_block;
+    bench("g711", "alaw_encode_block", "S16_LE>A_LAW", b, bench_time,
+	  3*b->frames);
+    b->run = run_linear2alaw;
+    bench("g711", "linear2alaw", "S16_LE>A_LAW", b, bench_time,
+	  3*b->frames);
+    b->run = run_ulaw_encode_block;
+    bench("g711", "ulaw_encode_block", "S16_LE>MU_LAW", b, bench_time,
+	  3*b->frames);
+    b->run = run_alaw_decode_block;
+    bench("g711", "alaw_decode_block", "A_LAW>S16_LE", b, bench_time,
+	  3*b->frames);
+    b->run = run_alaw2linear;
+    bench("g711", "alaw2linear", "A_LAW>S16_LE", b, bench_time,
+	  3*b->frames);
+    b->run = run_ulaw_decode_block;
+    bench("g711", "ulaw_decode_block", "MU_LAW>S16_LE", b, bench_time,
+	  3*b->frames);
+}
+
+// one frame is one byte
+static void bench_crc32(bench_t* b, tick_t bench_time)
+{
+    size_t len[] = { 1472, 65536 };
+    int i;
+
+    fill_random(b->src, BUFFER_SIZE);
+    b->nsrc = 1;
+    for (i = 0; i < sizeof(len)/sizeof(len[0]); i++) {
+	char name[32];
+	snprintf(name, sizeof(name), "crc32 %zu", len[i]);
+	b->frames = len[i];
+	b->run = run_crc32;
+	bench("crc", name, "U8", b, bench_time, b->frames);
+	snprintf(name, sizeof(name), "crc32c %zu", len[i]);
+	b->run = run_crc32c;
+	bench("crc", name, "U8", b, bench_time, b->frames);
+    }
+}
+
+// send full S32_LE packets over loopback, receivers are never read so
+// the time includes kernel delivery up to the (full) socket queue
+static void bench_send(bench_t* b, tick_t bench_time)
+{
+    int rsock[NET_CLIENTS];
+    size_t segments = NET_SEGMENTS;
+    struct sockaddr_in saddr;
+    socklen_t saddrlen;
+    size_t packet_len;
+    char name[32];
+    int i;
+
+    if ((b->sock = acast_usender_open("127.0.0.1", "127.0.0.1", 1,
+				      &saddr, &saddrlen,
+				      NET_CLIENTS*NET_SEGMENTS*BYTES_PER_PACKET,
+				      &segments)) < 0) {
+	fprintf(stderr, "unable to open send socket\n");
+	return;
+    }
+    for (i = 0; i < NET_CLIENTS; i++) {
+	socklen_t len = sizeof(b->addr[i]);
+	rsock[i] = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&b->addr[i], 0, sizeof(b->addr[i]));
+	b->addr[i].sin_family = AF_INET;
+	b->addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(rsock[i], (struct sockaddr*) &b->addr[i], len);
+	getsockname(rsock[i], (struct sockaddr*) &b->addr[i], &len);
+    }
+    memset(&b->header, 0, sizeof(acast_t));
+    b->header.magic = ACAST_MAGIC;
+    b->header.param.format = SND_PCM_FORMAT_S32_LE;
+    b->header.param.channels_per_frame = NET_CHANNELS;
+    b->header.param.bits_per_channel = 32;
+    b->header.param.bytes_per_channel = 4;
+    b->header.param.sample_rate = 96000;
+    b->header.num_frames = acast_get_frames_per_packet(&b->header.param,
+						       BYTES_PER_PACKET);
+    b->data_len = b->header.num_frames*NET_CHANNELS*4;
+    packet_len = sizeof(acast_t) + b->data_len;
+    fill_random(b->src, b->data_len);
+
+    b->nsrc = NET_CHANNELS;
+    b->frames = NET_CLIENTS*NET_SEGMENTS;
+    b->run = run_send;
+    b->batch = acast_batch_new(NET_CLIENTS*NET_SEGMENTS, 1);
+    snprintf(name, sizeof(name), "sendmmsg %dx%d", NET_CLIENTS, NET_SEGMENTS);
+    bench("net", name, "S32_LE", b, bench_time, b->frames*packet_len);
+    acast_batch_free(b->batch);
+
+    if (segments > 1) {
+	b->batch = acast_batch_new(NET_CLIENTS*NET_SEGMENTS, segments);
+	snprintf(name, sizeof(name), "udp_segment %dx%d",
+		 NET_CLIENTS, NET_SEGMENTS);
+	bench("net", name, "S32_LE", b, bench_time, b->frames*packet_len);
+	if (acast_batch_segments(b->batch) == 1)
+	    fprintf(stderr, "UDP_SEGMENT refused on loopback\n");
+	acast_batch_free(b->batch);
+    }
+    else
+	fprintf(stderr, "UDP_SEGMENT not supported\n");
+
+    for (i = 0; i < NET_CLIENTS; i++)
+	close(rsock[i]);
+    close(b->sock);
+}
+
+static void bench_file(bench_t* b, char* filename, tick_t bench_time)
+{
+    size_t bytes_per_channel;
+    char* format;
+
+    b->filename = filename;
+    if ((b->frames = read_file(b)) == 0) {
+	fprintf(stderr, "unable to read %s\n", filename);
+	return;
+    }
+    bytes_per_channel = snd_pcm_format_physical_width(b->fmt)/8;
+    format = (char*) snd_pcm_format_name(b->fmt);
+    b->run = run_read_file;
+    bench("file", "acast_file_read", format, b, bench_time,
+	  b->frames*b->nsrc*bytes_per_channel);
+}
+
+// resample a full scale -6dB sine at ratio and compare with the sine at
+// the input position of each output frame, the resampler lags two
+// frames. at ratio 1 the input must come through unchanged.
+// return 1 if the SNR is below SNR_MIN or ratio 1 changes samples
+static int sim_snr(double ratio)
+{
+    acast_resample_t* rs;
+    int16_t in[SIM_FRAMES*2];
+    int16_t out[SIM_FRAMES*4*2];
+    double f = SNR_TONE / SIM_RATE;
+    double a = 16384.0;
+    double err2 = 0, sig2 = 0, snr;
+    uint64_t tin = 0, tout = 0;
+    uint64_t changed = 0;
+    size_t i, n;
+    int fail;
+
+    if ((rs = acast_resample_new()) == NULL) {
+	fprintf(stderr, "unable to allocate resampler\n");
+	exit(1);
+    }
+    acast_resample_setup(rs, SND_PCM_FORMAT_S16_LE, 2);
+    acast_resample_set_ratio(rs, ratio);
+    while(tin < (uint64_t) SNR_SECONDS*SIM_RATE) {
+	for (i = 0; i < SIM_FRAMES; i++)
+	    in[2*i] = in[2*i+1] = lrint(a*sin(2*M_PI*f*(tin + i)));
+	n = acast_resample(rs, in, SIM_FRAMES, out, SIM_FRAMES*4);
+	for (i = 0; i < n; i++) {
+	    double p = (tout + i)*ratio - 2.0;
+	    double e;
+
+	    if ((tout + i) < SIM_FRAMES)  // history filled
+		continue;
+	    e = out[2*i] - a*sin(2*M_PI*f*p);
+	    err2 += e*e;
+	    sig2 += a*a/2;
+	    if ((ratio == 1.0) && (out[2*i] != lrint(a*sin(2*M_PI*f*p))))
+		changed++;
+	}
+	tin += SIM_FRAMES;
+	tout += n;
+    }
+    acast_resample_free(rs);
+    snr = 10*log10(sig2/err2);
+    fail = (snr < SNR_MIN) || changed;
+    printf("resample ratio %.4f: %.7f measured, snr %.1fdB",
+	   ratio, (double) tin / tout, snr);
+    if (ratio == 1.0)
+	printf(", %lu samples changed", (unsigned long) changed);
+    printf(" %s\n", fail ? "FAIL" : "ok");
+    return fail;
+}
+
+// a sender with its clock ppm off sends packets for DRIFT_HOURS, the
+// receiver plays them from the jitter buffer through the resampler
+// into a device kept two packets full, the device clock is the
+// reference. the speed is set on packet arrival from the frames queued
+// in the jitter buffer and the device, as acast_receiver does.
+// without the resampler the jitter buffer runs over or under, with it
+// the latency must stay within one packet after SIM_SETTLE seconds
+// with no xruns, overflows or underruns. return 1 if it does not
+static int sim_drift(double ppm, int use_rs)
+{
+    acast_jitter_t* jb = acast_jitter_new(64, SIM_FRAMES*4);
+    acast_resample_t* rs = acast_resample_new();
+    acast_jitter_stats_t st;
+    acast_drift_t drift;
+    int16_t pkt[SIM_FRAMES*2];
+    int16_t out[SIM_FRAMES*4*2];
+    double period = SIM_FRAMES*1e6/(SIM_RATE*(1 + ppm*1e-6));
+    double send_time = 0;
+    double delay = 0;      // frames queued in the device
+    double min_latency = 1e9, max_latency = 0;
+    uint32_t seqno = 0;
+    uint64_t xruns = 0;
+    uint64_t t;
+    int fail;
+
+    if (!jb || !rs) {
+	fprintf(stderr, "unable to allocate simulation\n");
+	exit(1);
+    }
+    acast_jitter_set_latency(jb, 10000, 200000);
+    acast_jitter_reset(jb, SIM_RATE);
+    acast_resample_setup(rs, SND_PCM_FORMAT_S16_LE, 2);
+    acast_drift_reset(&drift, SIM_RATE);
+    memset(pkt, 0, sizeof(pkt));
+
+    for (t = 0; t < DRIFT_HOURS*3600*1000000ULL; t += SIM_STEP) {
+	while(send_time <= t) {
+	    int r = acast_jitter_put(jb, seqno, (tick_t) t,
+				     pkt, sizeof(pkt), SIM_FRAMES);
+	    if ((r == ACAST_JITTER_STORED) && use_rs && (seqno > 0)) {
+		acast_jitter_stats(jb, &st);
+		acast_drift_update(&drift, (double) st.depth + delay -
+				   (double)(st.target + 2*SIM_FRAMES),
+				   SIM_FRAMES);
+		acast_resample_set_ratio(rs, drift.ratio);
+	    }
+	    seqno++;
+	    send_time += period;
+	}
+	delay -= (double) SIM_RATE*SIM_STEP/1000000;
+	if (delay < 0) {
+	    if (t > 1000000)
+		xruns++;
+	    delay = 0;
+	}
+	while(delay < 2*SIM_FRAMES) {
+	    uint8_t* data;
+	    size_t num_frames;
+
+	    switch(acast_jitter_get(jb, &data, &num_frames)) {
+	    case ACAST_JITTER_WAIT:
+		num_frames = SIM_FRAMES;
+		// fall through
+	    case ACAST_JITTER_LOST:
+		data = (uint8_t*) pkt;
+		break;
+	    default:
+		break;
+	    }
+	    if (use_rs)
+		delay += acast_resample(rs, data, num_frames,
+					out, SIM_FRAMES*4);
+	    else
+		delay += num_frames;
+	}
+	if (t >= SIM_SETTLE*1000000ULL) {
+	    double latency;
+
+	    acast_jitter_stats(jb, &st);
+	    latency = st.depth + delay;
+	    if (latency < min_latency)
+		min_latency = latency;
+	    if (latency > max_latency)
+		max_latency = latency;
+	}
+    }
+    acast_jitter_stats(jb, &st);
+    fail = use_rs && (xruns || st.overflow || st.underrun ||
+		      (max_latency - min_latency > SIM_FRAMES));
+    printf("drift %+4.0fppm %dh %-13s: estimate %+6.1fppm, latency "
+	   "%.0f-%.0f frames, %lu xruns, %lu overflows, %lu underruns %s\n",
+	   ppm, DRIFT_HOURS, use_rs ? "resampled" : "not resampled",
+	   acast_drift_ppm(&drift), min_latency, max_latency,
+	   (unsigned long) xruns, (unsigned long) st.overflow,
+	   (unsigned long) st.underrun,
+	   use_rs ? (fail ? "FAIL" : "ok") : "");
+    acast_resample_free(rs);
+    acast_jitter_free(jb);
+    return fail;
+}
+
+typedef struct
+{
+    double sender_ppm;
+    double device_ppm;
+    double net_delay;     // us, plus 0-2ms jitter
+    double start;         // us, receiver start
+} sim_sync_t;
+
+typedef struct
+{
+    double time;          // arrival
+    uint32_t seqno;
+    int sr;               // sender report ahead of the packet
+} sim_arrival_t;
+
+// a sender reports the capture time of a packet once a second ahead of
+// the packet, every SYNC_SHORT packet is half size. the receiver plays
+// at capture time plus SYNC_DELAY ms, it holds the packet at its
+// presentation time from the media time counted since the report, as
+// acast_receiver does, and steps errors above SYNC_MAX_SKEW. the error
+// is the play time of the first frame of each packet minus its
+// presentation time. after SYNC_SETTLE seconds it must stay within
+// SYNC_MAX_ERROR, with the single step at start. return 1 if not
+static int sim_sync(sim_sync_t* c)
+{
+    acast_jitter_t* jb = acast_jitter_new(64, SIM_FRAMES*4);
+    acast_resample_t* rs = acast_resample_new();
+    acast_jitter_stats_t st;
+    acast_drift_t drift;
+    int16_t pkt[SIM_FRAMES*2];
+    int16_t out[SIM_FRAMES*4*2];
+    double sender_rate = SIM_RATE*(1 + c->sender_ppm*1e-6);
+    double device_rate = SIM_RATE*(1 + c->device_ppm*1e-6);
+    static uint64_t media[SYNC_HISTORY];   // sender media time per seqno
+    sim_arrival_t arr[64];
+    size_t narr = 0;
+    uint32_t seqno = 0;          // sender
+    uint64_t sent = 0;           // frames sent
+    double next_sr = 0;
+    uint32_t sr_seqno = 0;       // receiver, latest report
+    uint64_t sr_timestamp = 0;
+    double sr_wallclock = 0;
+    int have_sr = 0;
+    uint32_t media_seqno = 0;
+    uint64_t media_next = 0;
+    uint64_t media_time = 0;
+    double delay = 0;
+    long skew = 0;
+    int seen = 0;
+    int playing = 0;
+    uint64_t steps = 0;
+    double max_error = 0, sum_error = 0;
+    uint64_t num_errors = 0;
+    double t;
+    int fail;
+
+    if (!jb || !rs) {
+	fprintf(stderr, "unable to allocate simulation\n");
+	exit(1);
+    }
+    acast_jitter_set_latency(jb, 10000, 200000);
+    acast_jitter_reset(jb, SIM_RATE);
+    acast_resample_setup(rs, SND_PCM_FORMAT_S16_LE, 2);
+    acast_drift_reset(&drift, SIM_RATE);
+    memset(pkt, 0, sizeof(pkt));
+    srand((int)(c->net_delay + c->device_ppm));
+
+    for (t = 0; t < SYNC_MINUTES*60*1e6; t += SYNC_STEP) {
+	size_t i;
+
+	// sender, packets captured by now
+	while(1) {
+	    size_t nf = ((seqno % SYNC_SHORT) == SYNC_SHORT-1) ?
+		SIM_FRAMES/2 : SIM_FRAMES;
+	    double cap = sent*1e6/sender_rate;
+
+	    if ((sent + nf)*1e6/sender_rate > t)
+		break;
+	    media[seqno % SYNC_HISTORY] = sent;
+	    if ((t >= c->start) && (narr < 64)) {
+		arr[narr].time = t + c->net_delay + (rand() % 2000);
+		arr[narr].seqno = seqno;
+		arr[narr].sr = (cap >= next_sr);
+		narr++;
+	    }
+	    if (cap >= next_sr)
+		next_sr = cap + 1e6;
+	    sent += nf;
+	    seqno++;
+	}
+	if (seen) {
+	    delay -= device_rate*SYNC_STEP/1e6;
+	    if (delay < 0)
+		delay = 0;
+	}
+
+	// receiver, packets arrived by now
+	for (i = 0; i < narr; ) {
+	    uint32_t s = arr[i].seqno;
+	    uint64_t m = media[s % SYNC_HISTORY];
+	    size_t nf = ((s % SYNC_SHORT) == SYNC_SHORT-1) ?
+		SIM_FRAMES/2 : SIM_FRAMES;
+	    int32_t d;
+	    int r;
+
+	    if (arr[i].time > t) {
+		i++;
+		continue;
+	    }
+	    if (arr[i].sr) {  // sender wall clock within 20us
+		sr_seqno = s;
+		sr_timestamp = m;
+		sr_wallclock = m*1e6/sender_rate + (rand() % 40) - 20;
+		have_sr = 1;
+		media_seqno = sr_seqno;
+		media_next = sr_timestamp;
+	    }
+	    arr[i] = arr[--narr];
+
+	    r = acast_jitter_put(jb, s, (tick_t) t, pkt, nf*4, nf);
+	    if (have_sr) {
+		d = (int32_t)(s - media_seqno);
+		media_time = media_next + (int64_t) d*nf;
+		if (d >= 0) {
+		    media_seqno = s + 1;
+		    media_next = media_time + nf;
+		}
+	    }
+	    if (!seen) {
+		delay = 2*SIM_FRAMES;
+		seen = 1;
+	    }
+	    if ((r == ACAST_JITTER_STORED) && playing) {
+		double error;
+
+		acast_jitter_stats(jb, &st);
+		if (have_sr) {
+		    double ahead = delay - skew +
+			acast_jitter_frames_before(jb, s);
+		    double late = (double)(int64_t)(media_time - sr_timestamp) /
+			SIM_RATE;
+		    double pt = sr_wallclock + late*1e6 + SYNC_DELAY*1000;
+		    double wanted = (pt - t)*SIM_RATE/1e6;
+
+		    error = ahead - wanted;
+		    if (fabs(error) > SYNC_MAX_SKEW*SIM_RATE/1e6) {
+			skew += lround(error);
+			acast_drift_step(&drift);
+			steps++;
+			error = 0;
+		    }
+		}
+		else
+		    error = st.depth + delay - (st.target + 2*SIM_FRAMES);
+		acast_drift_update(&drift, error, nf);
+		acast_resample_set_ratio(rs, drift.ratio);
+	    }
+	}
+
+	// device, keep two packets queued
+	if (!seen)
+	    continue;
+	while(delay < 2*SIM_FRAMES) {
+	    uint8_t* data;
+	    size_t num_frames;
+	    size_t skipped = 0;
+	    int status;
+
+	    if (skew < 0) {
+		num_frames = (-skew < SIM_FRAMES) ? -skew : SIM_FRAMES;
+		delay += acast_resample(rs, pkt, num_frames,
+					out, SIM_FRAMES*4);
+		skew += num_frames;
+		continue;
+	    }
+	    status = acast_jitter_get(jb, &data, &num_frames);
+	    if (status == ACAST_JITTER_WAIT)
+		num_frames = SIM_FRAMES;
+	    else if (skew > 0) {
+		skipped = ((size_t) skew < num_frames) ?
+		    (size_t) skew : num_frames;
+		num_frames -= skipped;
+		skew -= skipped;
+	    }
+	    if (status == ACAST_JITTER_PLAY) {
+		// the resampler lags two frames
+		double play = t + (delay + 2)*1e6/device_rate;
+		double pt;
+		double e;
+
+		acast_jitter_stats(jb, &st);
+		pt = (media[(st.next-1) % SYNC_HISTORY] + skipped)*1e6 /
+		    sender_rate + SYNC_DELAY*1000;
+		e = play - pt;
+		if (t > SYNC_SETTLE*1e6) {
+		    if (fabs(e) > max_error)
+			max_error = fabs(e);
+		    sum_error += e;
+		    num_errors++;
+		}
+		playing = 1;
+	    }
+	    delay += acast_resample(rs, pkt, num_frames, out, SIM_FRAMES*4);
+	}
+    }
+    fail = (max_error > SYNC_MAX_ERROR) || (steps != 1);
+    printf("sync sender %+4.0fppm device %+4.0fppm net %4.0fus "
+	   "start %4.1fs: %lu steps, drift %+6.1fppm, error mean %+.0fus "
+	   "max %.0fus %s\n",
+	   c->sender_ppm, c->device_ppm, c->net_delay, c->start/1e6,
+	   (unsigned long) steps, acast_drift_ppm(&drift),
+	   num_errors ? sum_error/num_errors : 0.0, max_error,
+	   fail ? "FAIL" : "ok");
+    acast_resample_free(rs);
+    acast_jitter_free(jb);
+    return fail;
+}
+
+static int run_sims(void)
+{
+    double ratios[] = { 1.0, 1.0002, 0.9998, 1.001 };
+    double ppm[] = { 200, -200, 30 };
+    sim_sync_t sync[] = {
+	{   20,   50, 1000, 0 },
+	{   20,  -80, 5000, 3.3e6 },
+	{ -100,  100,  300, 7.7e6 }
+    };
+    int errors = 0;
+    int i;
+
+    for (i = 0; i < sizeof(ratios)/sizeof(ratios[0]); i++)
+	errors += sim_snr(ratios[i]);
+    for (i = 0; i < sizeof(ppm)/sizeof(ppm[0]); i++) {
+	if (verbose)
+	    sim_drift(ppm[i], 0);
+	errors += sim_drift(ppm[i], 1);
+    }
+    for (i = 0; i < sizeof(sync)/sizeof(sync[0]); i++)
+	errors += sim_sync(&sync[i]);
+    return errors;
+}
+
+static void write_json(FILE* f, tick_t bench_time)
+{
+    int i;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"frames\": %d,\n", NUM_FRAMES);
+    fprintf(f, "  \"time_ms\": %lu,\n", (unsigned long)(bench_time/1000));
+    fprintf(f, "  \"results\": [\n");
+    for (i = 0; i < num_results; i++) {
+	bench_result_t* r = &result[i];
+	fprintf(f, "    {\"group\": \"%s\", \"name\": \"%s\", "
+		"\"format\": \"%s\", \"channels\": %d, "
+		"\"ns_per_frame\": %.4f, \"gb_per_s\": %.4f}%s\n",
+		r->group, r->name, r->format, r->channels,
+		r->ns_per_frame, r->gb_per_s,
+		(i+1 < num_results) ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+}
+
+int main(int argc, char** argv)
+{
+    tick_t bench_time = time_tick_from_usec(BENCH_TIME*1000);
+    char* json_file = NULL;
+    char* filename = NULL;
+    char wav_file[] = "/tmp/acast_benchXXXXXX.wav";
+    uint8_t* dst2;
+    bench_t b;
+    int errors = 0;
+    int sim = 0;
+
+    while(1) {
+	int option_index = 0;
+	int c;
+	static struct option long_options[] = {
+	    {"help",   no_argument,       0, 'h'},
+	    {"verbose",no_argument,       0, 'v'},
+	    {"time",   required_argument, 0, 't'},
+	    {"json",   required_argument, 0, 'j'},
+	    {"file",   required_argument, 0, 'f'},
+	    {"sim",    no_argument,       0, 's'},
+	    {0,        0,                 0, 0}
+	};
+	c = getopt_long(argc, argv, "hvt:j:f:s", long_options, &option_index);
+	if (c == -1)
+	    break;
+	switch(c) {
+	case 'h':
+	    help();
+	    exit(0);
+	case 'v':
+	    verbose++;
+	    break;
+	case 't':
+	    bench_time = time_tick_from_usec(atoi(optarg)*1000);
+	    break;
+	case 'j':
+	    json_file = optarg;
+	    break;
+	case 'f':
+	    filename = optarg;
+	    break;
+	case 's':
+	    sim = 1;
+	    break;
+	default:
+	    help();
+	    exit(1);
+	}
+    }
+
+    time_tick_init();
+
+    if (sim)
+	exit(run_sims() ? 1 : 0);
+
+    memset(&b, 0, sizeof(b));
+    b.src = calloc(1, BUFFER_SIZE);
+    b.dst = calloc(1, BUFFER_SIZE);
+    dst2 = calloc(1, BUFFER_SIZE);
+
+    printf("%-8s %-20s %-16s %3s %10s %8s\n",
+	   "group", "name", "format", "ch", "ns/frame", "GB/s");
+    bench_maps(&b, bench_time);
+    errors += bench_ops(&b, bench_time, dst2);
+    bench_matrix(&b, bench_time);
+    bench_convert(&b, bench_time);
+    bench_g711(&b, bench_time);
+    bench_crc32(&b, bench_time);
+    bench_send(&b, bench_time);
+
+    if (make_wav_file(wav_file, WAV_SECONDS*WAV_RATE) < 0)
+	fprintf(stderr, "unable to create %s\n", wav_file);
+    else {
+	bench_file(&b, wav_file, bench_time);
+	unlink(wav_file);
+    }
+    if (filename != NULL)
+	bench_file(&b, filename, bench_time);
+
+    if (json_file != NULL) {
+	FILE* f;
+	if ((f = fopen(json_file, "w")) == NULL) {
+	    fprintf(stderr, "unable to open %s\n", json_file);
+	    errors++;
+	}
+	else {
+	    write_json(f, bench_time);
+	    fclose(f);
+	}
+    }
+    free(b.src);
+    free(b.dst);
+    free(dst2);
+    exit(errors ? 1 : 0);
+}
@@ -2,6 +2,7 @@
 //  Channel map operations
 //
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include "acast_channel.h"
@@ -128,6 +129,40 @@ void print_channel_ops(FILE* f, acast_op_t* channel_op, size_t num_ops)
     fprintf(f,"\n");
 }
 
+void print_channel_prog(FILE* f, acast_channel_prog_t* prog)
+{
+    int i;
+    for (i = 0; i < prog->num_ops; i++) {
+	acast_prog_op_t* p = &prog->op[i];
+	if (i > 0) fprintf(f, " ");
+	switch(p->op) {
+	case ACAST_OP_SRC:
+	    if (p->len > 1)
+		fprintf(f, "[%d..%d]=%d..%d", p->dst, p->dst+p->len-1,
+			p->src1, p->src1+p->len-1);
+	    else
+		fprintf(f, "[%d]=%d", p->dst, p->src1);
+	    break;
+	case ACAST_OP_CONST:
+	    fprintf(f, "[%d]=d%d", p->dst, p->src1);
+	    break;
+	case ACAST_OP_ADD:
+	    fprintf(f, "[%d]=+%d%d", p->dst, p->src1, p->src2);
+	    break;
+	case ACAST_OP_ADDC:
+	    fprintf(f, "[%d]=+%dd%d", p->dst, p->src1, p->src2);
+	    break;
+	case ACAST_OP_SUB:
+	    fprintf(f, "[%d]=-%d%d", p->dst, p->src1, p->src2);
+	    break;
+	case ACAST_OP_SUBC:
+	    fprintf(f, "[%d]=-%dd%d", p->dst, p->src1, p->src2);
+	    break;
+	}
+    }
+    fprintf(f,"\n");
+}
+
 void print_channel_ctx(FILE* f, acast_channel_ctx_t* ctx)
 {
     int i;
@@ -148,10 +183,23 @@ void print_channel_ctx(FILE* f, acast_channel_ctx_t* ctx)
 	}
 	fprintf(f, "\n");
 	break;
+    case ACAST_MAP_MATRIX: {
+	int j;
+	fprintf(f, "map_type: matrix\n");
+	for (i = 0; i < ctx->matrix.nout; i++) {
+	    fprintf(f, "     [%d]:", i);
+	    for (j = 0; j < ctx->matrix.nin; j++)
+		fprintf(f, " %g", ctx->matrix.dgain[i][j]);
+	    fprintf(f, "\n");
+	}
+	break;
+    }
     case ACAST_MAP_OP:
 	fprintf(f, "map_type: op\n");
 	fprintf(f, "     map: op\n");	
 	print_channel_ops(f, ctx->channel_op, ctx->num_channel_ops);
+	fprintf(f, "    prog: ");
+	print_channel_prog(f, &ctx->prog);
 	break;
     default:
 	fprintf(f, "  map_type: invalid\n"); break;
@@ -237,10 +285,162 @@ acast_map_type_t parse_channel_map(char* map,
 }
 
 
+// compile channel ops into a channel program, ops are grouped by kind
+// and consecutive ACAST_OP_SRC ops are merged into block copies.
+// Op order is kept if any destination channel is written more than once.
+void compile_channel_ops(acast_op_t* channel_op, size_t num_ops,
+			 acast_channel_prog_t* prog)
+{
+    int order[MAX_CHANNEL_OP];
+    uint32_t dst_mask = 0;
+    int grouped = 1;
+    int i, n;
+
+    if (num_ops > MAX_CHANNEL_OP)
+	num_ops = MAX_CHANNEL_OP;
+
+    for (i = 0; i < num_ops; i++) {
+	int d = channel_op[i].dst;
+	if ((d < 0) || (d >= 32) || (dst_mask & (1 << d)))
+	    grouped = 0;
+	else
+	    dst_mask |= (1 << d);
+    }
+
+    n = 0;
+    if (grouped) {
+	acast_channel_op_t op;
+	for (op = ACAST_OP_SRC; op <= ACAST_OP_SUBC; op++) {
+	    for (i = 0; i < num_ops; i++)
+		if (channel_op[i].op == op) order[n++] = i;
+	}
+    }
+    else {
+	for (i = 0; i < num_ops; i++)
+	    order[n++] = i;
+    }
+
+    prog->num_ops = 0;
+    for (i = 0; i < n; i++) {
+	acast_op_t* op = &channel_op[order[i]];
+	acast_prog_op_t* last = prog->num_ops ?
+	    &prog->op[prog->num_ops-1] : NULL;
+
+	if ((op->op == ACAST_OP_SRC) && last && (last->op == ACAST_OP_SRC) &&
+	    (op->src1 == last->src1 + last->len) &&
+	    (op->dst == last->dst + last->len)) {
+	    last->len++;
+	}
+	else {
+	    acast_prog_op_t* pop = &prog->op[prog->num_ops++];
+	    pop->op   = op->op;
+	    pop->src1 = op->src1;
+	    pop->src2 = op->src2;
+	    pop->dst  = op->dst;
+	    pop->len  = 1;
+	}
+    }
+}
+
+// parse gain matrix "<g00>,<g01>,.../<g10>,<g11>,..." (after the 'm')
+// one row of gains per output channel, one gain per input channel,
+// missing gains are 0. ex 5.1 to stereo:
+//   m1,0,.707,0,.707,0/0,1,.707,0,0,.707
+// return number of output channels or -1 on error
+int parse_channel_matrix(char* map, acast_matrix_t* mx,
+			 int num_input_channels)
+{
+    char* ptr = map;
+    int i = 0, j = 0;
+
+    memset(mx, 0, sizeof(acast_matrix_t));
+    if ((num_input_channels <= 0) || (num_input_channels > MAX_MATRIX_IN))
+	return -1;
+    mx->nin = num_input_channels;
+    while(1) {
+	char* end;
+	double g = strtod(ptr, &end);
+	if ((end == ptr) || (i >= MAX_MATRIX_OUT) || (j >= mx->nin))
+	    return -1;
+	mx->gain[i][j] = g;
+	mx->dgain[i][j] = g;
+	j++;
+	ptr = end;
+	if (*ptr == ',')
+	    ptr++;
+	else if (*ptr == '/') {
+	    ptr++;
+	    i++;
+	    j = 0;
+	}
+	else if (*ptr == '\0')
+	    break;
+	else
+	    return -1;
+    }
+    mx->nout = i+1;
+    return mx->nout;
+}
+
+void compile_channel_ctx(acast_channel_ctx_t* ctx)
+{
+    compile_channel_ops(ctx->channel_op, ctx->num_channel_ops, &ctx->prog);
+}
+
+int channel_ctx_equal(acast_channel_ctx_t* a, acast_channel_ctx_t* b)
+{
+    int i;
+
+    if (a->type != b->type)
+	return 0;
+    switch(a->type) {
+    case ACAST_MAP_ID:
+    case ACAST_MAP_PERMUTE:
+	if (a->num_channel_ops != b->num_channel_ops)
+	    return 0;
+	for (i = 0; (i < a->num_channel_ops) && (i < MAX_CHANNEL_MAP); i++)
+	    if (a->channel_map[i] != b->channel_map[i])
+		return 0;
+	return 1;
+    case ACAST_MAP_OP:
+	if (a->prog.num_ops != b->prog.num_ops)
+	    return 0;
+	return memcmp(a->prog.op, b->prog.op,
+		      a->prog.num_ops*sizeof(acast_prog_op_t)) == 0;
+    case ACAST_MAP_MATRIX:
+	if ((a->matrix.nin != b->matrix.nin) ||
+	    (a->matrix.nout != b->matrix.nout))
+	    return 0;
+	for (i = 0; i < a->matrix.nout; i++)
+	    if (memcmp(a->matrix.dgain[i], b->matrix.dgain[i],
+		       a->matrix.nin*sizeof(double)) != 0)
+		return 0;
+	return 1;
+    default:
+	return 0;
+    }
+}
+
 int parse_channel_ctx(char* map, acast_channel_ctx_t* ctx,
 		      int num_input_channels, int* num_output_channels)
 {
     acast_map_type_t r;
+
+    if (map[0] == 'm') {
+	if (parse_channel_matrix(map+1, &ctx->matrix, num_input_channels) < 0)
+	    return -1;
+	// extra output channels are silent
+	if (*num_output_channels == 0)
+	    *num_output_channels = ctx->matrix.nout;
+	else if (*num_output_channels > MAX_MATRIX_OUT)
+	    return -1;
+	else
+	    ctx->matrix.nout = *num_output_channels;
+	ctx->num_channel_ops = 0;
+	ctx->prog.num_ops = 0;
+	ctx->type = ACAST_MAP_MATRIX;
+	return ctx->type;
+    }
     r = parse_channel_map(map,
 			  ctx->channel_op, MAX_CHANNEL_OP,
 			  &ctx->num_channel_ops,
@@ -249,5 +449,6 @@ int parse_channel_ctx(char* map, acast_channel_ctx_t* ctx,
     if (r == ACAST_MAP_INVALID)
 	return -1;
     ctx->type = r;
+    compile_channel_ctx(ctx);
     return r;
 }
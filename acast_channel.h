@@ -34,32 +34,86 @@ typedef struct
 #define TYPE_MIN_int16_t -0x8000
 
 #define TYPE_MAX_int32_t 0x7fffffff
-#define TYPE_MIN_int32_t -0x80000000
+#define TYPE_MIN_int32_t (-0x7fffffff-1)
+
+// accumulator round to integer, (v + magic) - magic rounds to nearest even
+#define ROUND_MAGIC_float  12582912.0f              // 1.5*2^23
+#define ROUND_MAGIC_double 6755399441055744.0       // 1.5*2^52
+
+// gain matrix entries used with accumulator type
+#define MATRIX_GAIN_float  gain
+#define MATRIX_GAIN_double dgain
+
+// map constants (dN) are used as is in the sample format of the map,
+// only float samples are scaled, they have full scale 1.0 and get the
+// constant times this, so dN matches N in S16
+#define MAP_FLOAT_CONST_SCALE (1.0/32768)
 
 #define CAT_HELPER2(x,y) x ## y
 #define CAT2(x,y) CAT_HELPER2(x,y)
 
 #define MAX_CHANNEL_OP  16
 #define MAX_CHANNEL_MAP 8
+#define MAX_MATRIX_IN   16
+#define MAX_MATRIX_OUT  8
 
 typedef enum {
     ACAST_MAP_INVALID,
     ACAST_MAP_ID,
     ACAST_MAP_PERMUTE,
-    ACAST_MAP_OP
+    ACAST_MAP_OP,
+    ACAST_MAP_MATRIX
 } acast_map_type_t;
 
+// compiled channel operation, each op is run over all frames in a packet
+typedef struct
+{
+    acast_channel_op_t op;
+    int src1;     // (or constant for ACAST_OP_CONST)
+    int src2;     // (or constant for ACAST_OP_ADDC/ACAST_OP_SUBC)
+    int dst;
+    int len;      // number of consecutive channels (ACAST_OP_SRC)
+} acast_prog_op_t;
+
+typedef struct
+{
+    size_t num_ops;
+    acast_prog_op_t op[MAX_CHANNEL_OP];
+} acast_channel_prog_t;
+
+// gain matrix, out[i] = sum_j gain[i][j]*in[j]
+// float samples and 8/16 bit samples use gain, 32 bit and double
+// samples use dgain. Integer results are rounded and saturated.
+typedef struct
+{
+    int nin;
+    int nout;
+    float  gain[MAX_MATRIX_OUT][MAX_MATRIX_IN];
+    double dgain[MAX_MATRIX_OUT][MAX_MATRIX_IN];
+} acast_matrix_t;
+
 typedef struct
 {
     acast_map_type_t type;
     size_t num_channel_ops;
     acast_op_t channel_op[MAX_CHANNEL_OP];
     uint8_t    channel_map[MAX_CHANNEL_MAP];
+    acast_channel_prog_t prog;   // compiled channel_op
+    acast_matrix_t matrix;       // ACAST_MAP_MATRIX
 } acast_channel_ctx_t;
 
 
 extern void print_channel_ctx(FILE* f, acast_channel_ctx_t* ctx);
 
+extern void compile_channel_ops(acast_op_t* channel_op, size_t num_ops,
+				acast_channel_prog_t* prog);
+extern void compile_channel_ctx(acast_channel_ctx_t* ctx);
+// return 1 if a and b map channels the same way
+extern int channel_ctx_equal(acast_channel_ctx_t* a, acast_channel_ctx_t* b);
+
+extern int parse_channel_matrix(char* map, acast_matrix_t* mx,
+				int num_input_channels);
+
 extern int parse_channel_ctx(char* map, acast_channel_ctx_t* ctx,
 			     int num_input_channels, int* num_output_channels);
 
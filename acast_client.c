@@ -0,0 +1,207 @@
+//
+//  Client registry
+//
+//  The hash table holds indices into the dense client array and uses
+//  linear probing, removal shifts the following entries back so no
+//  tombstones are left. The array doubles when full and halves when a
+//  quarter is used, the table is rebuilt at twice the array capacity.
+//
+#include <stdlib.h>
+#include <string.h>
+
+#include "acast_client.h"
+
+#define MIN_CAPACITY 8
+#define EMPTY        -1
+
+struct _acast_clients_t
+{
+    size_t reserved;        // leading clients not hashed
+    size_t max_clients;
+    size_t count;
+    size_t capacity;        // room in client and key
+    client_t* client;
+    uint64_t* key;          // hash key per client
+    size_t table_size;      // power of two
+    int* table;             // client index or EMPTY
+};
+
+// clients with id are found by id, others by address and port
+static uint64_t client_key(uint32_t id, struct sockaddr_in* addr)
+{
+    if (id)
+	return (1ULL << 48) | id;
+    return ((uint64_t) ntohl(addr->sin_addr.s_addr) << 16) |
+	ntohs(addr->sin_port);
+}
+
+static size_t key_hash(acast_clients_t* cs, uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & (cs->table_size-1);
+}
+
+// slot holding key, or the empty slot where it would be inserted
+static size_t table_slot(acast_clients_t* cs, uint64_t key)
+{
+    size_t mask = cs->table_size-1;
+    size_t s = key_hash(cs, key);
+    int k;
+
+    while(((k = cs->table[s]) != EMPTY) && (cs->key[k] != key))
+	s = (s+1) & mask;
+    return s;
+}
+
+static void table_delete(acast_clients_t* cs, size_t s)
+{
+    size_t mask = cs->table_size-1;
+    size_t j = s;
+    int k;
+
+    // move back entries that can not be found past the hole
+    while((k = cs->table[j = (j+1) & mask]) != EMPTY) {
+	size_t h = key_hash(cs, cs->key[k]);
+	if (((j - h) & mask) >= ((j - s) & mask)) {
+	    cs->table[s] = k;
+	    s = j;
+	}
+    }
+    cs->table[s] = EMPTY;
+}
+
+static int clients_resize(acast_clients_t* cs, size_t capacity)
+{
+    client_t* client;
+    uint64_t* key;
+    int* table;
+    size_t table_size = 1;
+    size_t i;
+
+    while(table_size < 2*capacity)
+	table_size <<= 1;
+    if ((table = malloc(table_size*sizeof(int))) == NULL)
+	return -1;
+    if ((client = realloc(cs->client, capacity*sizeof(client_t))) == NULL) {
+	free(table);
+	return -1;
+    }
+    cs->client = client;
+    if ((key = realloc(cs->key, capacity*sizeof(uint64_t))) == NULL) {
+	// a shrunk client array limits the capacity
+	if (capacity < cs->capacity)
+	    cs->capacity = capacity;
+	free(table);
+	return -1;
+    }
+    cs->key = key;
+    cs->capacity = capacity;
+    free(cs->table);
+    cs->table = table;
+    cs->table_size = table_size;
+    for (i = 0; i < table_size; i++)
+	table[i] = EMPTY;
+    for (i = cs->reserved; i < cs->count; i++)
+	table[table_slot(cs, cs->key[i])] = i;
+    return 0;
+}
+
+acast_clients_t* acast_clients_new(size_t reserved, size_t max_clients)
+{
+    acast_clients_t* cs;
+    size_t capacity = MIN_CAPACITY;
+    size_t i;
+
+    while(capacity < reserved)
+	capacity <<= 1;
+    if ((cs = calloc(1, sizeof(acast_clients_t))) == NULL)
+	return NULL;
+    cs->reserved = reserved;
+    cs->max_clients = (max_clients < reserved) ? reserved : max_clients;
+    if (clients_resize(cs, capacity) < 0) {
+	acast_clients_free(cs);
+	return NULL;
+    }
+    memset(cs->client, 0, reserved*sizeof(client_t));
+    memset(cs->key, 0, reserved*sizeof(uint64_t));
+    for (i = 0; i < reserved; i++)
+	cs->client[i].group = -1;
+    cs->count = reserved;
+    return cs;
+}
+
+void acast_clients_free(acast_clients_t* cs)
+{
+    free(cs->client);
+    free(cs->key);
+    free(cs->table);
+    free(cs);
+}
+
+size_t acast_clients_count(acast_clients_t* cs)
+{
+    return cs->count;
+}
+
+size_t acast_clients_capacity(acast_clients_t* cs)
+{
+    return cs->capacity;
+}
+
+client_t* acast_clients_array(acast_clients_t* cs)
+{
+    return cs->client;
+}
+
+int acast_clients_find(acast_clients_t* cs, uint32_t id,
+		       struct sockaddr_in* addr)
+{
+    return cs->table[table_slot(cs, client_key(id, addr))];
+}
+
+int acast_clients_add(acast_clients_t* cs, uint32_t id,
+		      struct sockaddr_in* addr, socklen_t addrlen)
+{
+    uint64_t key = client_key(id, addr);
+    size_t i;
+
+    if (cs->table[table_slot(cs, key)] != EMPTY)
+	return -1;
+    if (cs->count >= cs->max_clients)
+	return -1;
+    if ((cs->count == cs->capacity) &&
+	(clients_resize(cs, 2*cs->capacity) < 0))
+	return -1;
+    i = cs->count++;
+    memset(&cs->client[i], 0, sizeof(client_t));
+    cs->client[i].id = id;
+    cs->client[i].addr = *addr;
+    cs->client[i].addrlen = addrlen;
+    cs->client[i].group = -1;
+    cs->key[i] = key;
+    cs->table[table_slot(cs, key)] = i;
+    return i;
+}
+
+int acast_clients_remove(acast_clients_t* cs, size_t i)
+{
+    size_t last = cs->count-1;
+    int moved = -1;
+
+    if ((i < cs->reserved) || (i >= cs->count))
+	return -1;
+    table_delete(cs, table_slot(cs, cs->key[i]));
+    if (i != last) {
+	cs->client[i] = cs->client[last];
+	cs->key[i] = cs->key[last];
+	cs->table[table_slot(cs, cs->key[i])] = i;
+	moved = last;
+    }
+    cs->count--;
+    // a failed shrink keeps the larger arrays
+    if ((cs->capacity > MIN_CAPACITY) && (cs->count <= cs->capacity/4))
+	clients_resize(cs, cs->capacity/2);
+    return moved;
+}
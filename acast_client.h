@@ -0,0 +1,45 @@
+//
+//  Client registry
+//
+//  Clients are kept in a dense array that the fan-out loops walk, and
+//  are hashed by id, or by address for clients without id, so that a
+//  subscription refresh finds its client in constant time. A removed
+//  client is replaced by the last one. The first reserved entries (the
+//  multicast client) are not hashed and are never removed.
+//
+#ifndef __ACAST_CLIENT_H__
+#define __ACAST_CLIENT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "acast.h"
+
+#define ACAST_MAX_CLIENTS 1024   // default limit of clients
+
+typedef struct _acast_clients_t acast_clients_t;
+
+// registry of at most max_clients clients, the first reserved clients
+// are zeroed, without group, and present from the start
+extern acast_clients_t* acast_clients_new(size_t reserved,
+					  size_t max_clients);
+extern void acast_clients_free(acast_clients_t* cs);
+// number of clients, including the reserved ones
+extern size_t acast_clients_count(acast_clients_t* cs);
+// clients the array has room for, changes on add and remove
+extern size_t acast_clients_capacity(acast_clients_t* cs);
+// the dense array, valid until the next add or remove
+extern client_t* acast_clients_array(acast_clients_t* cs);
+// index of the client with id, or with addr when id is 0, or -1
+extern int acast_clients_find(acast_clients_t* cs, uint32_t id,
+			      struct sockaddr_in* addr);
+// add a zeroed client without group with id and addr, return its
+// index or -1 when the registry is full or out of memory
+extern int acast_clients_add(acast_clients_t* cs, uint32_t id,
+			     struct sockaddr_in* addr, socklen_t addrlen);
+// remove client i (not reserved), the last client takes its place.
+// memory owned by the client must be released before. return the old
+// index of the client moved to i, or -1 if none was moved
+extern int acast_clients_remove(acast_clients_t* cs, size_t i);
+
+#endif
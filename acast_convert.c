@@ -0,0 +1,404 @@
+//
+//  Sample format conversion
+//
+//  A converter is selected once for each (src_fmt, dst_fmt) pair.
+//  Byte swap, sign flip, S16<->S32, A-law/u-law (g711 block
+//  functions) and native float to S16/S32 have specialized loops,
+//  other pairs decode to native left justified int32 and encode from
+//  there, a chunk at the time.
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#include "acast_convert.h"
+#include "acast_channel.h"
+#include "g711.h"
+#include "acast_simd.h"
+
+#define CONVERT_CHUNK 256    // samples per chunk in the generic path
+
+#define NOSWAP(x) (x)
+#define SWAP16(x) __builtin_bswap16((x))
+#define SWAP32(x) __builtin_bswap32((x))
+
+// linear pcm codecs, decode to and encode from left justified int32
+#define LINEAR_CODEC(name, utype, bits, swap, flip)			\
+static void CAT2(decode_,name)(void* src, int32_t* dst, size_t n)	\
+{									\
+    utype* s = (utype*) src;						\
+    while(n--) {							\
+	utype v = swap(*s) ^ (flip);					\
+	*dst++ = (int32_t)((uint32_t)v << (32-(bits)));			\
+	s++;								\
+    }									\
+}									\
+static void CAT2(encode_,name)(int32_t* src, void* dst, size_t n)	\
+{									\
+    utype* d = (utype*) dst;						\
+    while(n--) {							\
+	utype v = ((uint32_t)*src++ >> (32-(bits))) ^ (flip);		\
+	*d++ = swap(v);							\
+    }									\
+}
+
+LINEAR_CODEC(s8,   uint8_t,   8, NOSWAP, 0)
+LINEAR_CODEC(u8,   uint8_t,   8, NOSWAP, 0x80)
+LINEAR_CODEC(s16,  uint16_t, 16, NOSWAP, 0)
+LINEAR_CODEC(u16,  uint16_t, 16, NOSWAP, 0x8000)
+LINEAR_CODEC(s16x, uint16_t, 16, SWAP16, 0)
+LINEAR_CODEC(u16x, uint16_t, 16, SWAP16, 0x8000)
+LINEAR_CODEC(s32,  uint32_t, 32, NOSWAP, 0)
+LINEAR_CODEC(u32,  uint32_t, 32, NOSWAP, 0x80000000)
+LINEAR_CODEC(s32x, uint32_t, 32, SWAP32, 0)
+LINEAR_CODEC(u32x, uint32_t, 32, SWAP32, 0x80000000)
+
+// g711, via the block functions and an int16 chunk
+static void decode_alaw(void* src, int32_t* dst, size_t n)
+{
+    int16_t tmp[CONVERT_CHUNK];
+    uint8_t* s = (uint8_t*) src;
+
+    while(n) {
+	size_t i, k = (n < CONVERT_CHUNK) ? n : CONVERT_CHUNK;
+	g711_alaw_decode_block(s, tmp, k);
+	for (i = 0; i < k; i++)
+	    *dst++ = (int32_t)((uint32_t)(uint16_t)tmp[i] << 16);
+	s += k;
+	n -= k;
+    }
+}
+
+static void encode_alaw(int32_t* src, void* dst, size_t n)
+{
+    int16_t tmp[CONVERT_CHUNK];
+    uint8_t* d = (uint8_t*) dst;
+
+    while(n) {
+	size_t i, k = (n < CONVERT_CHUNK) ? n : CONVERT_CHUNK;
+	for (i = 0; i < k; i++)
+	    tmp[i] = *src++ >> 16;
+	g711_alaw_encode_block(tmp, d, k);
+	d += k;
+	n -= k;
+    }
+}
+
+static void decode_ulaw(void* src, int32_t* dst, size_t n)
+{
+    int16_t tmp[CONVERT_CHUNK];
+    uint8_t* s = (uint8_t*) src;
+
+    while(n) {
+	size_t i, k = (n < CONVERT_CHUNK) ? n : CONVERT_CHUNK;
+	g711_ulaw_decode_block(s, tmp, k);
+	for (i = 0; i < k; i++)
+	    *dst++ = (int32_t)((uint32_t)(uint16_t)tmp[i] << 16);
+	s += k;
+	n -= k;
+    }
+}
+
+static void encode_ulaw(int32_t* src, void* dst, size_t n)
+{
+    int16_t tmp[CONVERT_CHUNK];
+    uint8_t* d = (uint8_t*) dst;
+
+    while(n) {
+	size_t i, k = (n < CONVERT_CHUNK) ? n : CONVERT_CHUNK;
+	for (i = 0; i < k; i++)
+	    tmp[i] = *src++ >> 16;
+	g711_ulaw_encode_block(tmp, d, k);
+	d += k;
+	n -= k;
+    }
+}
+
+// native float codecs, see acast_float_to_int
+#define FLOAT_CODEC(name, ftype)					\
+static void CAT2(decode_,name)(void* src, int32_t* dst, size_t n)	\
+{									\
+    ftype* s = (ftype*) src;						\
+    while(n--)								\
+	*dst++ = acast_float_to_s32(*s++);				\
+}									\
+static void CAT2(encode_,name)(int32_t* src, void* dst, size_t n)	\
+{									\
+    ftype* d = (ftype*) dst;						\
+    while(n--)								\
+	*d++ = *src++ * (1.0/2147483648.0);				\
+}
+
+FLOAT_CODEC(f32, float)
+FLOAT_CODEC(f64, double)
+
+#define KIND_LINEAR  0
+#define KIND_LAW     1
+#define KIND_FLOAT   2
+
+typedef struct
+{
+    snd_pcm_format_t fmt;
+    int      kind;
+    size_t   bytes;
+    uint32_t flip;     // sign bit to flip for unsigned formats
+    int      swap;     // not in native byte order
+    void (*decode)(void* src, int32_t* dst, size_t n);
+    void (*encode)(int32_t* src, void* dst, size_t n);
+} format_info_t;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define LE_CODEC(name) 0, CAT2(decode_,name), CAT2(encode_,name)
+#define BE_CODEC(name) 1, CAT2(decode_,CAT2(name,x)), CAT2(encode_,CAT2(name,x))
+#else
+#define LE_CODEC(name) 1, CAT2(decode_,CAT2(name,x)), CAT2(encode_,CAT2(name,x))
+#define BE_CODEC(name) 0, CAT2(decode_,name), CAT2(encode_,name)
+#endif
+
+static format_info_t format_info[] = {
+    { SND_PCM_FORMAT_S8,     KIND_LINEAR, 1, 0, 0, decode_s8, encode_s8 },
+    { SND_PCM_FORMAT_U8,     KIND_LINEAR, 1, 0x80, 0, decode_u8, encode_u8 },
+    { SND_PCM_FORMAT_S16_LE, KIND_LINEAR, 2, 0, LE_CODEC(s16) },
+    { SND_PCM_FORMAT_S16_BE, KIND_LINEAR, 2, 0, BE_CODEC(s16) },
+    { SND_PCM_FORMAT_U16_LE, KIND_LINEAR, 2, 0x8000, LE_CODEC(u16) },
+    { SND_PCM_FORMAT_U16_BE, KIND_LINEAR, 2, 0x8000, BE_CODEC(u16) },
+    { SND_PCM_FORMAT_S32_LE, KIND_LINEAR, 4, 0, LE_CODEC(s32) },
+    { SND_PCM_FORMAT_S32_BE, KIND_LINEAR, 4, 0, BE_CODEC(s32) },
+    { SND_PCM_FORMAT_U32_LE, KIND_LINEAR, 4, 0x80000000, LE_CODEC(u32) },
+    { SND_PCM_FORMAT_U32_BE, KIND_LINEAR, 4, 0x80000000, BE_CODEC(u32) },
+    { SND_PCM_FORMAT_A_LAW,  KIND_LAW,    1, 0, 0, decode_alaw, encode_alaw },
+    { SND_PCM_FORMAT_MU_LAW, KIND_LAW,    1, 0, 0, decode_ulaw, encode_ulaw },
+    { SND_PCM_FORMAT_FLOAT,  KIND_FLOAT,  4, 0, 0, decode_f32, encode_f32 },
+    { SND_PCM_FORMAT_FLOAT64, KIND_FLOAT, 8, 0, 0, decode_f64, encode_f64 },
+    { SND_PCM_FORMAT_UNKNOWN, 0, 0, 0, 0, NULL, NULL }
+};
+
+static format_info_t* find_format(snd_pcm_format_t fmt)
+{
+    format_info_t* fi;
+    for (fi = format_info; fi->fmt != SND_PCM_FORMAT_UNKNOWN; fi++) {
+	if (fi->fmt == fmt)
+	    return fi;
+    }
+    return NULL;
+}
+
+int acast_convert_supported(snd_pcm_format_t fmt)
+{
+    return find_format(fmt) != NULL;
+}
+
+// same size linear formats, optional byte swap then xor with mask
+// (mask is given in destination byte order)
+static void conv_xor8(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    uint8_t* s = (uint8_t*) src;
+    uint8_t* d = (uint8_t*) dst;
+    uint8_t mask = cv->mask;
+    while(n--)
+	*d++ = *s++ ^ mask;
+}
+
+static void conv_xor16(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    uint16_t* s = (uint16_t*) src;
+    uint16_t* d = (uint16_t*) dst;
+    uint16_t mask = cv->mask;
+    while(n--)
+	*d++ = *s++ ^ mask;
+}
+
+static void conv_swap16(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    uint16_t* s = (uint16_t*) src;
+    uint16_t* d = (uint16_t*) dst;
+    uint16_t mask = cv->mask;
+    while(n--) {
+	*d++ = SWAP16(*s) ^ mask;
+	s++;
+    }
+}
+
+static void conv_xor32(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    uint32_t* s = (uint32_t*) src;
+    uint32_t* d = (uint32_t*) dst;
+    uint32_t mask = cv->mask;
+    while(n--)
+	*d++ = *s++ ^ mask;
+}
+
+static void conv_swap32(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    uint32_t* s = (uint32_t*) src;
+    uint32_t* d = (uint32_t*) dst;
+    uint32_t mask = cv->mask;
+    while(n--) {
+	*d++ = SWAP32(*s) ^ mask;
+	s++;
+    }
+}
+
+// native S16 <-> native S32
+static void conv_s16_s32(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    int16_t* s = (int16_t*) src;
+    int32_t* d = (int32_t*) dst;
+    while(n--)
+	*d++ = (int32_t)((uint32_t)(uint16_t)*s++ << 16);
+}
+
+static void conv_s32_s16(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    int32_t* s = (int32_t*) src;
+    int16_t* d = (int16_t*) dst;
+    while(n--)
+	*d++ = *s++ >> 16;
+}
+
+// g711 <-> native S16
+static void conv_alaw_s16(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    g711_alaw_decode_block((uint8_t*) src, (int16_t*) dst, n);
+}
+
+static void conv_ulaw_s16(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    g711_ulaw_decode_block((uint8_t*) src, (int16_t*) dst, n);
+}
+
+static void conv_s16_alaw(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    g711_alaw_encode_block((int16_t*) src, (uint8_t*) dst, n);
+}
+
+static void conv_s16_ulaw(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    g711_ulaw_encode_block((int16_t*) src, (uint8_t*) dst, n);
+}
+
+// native float -> native S16/S32, simd when possible
+static void conv_f32_s16(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    size_t i = acast_float_to_s16_simd((float*) src, (int16_t*) dst, n);
+    float* s = (float*) src + i;
+    int16_t* d = (int16_t*) dst + i;
+    for (; i < n; i++)
+	*d++ = acast_float_to_int(*s++ * 32768.0, -32768.0, 32767.0);
+}
+
+static void conv_f32_s32(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    size_t i = acast_float_to_s32_simd((float*) src, (int32_t*) dst, n);
+    decode_f32((float*) src + i, (int32_t*) dst + i, n - i);
+}
+
+static void conv_f64_s16(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    size_t i = acast_double_to_s16_simd((double*) src, (int16_t*) dst, n);
+    double* s = (double*) src + i;
+    int16_t* d = (int16_t*) dst + i;
+    for (; i < n; i++)
+	*d++ = acast_float_to_int(*s++ * 32768.0, -32768.0, 32767.0);
+}
+
+static void conv_f64_s32(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    size_t i = acast_double_to_s32_simd((double*) src, (int32_t*) dst, n);
+    decode_f64((double*) src + i, (int32_t*) dst + i, n - i);
+}
+
+// any supported pair, over int32
+static void conv_generic(acast_convert_t* cv, void* src, void* dst, size_t n)
+{
+    int32_t tmp[CONVERT_CHUNK];
+    uint8_t* s = (uint8_t*) src;
+    uint8_t* d = (uint8_t*) dst;
+
+    while(n) {
+	size_t k = (n < CONVERT_CHUNK) ? n : CONVERT_CHUNK;
+	(cv->decode)(s, tmp, k);
+	(cv->encode)(tmp, d, k);
+	s += k*cv->src_bytes;
+	d += k*cv->dst_bytes;
+	n -= k;
+    }
+}
+
+static int is_native_signed(format_info_t* fi, size_t bytes)
+{
+    return (fi->kind == KIND_LINEAR) && (fi->bytes == bytes) &&
+	(fi->flip == 0) && !fi->swap;
+}
+
+int acast_convert_setup(acast_convert_t* cv,
+			snd_pcm_format_t src_fmt,
+			snd_pcm_format_t dst_fmt)
+{
+    format_info_t* si;
+    format_info_t* di;
+
+    memset(cv, 0, sizeof(acast_convert_t));
+    cv->src_fmt = src_fmt;
+    cv->dst_fmt = dst_fmt;
+
+    if (src_fmt == dst_fmt) {
+	int width = snd_pcm_format_physical_width(src_fmt);
+	if (width <= 0)
+	    return -1;
+	cv->src_bytes = cv->dst_bytes = width / 8;
+	cv->convert = NULL;
+	return 0;
+    }
+    if (((si = find_format(src_fmt)) == NULL) ||
+	((di = find_format(dst_fmt)) == NULL))
+	return -1;
+
+    cv->src_bytes = si->bytes;
+    cv->dst_bytes = di->bytes;
+    cv->decode = si->decode;
+    cv->encode = di->encode;
+    cv->convert = conv_generic;
+
+    if ((si->kind == KIND_LINEAR) && (di->kind == KIND_LINEAR) &&
+	(si->bytes == di->bytes)) {
+	int swap = si->swap ^ di->swap;
+	uint32_t flip = si->flip ^ di->flip;
+	switch(si->bytes) {
+	case 1:
+	    cv->mask = flip;
+	    cv->convert = conv_xor8;
+	    break;
+	case 2:
+	    cv->mask = di->swap ? SWAP16(flip) : flip;
+	    cv->convert = swap ? conv_swap16 : conv_xor16;
+	    break;
+	case 4:
+	    cv->mask = di->swap ? SWAP32(flip) : flip;
+	    cv->convert = swap ? conv_swap32 : conv_xor32;
+	    break;
+	}
+    }
+    else if (is_native_signed(si, 2) && is_native_signed(di, 4))
+	cv->convert = conv_s16_s32;
+    else if (is_native_signed(si, 4) && is_native_signed(di, 2))
+	cv->convert = conv_s32_s16;
+    else if (is_native_signed(di, 2) && (src_fmt == SND_PCM_FORMAT_A_LAW))
+	cv->convert = conv_alaw_s16;
+    else if (is_native_signed(di, 2) && (src_fmt == SND_PCM_FORMAT_MU_LAW))
+	cv->convert = conv_ulaw_s16;
+    else if (is_native_signed(si, 2) && (dst_fmt == SND_PCM_FORMAT_A_LAW))
+	cv->convert = conv_s16_alaw;
+    else if (is_native_signed(si, 2) && (dst_fmt == SND_PCM_FORMAT_MU_LAW))
+	cv->convert = conv_s16_ulaw;
+    else if ((src_fmt == SND_PCM_FORMAT_FLOAT) && is_native_signed(di, 2))
+	cv->convert = conv_f32_s16;
+    else if ((src_fmt == SND_PCM_FORMAT_FLOAT) && is_native_signed(di, 4))
+	cv->convert = conv_f32_s32;
+    else if ((src_fmt == SND_PCM_FORMAT_FLOAT64) && is_native_signed(di, 2))
+	cv->convert = conv_f64_s16;
+    else if ((src_fmt == SND_PCM_FORMAT_FLOAT64) && is_native_signed(di, 4))
+	cv->convert = conv_f64_s32;
+    return 0;
+}
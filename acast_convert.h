@@ -0,0 +1,67 @@
+//
+//  Sample format conversion
+//
+#ifndef __ACAST_CONVERT_H__
+#define __ACAST_CONVERT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <alsa/asoundlib.h>
+
+typedef struct _acast_convert_t
+{
+    snd_pcm_format_t src_fmt;
+    snd_pcm_format_t dst_fmt;
+    size_t src_bytes;          // bytes per sample in source
+    size_t dst_bytes;          // bytes per sample in destination
+    uint32_t mask;             // xor mask for bit flip converters
+    // convert n samples from src to dst, set up by acast_convert_setup
+    // NULL when src_fmt == dst_fmt
+    void (*convert)(struct _acast_convert_t* cv,
+		    void* src, void* dst, size_t n);
+    // generic conversion path, over native left justified int32
+    void (*decode)(void* src, int32_t* dst, size_t n);
+    void (*encode)(int32_t* src, void* dst, size_t n);
+} acast_convert_t;
+
+// native float full scale is [-1.0, 1.0), scale, clamp and round to
+// nearest even (the same as the simd conversions), NaN gives lo
+#define ACAST_S32_SCALE    2147483648.0
+#define ACAST_ROUND_MAGIC  6755399441055744.0   // 1.5*2^52
+
+static inline int32_t acast_float_to_int(double x, double lo, double hi)
+{
+    if (!(x > lo))
+	return lo;
+    else if (x > hi)
+	return hi;
+    return (int32_t)((x + ACAST_ROUND_MAGIC) - ACAST_ROUND_MAGIC);
+}
+
+// native float sample to S32
+static inline int32_t acast_float_to_s32(double v)
+{
+    return acast_float_to_int(v*ACAST_S32_SCALE, -ACAST_S32_SCALE,
+			      2147483647.0);
+}
+
+// select converter for src_fmt to dst_fmt, return -1 if not supported
+extern int acast_convert_setup(acast_convert_t* cv,
+			       snd_pcm_format_t src_fmt,
+			       snd_pcm_format_t dst_fmt);
+
+// return 1 if format can be converted
+extern int acast_convert_supported(snd_pcm_format_t fmt);
+
+static inline void acast_convert(acast_convert_t* cv,
+				 void* src, void* dst, size_t n)
+{
+    if (cv->convert == NULL)
+	memcpy(dst, src, n*cv->src_bytes);
+    else
+	(cv->convert)(cv, src, dst, n);
+}
+
+#endif
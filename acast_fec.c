@@ -0,0 +1,428 @@
+//
+//  Forward error correction
+//
+//  The encoder keeps one xor accumulator for the current row and one
+//  per column of the current block. The decoder keeps the latest
+//  packets as they were sent, indexed by seqno modulo the number of
+//  slots, and the parity packets whose groups are not yet complete.
+//  Groups are checked whenever a packet or a parity packet arrives.
+//
+#include <stdlib.h>
+#include <string.h>
+
+#include "acast.h"
+#include "acast_fec.h"
+#include "crc32.h"
+
+#define FEC_DATA_SLOTS   (2*ACAST_FEC_MAX_SPAN)  // received packets kept
+#define FEC_PARITY_SLOTS 64                      // unsolved groups kept
+#define FEC_PENDING      64                      // rebuilt, not fetched
+
+typedef struct
+{
+    uint32_t seqno;          // first packet in group
+    size_t   n;              // packets added
+    size_t   max_len;        // longest packet
+    uint16_t length;         // xor of packet lengths
+    uint8_t* data;
+} fec_acc_t;
+
+struct _acast_fec_enc_t
+{
+    size_t k;                // packets per row
+    size_t d;                // rows per block, 0 no columns
+    size_t pos;              // packet position in block
+    int synced;
+    uint32_t next;           // expected seqno
+    size_t max_len;          // longest packet that can be protected
+    fec_acc_t row;
+    fec_acc_t* col;          // k column accumulators
+    uint8_t* buf;            // accumulator data
+};
+
+typedef struct
+{
+    uint32_t seqno;
+    int      valid;
+    size_t   len;
+    uint8_t* data;
+} fec_slot_t;
+
+struct _acast_fec_dec_t
+{
+    int synced;
+    uint32_t high;           // highest seqno stored + 1
+    size_t pnext;            // next parity slot to use
+    size_t pend_head;
+    size_t pend_count;
+    uint32_t pending[FEC_PENDING];
+    size_t packet_size;
+    fec_slot_t data[FEC_DATA_SLOTS];
+    fec_slot_t parity[FEC_PARITY_SLOTS];
+    uint8_t* out;
+    uint8_t* buf;            // slot data
+    acast_fec_stats_t st;
+};
+
+snd_pcm_uframes_t acast_fec_frames_per_packet(acast_params_t* pp,
+					      size_t packet_size)
+{
+    return (packet_size - sizeof(acast_fec_t) - sizeof(acast_t)) /
+	(pp->channels_per_frame * pp->bytes_per_channel);
+}
+
+static void fec_xor(uint8_t* dst, uint8_t* src, size_t len)
+{
+    while(len--)
+	*dst++ ^= *src++;
+}
+
+acast_fec_enc_t* acast_fec_enc_new(size_t k, size_t d, size_t packet_size)
+{
+    acast_fec_enc_t* enc;
+    size_t i;
+
+    if ((k < 1) || (k > ACAST_FEC_MAX_K) || (d > ACAST_FEC_MAX_D) ||
+	(k*d > ACAST_FEC_MAX_SPAN) || (packet_size <= sizeof(acast_fec_t)))
+	return NULL;
+    if ((enc = calloc(1, sizeof(acast_fec_enc_t))) == NULL)
+	return NULL;
+    enc->k = k;
+    enc->d = (d > 1) ? d : 0;
+    enc->max_len = packet_size - sizeof(acast_fec_t);
+    if (enc->d && ((enc->col = calloc(k, sizeof(fec_acc_t))) == NULL)) {
+	acast_fec_enc_free(enc);
+	return NULL;
+    }
+    // row accumulator first, then the columns
+    if ((enc->buf = malloc((1 + (enc->d ? k : 0))*enc->max_len)) == NULL) {
+	acast_fec_enc_free(enc);
+	return NULL;
+    }
+    enc->row.data = enc->buf;
+    for (i = 0; enc->d && (i < k); i++)
+	enc->col[i].data = enc->buf + (i+1)*enc->max_len;
+    return enc;
+}
+
+void acast_fec_enc_free(acast_fec_enc_t* enc)
+{
+    free(enc->buf);
+    free(enc->col);
+    free(enc);
+}
+
+void acast_fec_enc_reset(acast_fec_enc_t* enc)
+{
+    size_t i;
+
+    enc->synced = 0;
+    enc->pos = 0;
+    enc->row.n = 0;
+    for (i = 0; enc->d && (i < enc->k); i++)
+	enc->col[i].n = 0;
+}
+
+double acast_fec_enc_overhead(acast_fec_enc_t* enc)
+{
+    return 1.0/enc->k + (enc->d ? 1.0/enc->d : 0.0);
+}
+
+static void acc_add(fec_acc_t* a, acast_t* hdr,
+		    void* data, size_t data_len,
+		    void* trailer, size_t trailer_len)
+{
+    size_t len = sizeof(acast_t) + data_len + trailer_len;
+
+    if (a->n == 0) {
+	a->seqno = hdr->seqno;
+	a->max_len = 0;
+	a->length = 0;
+    }
+    // shorter packets are padded with zeros
+    if (len > a->max_len) {
+	memset(a->data + a->max_len, 0, len - a->max_len);
+	a->max_len = len;
+    }
+    fec_xor(a->data, (uint8_t*) hdr, sizeof(acast_t));
+    fec_xor(a->data + sizeof(acast_t), data, data_len);
+    fec_xor(a->data + sizeof(acast_t) + data_len, trailer, trailer_len);
+    a->length ^= len;
+    a->n++;
+}
+
+// write parity packet for the accumulated group and start over
+static size_t acc_emit(fec_acc_t* a, size_t stride, uint8_t* out)
+{
+    acast_fec_t* p = (acast_fec_t*) out;
+
+    p->magic  = ACAST_MAGIC_FEC;
+    p->seqno  = a->seqno;
+    p->count  = a->n;
+    p->stride = stride;
+    p->length = a->length;
+    p->crc    = 0;
+    p->crc    = crc32(out, sizeof(acast_fec_t));
+    memcpy(p->data, a->data, a->max_len);
+    a->n = 0;
+    return sizeof(acast_fec_t) + a->max_len;
+}
+
+int acast_fec_encode(acast_fec_enc_t* enc, acast_t* hdr,
+		     void* data, size_t data_len,
+		     void* trailer, size_t trailer_len,
+		     uint8_t** out, size_t* out_len)
+{
+    int n = 0;
+
+    // packets without room for the parity header are not protected
+    if (sizeof(acast_t) + data_len + trailer_len > enc->max_len) {
+	acast_fec_enc_reset(enc);
+	return 0;
+    }
+    if (enc->synced && (hdr->seqno != enc->next))
+	acast_fec_enc_reset(enc);
+    enc->synced = 1;
+    enc->next = hdr->seqno + 1;
+
+    acc_add(&enc->row, hdr, data, data_len, trailer, trailer_len);
+    if (enc->d) {
+	fec_acc_t* c = &enc->col[enc->pos % enc->k];
+
+	acc_add(c, hdr, data, data_len, trailer, trailer_len);
+	if (c->n == enc->d) {
+	    out_len[n] = acc_emit(c, enc->k, out[n]);
+	    n++;
+	}
+	if (++enc->pos == enc->k*enc->d)
+	    enc->pos = 0;
+    }
+    if (enc->row.n == enc->k) {
+	out_len[n] = acc_emit(&enc->row, 1, out[n]);
+	n++;
+    }
+    return n;
+}
+
+acast_fec_dec_t* acast_fec_dec_new(size_t packet_size)
+{
+    acast_fec_dec_t* dec;
+    uint8_t* ptr;
+    size_t i;
+
+    if ((dec = calloc(1, sizeof(acast_fec_dec_t))) == NULL)
+	return NULL;
+    dec->packet_size = packet_size;
+    // data slots, parity slots and the copy handed out
+    dec->buf = malloc((FEC_DATA_SLOTS+FEC_PARITY_SLOTS+1)*packet_size);
+    if (dec->buf == NULL) {
+	free(dec);
+	return NULL;
+    }
+    ptr = dec->buf;
+    for (i = 0; i < FEC_DATA_SLOTS; i++, ptr += packet_size)
+	dec->data[i].data = ptr;
+    for (i = 0; i < FEC_PARITY_SLOTS; i++, ptr += packet_size)
+	dec->parity[i].data = ptr;
+    dec->out = ptr;
+    return dec;
+}
+
+void acast_fec_dec_free(acast_fec_dec_t* dec)
+{
+    free(dec->buf);
+    free(dec);
+}
+
+void acast_fec_dec_reset(acast_fec_dec_t* dec)
+{
+    size_t i;
+
+    for (i = 0; i < FEC_DATA_SLOTS; i++)
+	dec->data[i].valid = 0;
+    for (i = 0; i < FEC_PARITY_SLOTS; i++)
+	dec->parity[i].valid = 0;
+    dec->synced = 0;
+    dec->pend_count = 0;
+}
+
+static fec_slot_t* dec_slot(acast_fec_dec_t* dec, uint32_t seqno)
+{
+    return &dec->data[seqno % FEC_DATA_SLOTS];
+}
+
+static int dec_have(acast_fec_dec_t* dec, uint32_t seqno)
+{
+    fec_slot_t* sp = dec_slot(dec, seqno);
+    return sp->valid && (sp->seqno == seqno);
+}
+
+// rebuild the missing packet seqno of group p
+static int dec_rebuild(acast_fec_dec_t* dec, acast_fec_t* p, size_t plen,
+		       uint32_t seqno)
+{
+    fec_slot_t* dp = dec_slot(dec, seqno);
+    size_t max_len = plen - sizeof(acast_fec_t);
+    uint16_t length = p->length;
+    size_t i;
+
+    dp->valid = 0;
+    memcpy(dp->data, p->data, max_len);
+    for (i = 0; i < p->count; i++) {
+	uint32_t s = p->seqno + i*p->stride;
+	fec_slot_t* sp;
+
+	if (s == seqno)
+	    continue;
+	sp = dec_slot(dec, s);
+	fec_xor(dp->data, sp->data, (sp->len < max_len) ? sp->len : max_len);
+	length ^= sp->len;
+    }
+    if ((length < sizeof(acast_t)) || (length > max_len) ||
+	(((acast_t*) dp->data)->seqno != seqno))
+	return -1;
+    dp->seqno = seqno;
+    dp->len = length;
+    dp->valid = 1;
+
+    if (dec->pend_count == FEC_PENDING) {  // drop oldest
+	dec->pend_head = (dec->pend_head + 1) % FEC_PENDING;
+	dec->pend_count--;
+    }
+    dec->pending[(dec->pend_head + dec->pend_count) % FEC_PENDING] = seqno;
+    dec->pend_count++;
+    dec->st.recovered++;
+    return 0;
+}
+
+// rebuild single losses until no group can be solved, drop groups
+// that are complete or too old to be solved
+static void dec_solve(acast_fec_dec_t* dec)
+{
+    int progress = 1;
+
+    while(progress) {
+	size_t i;
+
+	progress = 0;
+	for (i = 0; i < FEC_PARITY_SLOTS; i++) {
+	    fec_slot_t* ps = &dec->parity[i];
+	    acast_fec_t* p = (acast_fec_t*) ps->data;
+	    uint32_t last;
+	    uint32_t lost = 0;
+	    size_t missing = 0;
+	    size_t j;
+
+	    if (!ps->valid)
+		continue;
+	    for (j = 0; (j < p->count) && (missing < 2); j++) {
+		uint32_t s = p->seqno + j*p->stride;
+		if (!dec_have(dec, s)) {
+		    lost = s;
+		    missing++;
+		}
+	    }
+	    if (missing == 1) {
+		if (dec_rebuild(dec, p, ps->len, lost) == 0)
+		    progress = 1;
+	    }
+	    else if (missing > 1) {
+		last = p->seqno + (p->count-1)*p->stride;
+		if ((int32_t)(dec->high - 1 - last) <
+		    (int32_t)(FEC_DATA_SLOTS - ACAST_FEC_MAX_SPAN))
+		    continue;
+		dec->st.failed++;
+	    }
+	    ps->valid = 0;
+	}
+    }
+}
+
+void acast_fec_dec_data(acast_fec_dec_t* dec, acast_t* packet, size_t len)
+{
+    uint32_t seqno = packet->seqno;
+    fec_slot_t* sp;
+
+    if ((len < sizeof(acast_t)) || (len > dec->packet_size))
+	return;
+    if (dec->synced) {
+	int32_t diff = (int32_t)(seqno - dec->high);
+	// far out of range, sender restarted
+	if ((diff >= FEC_DATA_SLOTS) || (diff < -FEC_DATA_SLOTS))
+	    acast_fec_dec_reset(dec);
+    }
+    if (!dec->synced) {
+	dec->high = seqno + 1;
+	dec->synced = 1;
+    }
+    else if ((int32_t)(seqno - dec->high) >= 0)
+	dec->high = seqno + 1;
+
+    if (dec_have(dec, seqno))  // duplicate or rebuilt
+	return;
+    sp = dec_slot(dec, seqno);
+    memcpy(sp->data, packet, len);
+    sp->seqno = seqno;
+    sp->len = len;
+    sp->valid = 1;
+    dec_solve(dec);
+}
+
+int acast_fec_dec_parity(acast_fec_dec_t* dec, acast_fec_t* parity,
+			 size_t len)
+{
+    uint32_t crc;
+    fec_slot_t* ps;
+
+    if ((len < sizeof(acast_fec_t)) || (len > dec->packet_size))
+	goto corrupt;
+    crc = parity->crc;
+    parity->crc = 0;
+    if (crc32((uint8_t*) parity, sizeof(acast_fec_t)) != crc)
+	goto corrupt;
+    parity->crc = crc;
+    if ((parity->count < 1) || (parity->stride < 1) ||
+	((parity->count-1)*parity->stride >= ACAST_FEC_MAX_SPAN))
+	goto corrupt;
+
+    dec->st.parity++;
+    ps = &dec->parity[dec->pnext];
+    dec->pnext = (dec->pnext + 1) % FEC_PARITY_SLOTS;
+    if (ps->valid)  // unsolved group pushed out
+	dec->st.failed++;
+    memcpy(ps->data, parity, len);
+    ps->len = len;
+    ps->valid = 1;
+    dec_solve(dec);
+    return 0;
+corrupt:
+    dec->st.corrupt++;
+    return -1;
+}
+
+size_t acast_fec_dec_pending(acast_fec_dec_t* dec)
+{
+    return dec->pend_count;
+}
+
+acast_t* acast_fec_dec_recovered(acast_fec_dec_t* dec, size_t* len)
+{
+    while(dec->pend_count > 0) {
+	uint32_t seqno = dec->pending[dec->pend_head];
+	fec_slot_t* sp = dec_slot(dec, seqno);
+
+	dec->pend_head = (dec->pend_head + 1) % FEC_PENDING;
+	dec->pend_count--;
+	if (sp->valid && (sp->seqno == seqno)) {
+	    memcpy(dec->out, sp->data, sp->len);
+	    *len = sp->len;
+	    return (acast_t*) dec->out;
+	}
+    }
+    return NULL;
+}
+
+void acast_fec_dec_stats(acast_fec_dec_t* dec, acast_fec_stats_t* st)
+{
+    *st = dec->st;
+}
@@ -0,0 +1,73 @@
+//
+//  Forward error correction
+//
+//  Every K packets are followed by a parity packet holding the xor of
+//  them (row). With D > 1 a block of K*D packets is also protected by
+//  K column parity packets, each the xor of D packets K apart, that
+//  repair burst losses a row can not. A group with a single missing
+//  packet is rebuilt from the parity, rebuilt packets may complete
+//  other groups in turn.
+//
+#ifndef __ACAST_FEC_H__
+#define __ACAST_FEC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "acast.h"
+
+#define ACAST_FEC_MAX_K     32    // max packets per row
+#define ACAST_FEC_MAX_D     32    // max rows per column block
+#define ACAST_FEC_MAX_SPAN  128   // max packets per block (K*D)
+
+typedef struct
+{
+    uint64_t parity;        // parity packets received
+    uint64_t recovered;     // packets rebuilt
+    uint64_t failed;        // groups dropped with more than one loss
+    uint64_t corrupt;       // parity packets with bad header
+} acast_fec_stats_t;
+
+// frames per packet leaving room for the parity header
+extern snd_pcm_uframes_t acast_fec_frames_per_packet(acast_params_t* pp,
+						     size_t packet_size);
+
+typedef struct _acast_fec_enc_t acast_fec_enc_t;
+
+// k packets per row parity, d rows per column block (0 or 1 no columns)
+// and parity packets of at most packet_size bytes.
+// return NULL if k and d are out of range
+extern acast_fec_enc_t* acast_fec_enc_new(size_t k, size_t d,
+					  size_t packet_size);
+extern void acast_fec_enc_free(acast_fec_enc_t* enc);
+extern void acast_fec_enc_reset(acast_fec_enc_t* enc);
+// parity packets per data packet
+extern double acast_fec_enc_overhead(acast_fec_enc_t* enc);
+// add packet gathered from hdr, data and trailer. parity packets
+// completed by it are written to out[0] and out[1] (packet_size bytes
+// each) with their lengths in out_len. return number of parity packets.
+// a gap in sequence numbers starts over with a new block
+extern int acast_fec_encode(acast_fec_enc_t* enc, acast_t* hdr,
+			    void* data, size_t data_len,
+			    void* trailer, size_t trailer_len,
+			    uint8_t** out, size_t* out_len);
+
+typedef struct _acast_fec_dec_t acast_fec_dec_t;
+
+// packets up to packet_size bytes are kept
+extern acast_fec_dec_t* acast_fec_dec_new(size_t packet_size);
+extern void acast_fec_dec_free(acast_fec_dec_t* dec);
+extern void acast_fec_dec_reset(acast_fec_dec_t* dec);
+// store a received packet of len bytes as it was sent
+extern void acast_fec_dec_data(acast_fec_dec_t* dec, acast_t* packet,
+			       size_t len);
+// store a parity packet, return -1 if its header is corrupt
+extern int acast_fec_dec_parity(acast_fec_dec_t* dec, acast_fec_t* parity,
+				size_t len);
+// number of rebuilt packets not yet fetched
+extern size_t acast_fec_dec_pending(acast_fec_dec_t* dec);
+// copy of the next rebuilt packet or NULL, valid until the next call
+extern acast_t* acast_fec_dec_recovered(acast_fec_dec_t* dec, size_t* len);
+extern void acast_fec_dec_stats(acast_fec_dec_t* dec, acast_fec_stats_t* st);
+
+#endif
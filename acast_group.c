@@ -0,0 +1,131 @@
+//
+//  Stream groups
+//
+//  A join compares the mapping with every group, that is done on a
+//  subscription change only and the number of distinct mappings is
+//  small. The array doubles when all slots are used.
+//
+#include <stdlib.h>
+#include <string.h>
+
+#include "acast_group.h"
+
+#define MIN_CAPACITY 4
+
+struct _acast_groups_t
+{
+    size_t count;           // slots in use or free
+    size_t used;            // groups with members
+    size_t capacity;
+    client_t* stream;
+    size_t* members;
+};
+
+acast_groups_t* acast_groups_new(void)
+{
+    acast_groups_t* gs;
+
+    if ((gs = calloc(1, sizeof(acast_groups_t))) == NULL)
+	return NULL;
+    gs->stream = malloc(MIN_CAPACITY*sizeof(client_t));
+    gs->members = malloc(MIN_CAPACITY*sizeof(size_t));
+    if (!gs->stream || !gs->members) {
+	acast_groups_free(gs);
+	return NULL;
+    }
+    gs->capacity = MIN_CAPACITY;
+    return gs;
+}
+
+void acast_groups_free(acast_groups_t* gs)
+{
+    free(gs->stream);
+    free(gs->members);
+    free(gs);
+}
+
+size_t acast_groups_count(acast_groups_t* gs)
+{
+    return gs->count;
+}
+
+size_t acast_groups_used(acast_groups_t* gs)
+{
+    return gs->used;
+}
+
+size_t acast_groups_capacity(acast_groups_t* gs)
+{
+    return gs->capacity;
+}
+
+client_t* acast_groups_array(acast_groups_t* gs)
+{
+    return gs->stream;
+}
+
+size_t acast_groups_members(acast_groups_t* gs, size_t g)
+{
+    return (g < gs->count) ? gs->members[g] : 0;
+}
+
+int acast_groups_join(acast_groups_t* gs, client_t* cp)
+{
+    client_t* sp;
+    int free_slot = -1;
+    size_t g;
+
+    for (g = 0; g < gs->count; g++) {
+	sp = &gs->stream[g];
+	if (gs->members[g] == 0) {
+	    if (free_slot < 0)
+		free_slot = g;
+	}
+	else if ((sp->num_output_channels == cp->num_output_channels) &&
+		 channel_ctx_equal(&sp->chan_ctx, &cp->chan_ctx)) {
+	    gs->members[g]++;
+	    return cp->group = g;
+	}
+    }
+    if (free_slot >= 0)
+	g = free_slot;
+    else {
+	if (gs->count == gs->capacity) {
+	    size_t n = 2*gs->capacity;
+	    client_t* stream;
+	    size_t* members;
+
+	    if ((stream = realloc(gs->stream, n*sizeof(client_t))) == NULL)
+		return cp->group = -1;
+	    gs->stream = stream;
+	    if ((members = realloc(gs->members, n*sizeof(size_t))) == NULL)
+		return cp->group = -1;
+	    gs->members = members;
+	    gs->capacity = n;
+	}
+	g = gs->count++;
+    }
+    sp = &gs->stream[g];
+    memset(sp, 0, sizeof(client_t));
+    sp->mask = cp->mask;
+    sp->num_output_channels = cp->num_output_channels;
+    sp->chan_ctx = cp->chan_ctx;
+    sp->group = g;
+    gs->members[g] = 1;
+    gs->used++;
+    return cp->group = g;
+}
+
+int acast_groups_leave(acast_groups_t* gs, client_t* cp)
+{
+    int g = cp->group;
+
+    if ((g < 0) || (g >= gs->count) || (gs->members[g] == 0))
+	return 0;
+    cp->group = -1;
+    if (--gs->members[g] > 0)
+	return 0;
+    gs->stream[g].ptr = NULL;
+    gs->used--;
+    return 1;
+}
@@ -0,0 +1,41 @@
+//
+//  Stream groups
+//
+//  Clients with the same channel mapping are sent the same packets,
+//  only the destination differs. Each group holds the mapping of its
+//  members as a client_t, so the fan-out maps, and the senders build
+//  header, crc and parity, once per group instead of once per client.
+//  Group numbers stay valid while the group has members, free groups
+//  have ptr == NULL and are reused by the next new mapping.
+//
+#ifndef __ACAST_GROUP_H__
+#define __ACAST_GROUP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "acast.h"
+
+typedef struct _acast_groups_t acast_groups_t;
+
+extern acast_groups_t* acast_groups_new(void);
+extern void acast_groups_free(acast_groups_t* gs);
+// number of group slots, used and free
+extern size_t acast_groups_count(acast_groups_t* gs);
+// groups with members
+extern size_t acast_groups_used(acast_groups_t* gs);
+// groups the array has room for, changes on join
+extern size_t acast_groups_capacity(acast_groups_t* gs);
+// stream per group, valid until the next join
+extern client_t* acast_groups_array(acast_groups_t* gs);
+extern size_t acast_groups_members(acast_groups_t* gs, size_t g);
+// add cp to the group mapping with cp->chan_ctx to
+// cp->num_output_channels channels, a new group is made when there is
+// none. set and return cp->group, -1 if out of memory. a new group is
+// zeroed except for the mapping
+extern int acast_groups_join(acast_groups_t* gs, client_t* cp);
+// remove cp from its group, return 1 if the group has no members left,
+// memory owned by the group stream must then be released
+extern int acast_groups_leave(acast_groups_t* gs, client_t* cp);
+
+#endif
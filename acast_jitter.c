@@ -0,0 +1,297 @@
+//
+//  Jitter buffer
+//
+//  Slots are indexed by seqno modulo the number of slots. Playout
+//  starts when the span from the next packet to play up to the highest
+//  stored packet reach the target depth, the target is one packet plus
+//  JITTER_FACTOR times the interarrival jitter (RFC 3550 estimate).
+//
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "acast_jitter.h"
+
+#define JITTER_FACTOR  3.0   // jitter estimates covered by target depth
+#define JITTER_GAIN    16.0  // 1/gain of the jitter estimate filter
+
+typedef struct
+{
+    uint32_t seqno;
+    int      valid;
+    size_t   num_frames;
+    uint8_t* data;
+} jitter_slot_t;
+
+struct _acast_jitter_t
+{
+    size_t num_slots;
+    size_t slot_size;
+    jitter_slot_t* slot;
+    uint8_t* mem;
+    uint32_t sample_rate;
+    tick_t min_latency;
+    tick_t max_latency;
+    int synced;             // next and end are valid
+    int playing;            // target depth was reached
+    uint32_t next;          // next seqno to play
+    uint32_t end;           // highest stored seqno + 1
+    size_t count;           // number of stored packets
+    size_t packet_frames;   // frames in last stored packet
+    int have_last;
+    uint32_t last_seqno;    // last in order arrival
+    tick_t last_arrival;
+    acast_jitter_stats_t st;
+};
+
+acast_jitter_t* acast_jitter_new(size_t num_slots, size_t slot_size)
+{
+    acast_jitter_t* jb;
+    size_t n = 1;
+    size_t i;
+
+    while(n < num_slots)
+	n <<= 1;
+    if ((jb = calloc(1, sizeof(acast_jitter_t))) == NULL)
+	return NULL;
+    jb->num_slots = n;
+    jb->slot_size = slot_size;
+    jb->slot = calloc(n, sizeof(jitter_slot_t));
+    jb->mem = malloc(n*slot_size);
+    if (!jb->slot || !jb->mem) {
+	acast_jitter_free(jb);
+	return NULL;
+    }
+    for (i = 0; i < n; i++)
+	jb->slot[i].data = jb->mem + i*slot_size;
+    jb->max_latency = time_tick_from_usec(1000000);
+    acast_jitter_reset(jb, 48000);
+    return jb;
+}
+
+void acast_jitter_free(acast_jitter_t* jb)
+{
+    free(jb->slot);
+    free(jb->mem);
+    free(jb);
+}
+
+// drop stored packets, keep statistics
+static void jitter_flush(acast_jitter_t* jb)
+{
+    size_t i;
+
+    for (i = 0; i < jb->num_slots; i++)
+	jb->slot[i].valid = 0;
+    jb->count = 0;
+    jb->synced = 0;
+    jb->playing = 0;
+    jb->have_last = 0;
+}
+
+void acast_jitter_reset(acast_jitter_t* jb, uint32_t sample_rate)
+{
+    jitter_flush(jb);
+    jb->sample_rate = sample_rate ? sample_rate : 48000;
+    jb->packet_frames = 0;
+    memset(&jb->st, 0, sizeof(jb->st));
+}
+
+void acast_jitter_set_latency(acast_jitter_t* jb,
+			      tick_t min_latency, tick_t max_latency)
+{
+    jb->min_latency = min_latency;
+    jb->max_latency = (max_latency < min_latency) ? min_latency : max_latency;
+}
+
+static size_t usec_to_frames(acast_jitter_t* jb, double usec)
+{
+    return (size_t) ((usec*jb->sample_rate) / 1000000.0);
+}
+
+static double frames_to_usec(acast_jitter_t* jb, size_t frames)
+{
+    return (frames*1000000.0) / jb->sample_rate;
+}
+
+// buffered frames, missing packets count as full packets
+static size_t jitter_depth(acast_jitter_t* jb)
+{
+    if (!jb->synced)
+	return 0;
+    return (size_t)(jb->end - jb->next) * jb->packet_frames;
+}
+
+// max depth in frames, limited by the number of slots
+static size_t jitter_max(acast_jitter_t* jb)
+{
+    size_t max_frames = usec_to_frames(jb, time_tick_to_usec(jb->max_latency));
+
+    if (max_frames > (jb->num_slots-1)*jb->packet_frames)
+	max_frames = (jb->num_slots-1)*jb->packet_frames;
+    return max_frames;
+}
+
+static size_t jitter_target(acast_jitter_t* jb)
+{
+    size_t min_frames = usec_to_frames(jb, time_tick_to_usec(jb->min_latency));
+    size_t max_frames = jitter_max(jb);
+    size_t target = jb->packet_frames +
+	usec_to_frames(jb, JITTER_FACTOR*jb->st.jitter_us);
+
+    if (target < min_frames)
+	target = min_frames;
+    if (target > max_frames)
+	target = max_frames;
+    return target;
+}
+
+// skip the next packet, stored or not
+static void jitter_skip(acast_jitter_t* jb)
+{
+    jitter_slot_t* sp = &jb->slot[jb->next & (jb->num_slots-1)];
+
+    if (sp->valid && (sp->seqno == jb->next)) {
+	sp->valid = 0;
+	jb->count--;
+    }
+    jb->next++;
+}
+
+int acast_jitter_put(acast_jitter_t* jb, uint32_t seqno,
+		     tick_t arrival, void* data, size_t len,
+		     size_t num_frames)
+{
+    jitter_slot_t* sp;
+    int32_t diff;
+
+    jb->st.received++;
+    if (len > jb->slot_size)
+	return ACAST_JITTER_TOO_LARGE;
+
+    diff = (int32_t)(seqno - jb->next);
+    if (jb->synced) {
+	if ((diff < 0) && (-diff <= (int32_t) jb->num_slots)) {
+	    jb->st.late++;
+	    return ACAST_JITTER_LATE;
+	}
+	// far out of range, sender restarted or we are far behind
+	if ((diff < 0) || (diff >= (int32_t) jb->num_slots)) {
+	    jb->st.overflow += jb->count;
+	    jitter_flush(jb);
+	}
+    }
+    if (!jb->synced) {
+	jb->next = seqno;
+	jb->end = seqno;
+	jb->synced = 1;
+    }
+
+    sp = &jb->slot[seqno & (jb->num_slots-1)];
+    if (sp->valid && (sp->seqno == seqno)) {
+	jb->st.duplicate++;
+	return ACAST_JITTER_DUPLICATE;
+    }
+    memcpy(sp->data, data, len);
+    sp->seqno = seqno;
+    sp->num_frames = num_frames;
+    sp->valid = 1;
+    jb->count++;
+    jb->packet_frames = num_frames;
+
+    if ((int32_t)(seqno - jb->end) >= 0)
+	jb->end = seqno + 1;
+    else
+	jb->st.reordered++;
+
+    // D = arrival spacing - send spacing, J += (|D| - J)/16
+    if (jb->have_last && ((int32_t)(seqno - jb->last_seqno) > 0)) {
+	double d = (double) time_tick_to_usec(arrival - jb->last_arrival) -
+	    (seqno - jb->last_seqno)*frames_to_usec(jb, num_frames);
+	jb->st.jitter_us += (fabs(d) - jb->st.jitter_us) / JITTER_GAIN;
+    }
+    if (!jb->have_last || ((int32_t)(seqno - jb->last_seqno) > 0)) {
+	jb->last_seqno = seqno;
+	jb->last_arrival = arrival;
+	jb->have_last = 1;
+    }
+
+    // drop the oldest packets when above max latency
+    while((jb->count > 0) && (jitter_depth(jb) > jitter_max(jb))) {
+	jitter_skip(jb);
+	jb->st.overflow++;
+    }
+    return ACAST_JITTER_STORED;
+}
+
+int acast_jitter_get(acast_jitter_t* jb, uint8_t** data, size_t* num_frames)
+{
+    jitter_slot_t* sp;
+
+    if (!jb->synced)
+	return ACAST_JITTER_WAIT;
+    if (!jb->playing) {
+	if ((jb->count == 0) || (jitter_depth(jb) < jitter_target(jb)))
+	    return ACAST_JITTER_WAIT;
+	jb->playing = 1;
+    }
+    sp = &jb->slot[jb->next & (jb->num_slots-1)];
+    if (sp->valid && (sp->seqno == jb->next)) {
+	sp->valid = 0;
+	jb->count--;
+	jb->next++;
+	jb->st.played++;
+	*data = sp->data;
+	*num_frames = sp->num_frames;
+	return ACAST_JITTER_PLAY;
+    }
+    if (jb->count > 0) {  // gap, later packets are stored
+	jb->next++;
+	jb->st.lost++;
+	*num_frames = jb->packet_frames;
+	return ACAST_JITTER_LOST;
+    }
+    // empty, wait for the next packet and refill to target depth
+    jb->playing = 0;
+    jb->st.underrun++;
+    return ACAST_JITTER_WAIT;
+}
+
+int acast_jitter_peek(acast_jitter_t* jb, uint8_t** data, size_t* num_frames)
+{
+    jitter_slot_t* sp = &jb->slot[jb->next & (jb->num_slots-1)];
+
+    if (!jb->synced || !sp->valid || (sp->seqno != jb->next))
+	return ACAST_JITTER_WAIT;
+    *data = sp->data;
+    *num_frames = sp->num_frames;
+    return ACAST_JITTER_PLAY;
+}
+
+size_t acast_jitter_frames_before(acast_jitter_t* jb, uint32_t seqno)
+{
+    int32_t n = (int32_t)(seqno - jb->next);
+    size_t frames = 0;
+    uint32_t s;
+
+    if (!jb->synced || (n <= 0))
+	return 0;
+    if (n > (int32_t) jb->num_slots)
+	return n*jb->packet_frames;
+    for (s = jb->next; s != seqno; s++) {
+	jitter_slot_t* sp = &jb->slot[s & (jb->num_slots-1)];
+	if (sp->valid && (sp->seqno == s))
+	    frames += sp->num_frames;
+	else
+	    frames += jb->packet_frames;
+    }
+    return frames;
+}
+
+void acast_jitter_stats(acast_jitter_t* jb, acast_jitter_stats_t* st)
+{
+    *st = jb->st;
+    st->depth = jitter_depth(jb);
+    st->target = jitter_target(jb);
+    st->next = jb->next;
+}
@@ -0,0 +1,71 @@
+//
+//  Jitter buffer
+//
+//  Packets are stored by sequence number and played in order. The
+//  playout depth follows the measured interarrival jitter within the
+//  min and max latency limits.
+//
+#ifndef __ACAST_JITTER_H__
+#define __ACAST_JITTER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tick.h"
+
+// acast_jitter_put status
+#define ACAST_JITTER_STORED    0
+#define ACAST_JITTER_LATE      1   // already played or skipped
+#define ACAST_JITTER_DUPLICATE 2   // already in buffer
+#define ACAST_JITTER_TOO_LARGE 3   // does not fit in a slot
+
+// acast_jitter_get status
+#define ACAST_JITTER_WAIT      0   // filling up to target depth
+#define ACAST_JITTER_PLAY      1   // next packet returned
+#define ACAST_JITTER_LOST      2   // next packet missing, later ones stored
+
+typedef struct
+{
+    uint64_t received;
+    uint64_t played;
+    uint64_t lost;          // gaps played as missing
+    uint64_t late;          // arrived after playout
+    uint64_t duplicate;
+    uint64_t reordered;     // arrived after a later packet
+    uint64_t underrun;      // buffer ran empty while playing
+    uint64_t overflow;      // dropped to stay below max latency
+    double   jitter_us;     // interarrival jitter estimate
+    size_t   depth;         // buffered frames (including gaps)
+    size_t   target;        // target depth in frames
+    uint32_t next;          // next seqno to play
+} acast_jitter_stats_t;
+
+typedef struct _acast_jitter_t acast_jitter_t;
+
+// num_slots is rounded up to a power of two
+extern acast_jitter_t* acast_jitter_new(size_t num_slots, size_t slot_size);
+extern void acast_jitter_free(acast_jitter_t* jb);
+// drop all packets and sync on the next one, sample_rate converts
+// between frames and time
+extern void acast_jitter_reset(acast_jitter_t* jb, uint32_t sample_rate);
+// latency limits in ticks
+extern void acast_jitter_set_latency(acast_jitter_t* jb,
+				     tick_t min_latency, tick_t max_latency);
+// store a copy of len bytes holding num_frames frames
+extern int acast_jitter_put(acast_jitter_t* jb, uint32_t seqno,
+			    tick_t arrival, void* data, size_t len,
+			    size_t num_frames);
+// next packet to play, data is valid until the next acast_jitter_put.
+// *num_frames is set for ACAST_JITTER_PLAY and ACAST_JITTER_LOST
+extern int acast_jitter_get(acast_jitter_t* jb, uint8_t** data,
+			    size_t* num_frames);
+// look at the next packet without removing it, ACAST_JITTER_PLAY if
+// it is stored
+extern int acast_jitter_peek(acast_jitter_t* jb, uint8_t** data,
+			     size_t* num_frames);
+extern void acast_jitter_stats(acast_jitter_t* jb, acast_jitter_stats_t* st);
+// frames to play before seqno, missing packets count as the last
+// stored packet
+extern size_t acast_jitter_frames_before(acast_jitter_t* jb, uint32_t seqno);
+
+#endif
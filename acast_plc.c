@@ -0,0 +1,351 @@
+//
+//  Packet loss concealment
+//
+//  Samples are decoded to native S32 and kept as float history per
+//  channel. The method for each channel is selected from the history
+//  when a loss starts: the pitch search (normalized autocorrelation)
+//  only runs on the first concealed packet of a loss.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "acast.h"
+#include "acast_plc.h"
+#include "acast_convert.h"
+
+#define PLC_MIN_PITCH_US  2500    // shortest pitch period
+#define PLC_MAX_PITCH_US  20000   // longest pitch period
+#define PLC_FADE_START_US 10000   // full level for the first 10ms
+#define PLC_FADE_END_US   60000   // silent after 60ms
+#define PLC_OLA_US        2500    // cross fade into received frames
+#define PLC_VOICED        0.6     // min correlation for waveform
+#define PLC_SMOOTH        0.001   // max diff/signal energy for linear
+#define PLC_BLOCK         256     // frames per decode/encode block
+
+typedef struct
+{
+    int    method;
+    size_t period;      // length of src
+    size_t phase;       // position in src
+    float  a;           // linear: last played sample
+    float  b;           // linear: first sample after the gap
+    float* src;         // waveform/repeat source, max_lag samples
+    float* hist;        // played samples, oldest first
+    float* tail;        // concealment continued for cross fade
+} plc_channel_t;
+
+struct _acast_plc_t
+{
+    size_t channels;
+    acast_convert_t dec;    // stream format -> S32
+    acast_convert_t enc;    // S32 -> stream format
+    size_t min_lag;
+    size_t max_lag;
+    size_t window;          // correlation window
+    size_t hist_len;
+    size_t ola;
+    size_t fade_start;
+    size_t fade_end;
+    size_t lost;            // frames concealed in current loss
+    size_t gap;             // frames in first concealed packet
+    int    concealed;       // cross fade on next update
+    float* mem;
+    plc_channel_t ch[MAX_CHANNELS];
+    int32_t tmp[PLC_BLOCK*MAX_CHANNELS];
+};
+
+acast_plc_t* acast_plc_new(void)
+{
+    return calloc(1, sizeof(acast_plc_t));
+}
+
+void acast_plc_free(acast_plc_t* plc)
+{
+    free(plc->mem);
+    free(plc);
+}
+
+static size_t usec_to_frames(uint32_t sample_rate, uint32_t usec)
+{
+    return ((uint64_t) usec * sample_rate) / 1000000;
+}
+
+int acast_plc_setup(acast_plc_t* plc, snd_pcm_format_t fmt,
+		    size_t channels, uint32_t sample_rate)
+{
+    size_t per_channel;
+    size_t i;
+
+    plc->channels = 0;
+    if ((channels == 0) || (channels > MAX_CHANNELS) || (sample_rate == 0))
+	return -1;
+    if ((acast_convert_setup(&plc->dec, fmt, SND_PCM_FORMAT_S32) < 0) ||
+	(acast_convert_setup(&plc->enc, SND_PCM_FORMAT_S32, fmt) < 0))
+	return -1;
+
+    plc->min_lag = usec_to_frames(sample_rate, PLC_MIN_PITCH_US);
+    plc->max_lag = usec_to_frames(sample_rate, PLC_MAX_PITCH_US);
+    plc->window = 2*plc->min_lag;
+    plc->hist_len = plc->max_lag + plc->window;
+    plc->ola = usec_to_frames(sample_rate, PLC_OLA_US);
+    plc->fade_start = usec_to_frames(sample_rate, PLC_FADE_START_US);
+    plc->fade_end = usec_to_frames(sample_rate, PLC_FADE_END_US);
+    if ((plc->min_lag < 2) || (plc->ola == 0))
+	return -1;
+
+    per_channel = plc->hist_len + plc->max_lag + plc->ola;
+    free(plc->mem);
+    if ((plc->mem = calloc(channels*per_channel, sizeof(float))) == NULL)
+	return -1;
+    for (i = 0; i < channels; i++) {
+	plc_channel_t* c = &plc->ch[i];
+	c->hist = plc->mem + i*per_channel;
+	c->src  = c->hist + plc->hist_len;
+	c->tail = c->src + plc->max_lag;
+	c->method = ACAST_PLC_NONE;
+    }
+    plc->channels = channels;
+    plc->lost = 0;
+    plc->concealed = 0;
+    return 0;
+}
+
+// append k frames of interleaved S32 to the history of all channels
+static void plc_append(acast_plc_t* plc, int32_t* x, size_t k)
+{
+    size_t nch = plc->channels;
+    size_t hl = plc->hist_len;
+    size_t i, j;
+
+    if (k > hl) {
+	x += (k - hl)*nch;
+	k = hl;
+    }
+    for (i = 0; i < nch; i++) {
+	float* h = plc->ch[i].hist;
+	memmove(h, h + k, (hl - k)*sizeof(float));
+	h += hl - k;
+	for (j = 0; j < k; j++)
+	    h[j] = x[j*nch + i] / ACAST_S32_SCALE;
+    }
+}
+
+void acast_plc_update(acast_plc_t* plc, void* data, size_t num_frames)
+{
+    size_t nch = plc->channels;
+    size_t bytes_per_frame = nch*plc->dec.src_bytes;
+    uint8_t* ptr = data;
+    size_t offs = 0;
+
+    if (nch == 0)
+	return;
+    // only the cross fade and the last hist_len frames are needed
+    if (!plc->concealed && (num_frames > plc->hist_len)) {
+	offs = num_frames - plc->hist_len;
+	ptr += offs*bytes_per_frame;
+    }
+    while(offs < num_frames) {
+	size_t k = num_frames - offs;
+	size_t i, j;
+
+	if (k > PLC_BLOCK)
+	    k = PLC_BLOCK;
+	acast_convert(&plc->dec, ptr, plc->tmp, k*nch);
+	if (plc->concealed && (offs < plc->ola)) {
+	    size_t n = plc->ola - offs;
+	    if (n > k)
+		n = k;
+	    for (j = 0; j < n; j++) {
+		float w = (float)(offs + j + 1) / (plc->ola + 1);
+		for (i = 0; i < nch; i++) {
+		    int32_t* xp = &plc->tmp[j*nch + i];
+		    float y = w*(*xp / ACAST_S32_SCALE) +
+			(1-w)*plc->ch[i].tail[offs + j];
+		    *xp = acast_float_to_s32(y);
+		}
+	    }
+	    acast_convert(&plc->enc, plc->tmp, ptr, k*nch);
+	}
+	plc_append(plc, plc->tmp, k);
+	ptr += k*bytes_per_frame;
+	offs += k;
+    }
+    plc->concealed = 0;
+    plc->lost = 0;
+}
+
+// four partial sums let the multiplies run in parallel
+static float dot(float* x, float* y, size_t n)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+	s0 += x[i]*y[i];
+	s1 += x[i+1]*y[i+1];
+	s2 += x[i+2]*y[i+2];
+	s3 += x[i+3]*y[i+3];
+    }
+    for (; i < n; i++)
+	s0 += x[i]*y[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+// return normalized correlation at the best lag in [min_lag, max_lag]
+static float plc_pitch(acast_plc_t* plc, float* h, float e0, size_t* lag)
+{
+    size_t w = plc->window;
+    float* cur = h + plc->hist_len - w;
+    float best_r = 0;
+    size_t best = plc->min_lag;
+    size_t lo, hi, l;
+    float el;
+
+    // coarse search on even lags, then refine around the best one.
+    // the energy of the lagged window is updated as it slides
+    el = dot(cur - plc->min_lag, cur - plc->min_lag, w);
+    for (l = plc->min_lag; l <= plc->max_lag; l++) {
+	if ((l & 1) == 0) {
+	    float c = dot(cur, cur - l, w);
+	    if ((c > 0) && (el > 0)) {
+		float r = c / sqrtf(e0*el + 1e-20f);
+		if (r > best_r) {
+		    best_r = r;
+		    best = l;
+		}
+	    }
+	}
+	if (l < plc->max_lag)
+	    el += cur[-(long)l-1]*cur[-(long)l-1] - cur[w-1-l]*cur[w-1-l];
+    }
+    lo = (best > plc->min_lag) ? best - 1 : best;
+    hi = (best < plc->max_lag) ? best + 1 : best;
+    for (l = lo; l <= hi; l += 2) {
+	float c = dot(cur, cur - l, w);
+	if ((l != best) && (c > 0)) {
+	    float r = c / sqrtf(e0*dot(cur - l, cur - l, w) + 1e-20f);
+	    if (r > best_r) {
+		best_r = r;
+		best = l;
+	    }
+	}
+    }
+    *lag = best;
+    return best_r;
+}
+
+// select method for each channel at the start of a loss
+static void plc_select(acast_plc_t* plc, void* next, size_t next_frames)
+{
+    size_t nch = plc->channels;
+    size_t w = plc->window;
+    size_t i, j;
+
+    if ((next != NULL) && (next_frames > 0))
+	acast_convert(&plc->dec, next, plc->tmp, nch);  // first frame
+    else
+	next = NULL;
+
+    for (i = 0; i < nch; i++) {
+	plc_channel_t* c = &plc->ch[i];
+	float* h = c->hist;
+	float* cur = h + plc->hist_len - w;
+	float e0 = dot(cur, cur, w);
+	float d = 0;
+	size_t lag;
+
+	for (j = 1; j < w; j++)
+	    d += (cur[j] - cur[j-1])*(cur[j] - cur[j-1]);
+	c->a = h[plc->hist_len-1];
+	c->b = (next != NULL) ? plc->tmp[i] / ACAST_S32_SCALE : c->a;
+	c->phase = 0;
+	if ((next != NULL) && (d <= PLC_SMOOTH*e0)) {
+	    c->method = ACAST_PLC_LINEAR;
+	    continue;
+	}
+	if ((e0 > 0) && (plc_pitch(plc, h, e0, &lag) >= PLC_VOICED)) {
+	    c->method = ACAST_PLC_WAVEFORM;
+	    c->period = lag;
+	}
+	else {
+	    c->method = ACAST_PLC_REPEAT;
+	    c->period = plc->max_lag;
+	}
+	memcpy(c->src, h + plc->hist_len - c->period,
+	       c->period*sizeof(float));
+    }
+}
+
+// concealed sample n of the current loss for channel c, linear
+// interpolation spans the first concealed packet
+static float plc_sample(acast_plc_t* plc, plc_channel_t* c, size_t n)
+{
+    size_t gap = plc->gap;
+    float g = 1.0;
+    float v;
+
+    if (c->method == ACAST_PLC_LINEAR) {
+	if (n >= gap)
+	    return c->b;
+	return c->a + (c->b - c->a)*(float)(n + 1)/(gap + 1);
+    }
+    if (n >= plc->fade_end)
+	return 0;
+    if (n > plc->fade_start)
+	g = (float)(plc->fade_end - n) / (plc->fade_end - plc->fade_start);
+    v = c->src[c->phase];
+    if (++c->phase >= c->period)
+	c->phase = 0;
+    return g*v;
+}
+
+void acast_plc_conceal(acast_plc_t* plc, void* dst, size_t num_frames,
+		       void* next, size_t next_frames)
+{
+    size_t nch = plc->channels;
+    size_t bytes_per_frame = nch*plc->enc.dst_bytes;
+    uint8_t* ptr = dst;
+    size_t offs = 0;
+    size_t i, j;
+
+    if (nch == 0)
+	return;
+    if (plc->lost == 0) {
+	plc_select(plc, next, next_frames);
+	plc->gap = num_frames;
+    }
+
+    while(offs < num_frames) {
+	size_t k = num_frames - offs;
+	if (k > PLC_BLOCK)
+	    k = PLC_BLOCK;
+	for (j = 0; j < k; j++) {
+	    for (i = 0; i < nch; i++) {
+		float v = plc_sample(plc, &plc->ch[i], plc->lost + offs + j);
+		plc->tmp[j*nch + i] = acast_float_to_s32(v);
+	    }
+	}
+	acast_convert(&plc->enc, plc->tmp, ptr, k*nch);
+	plc_append(plc, plc->tmp, k);
+	ptr += k*bytes_per_frame;
+	offs += k;
+    }
+    // continue the concealment to cross fade into the next packet
+    for (i = 0; i < nch; i++) {
+	plc_channel_t* c = &plc->ch[i];
+	size_t phase = c->phase;
+	for (j = 0; j < plc->ola; j++)
+	    c->tail[j] = plc_sample(plc, c, plc->lost + num_frames + j);
+	c->phase = phase;
+    }
+    plc->lost += num_frames;
+    plc->concealed = 1;
+}
+
+int acast_plc_method(acast_plc_t* plc, size_t channel)
+{
+    if (channel >= plc->channels)
+	return ACAST_PLC_NONE;
+    return plc->ch[channel].method;
+}
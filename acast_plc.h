@@ -0,0 +1,43 @@
+//
+//  Packet loss concealment
+//
+//  Missing frames are synthesized from the played history, the method
+//  is chosen per channel when a loss starts:
+//    waveform  repeat the last pitch period (periodic signals)
+//    linear    interpolate towards the packet after the gap (smooth
+//              signals when that packet is available)
+//    repeat    repeat the last frames with fade out (noise like signals)
+//  All methods fade out on long losses. The first frames played after a
+//  loss are cross faded from the concealed signal.
+//
+#ifndef __ACAST_PLC_H__
+#define __ACAST_PLC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <alsa/asoundlib.h>
+
+#define ACAST_PLC_NONE     0
+#define ACAST_PLC_REPEAT   1
+#define ACAST_PLC_WAVEFORM 2
+#define ACAST_PLC_LINEAR   3
+
+typedef struct _acast_plc_t acast_plc_t;
+
+extern acast_plc_t* acast_plc_new(void);
+extern void acast_plc_free(acast_plc_t* plc);
+// set interleaved stream format and clear history,
+// return -1 if the format is not supported
+extern int acast_plc_setup(acast_plc_t* plc, snd_pcm_format_t fmt,
+			   size_t channels, uint32_t sample_rate);
+// data is about to be played, cross fade after a loss and keep history
+extern void acast_plc_update(acast_plc_t* plc, void* data, size_t num_frames);
+// synthesize num_frames missing frames into dst, next is the packet
+// after the gap or NULL if not yet received
+extern void acast_plc_conceal(acast_plc_t* plc, void* dst, size_t num_frames,
+			      void* next, size_t next_frames);
+// method selected for channel by the last concealment
+extern int acast_plc_method(acast_plc_t* plc, size_t channel);
+
+#endif
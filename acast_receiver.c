@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -14,6 +15,10 @@
 #include <arpa/inet.h>
 
 #include "acast.h"
+#include "acast_jitter.h"
+#include "acast_fec.h"
+#include "acast_resample.h"
+#include "acast_plc.h"
 #include "tick.h"
 #include "crc32.h"
 
@@ -27,6 +32,13 @@
 
 #define SUB_REFRESH_TIME 10000000  // 10s
 
+#define RECV_BATCH 16              // max datagrams per recvmmsg batch
+
+#define JITTER_SLOTS       64      // max packets in jitter buffer
+#define JITTER_MIN_LATENCY 10      // ms
+#define JITTER_MAX_LATENCY 200     // ms
+#define SYNC_MAX_SKEW      2000    // us, larger errors are stepped
+
 #define CLIENT_MODE_UNICAST   1
 #define CLIENT_MODE_MULTICAST 2
 #define CLIENT_MODE_MIXED     3
@@ -46,8 +58,15 @@ printf("usage: acast_receiver [options] file\n"
 "  -l, --loop      enable multi cast loop (%d)\n"
 "  -t, --ttl       multicast ttl (%d)\n"       
 "  -d, --device    playback device (%s)\n"
+"  -f, --format    playback format (same as stream)\n"
 "  -c, --channels  number of output channels (%d)\n"
-"  -m, --map       channel map (%s)\n",       
+"  -m, --map       channel map (%s)\n"
+"                  dN is N in sample units, N/32768 for float formats\n"
+"  -L, --latency   jitter buffer latency min[:max] ms (%d:%d)\n"
+"  -S, --sync      play at capture time plus delay ms, needs wall\n"
+"                  clocks synchronized with the sender (off)\n"
+"  -P, --packet    expected packet size, grows when larger packets\n"
+"                  arrive (%d)\n",
        MULTICAST_ADDR,
        INTERFACE_ADDR,
        MULTICAST_PORT,
@@ -56,12 +75,44 @@ printf("usage: acast_receiver [options] file\n"
        MULTICAST_TTL,
        PLAYBACK_DEVICE,
        NUM_CHANNELS,
-       CHANNEL_MAP);
+       CHANNEL_MAP,
+       JITTER_MIN_LATENCY,
+       JITTER_MAX_LATENCY,
+       BYTES_PER_PACKET);
 }
 
 int verbose = 0;
 int debug = 0;
 
+// packet buffers, sized for the largest packet received
+static size_t packet_size = BYTES_PER_PACKET;
+static size_t slot_size;            // packet mapped to playback format
+static uint8_t* silence_buffer;
+static uint8_t* dst_buffer;
+static uint8_t* cnv_buffer;         // (U8 -> S32)
+static uint8_t* plc_buffer;
+static uint8_t* resample_buffer;    // room for speed up
+
+int alloc_buffers(size_t size)
+{
+    free(silence_buffer);
+    free(dst_buffer);
+    free(cnv_buffer);
+    free(plc_buffer);
+    free(resample_buffer);
+    packet_size = size;
+    slot_size = size*SRC_CHANNELS;
+    silence_buffer = malloc(slot_size);
+    dst_buffer = malloc(slot_size);
+    cnv_buffer = malloc(size*4);
+    plc_buffer = malloc(slot_size);
+    resample_buffer = malloc(2*slot_size);
+    if (!silence_buffer || !dst_buffer || !cnv_buffer || !plc_buffer ||
+	!resample_buffer)
+	return -1;
+    return 0;
+}
+
 void flush_packets(int sock)
 {
     size_t flushed_packets = 0;
@@ -96,6 +147,62 @@ void flush_packets(int sock)
     }
 }
 
+// restart playback with two packets of silence queued
+void start_playback(snd_pcm_t* handle, size_t bytes_per_frame,
+		    acast_t* silence)
+{
+    snd_pcm_reset(handle);
+    snd_pcm_prepare(handle);
+    acast_play(handle,bytes_per_frame,silence->data,silence->num_frames);
+    acast_play(handle,bytes_per_frame,silence->data,silence->num_frames);
+    snd_pcm_start(handle);
+}
+
+// play num_frames at the drift corrected speed when rs is set
+long play_resampled(snd_pcm_t* handle, size_t bytes_per_frame,
+		    acast_resample_t* rs, uint8_t* data, size_t num_frames)
+{
+    size_t n;
+
+    if (rs == NULL)
+	return acast_play(handle, bytes_per_frame, data, num_frames);
+    n = acast_resample(rs, data, num_frames, resample_buffer,
+		       (2*slot_size) / bytes_per_frame);
+    return acast_play(handle, bytes_per_frame, resample_buffer, n);
+}
+
+// play num_frames of silence
+long play_silence(snd_pcm_t* handle, size_t bytes_per_frame,
+		  acast_resample_t* rs, acast_t* silence, size_t num_frames)
+{
+    long r = 0;
+
+    while(num_frames > 0) {
+	size_t n = (num_frames < silence->num_frames) ?
+	    num_frames : silence->num_frames;
+	if ((r = play_resampled(handle, bytes_per_frame, rs,
+				silence->data, n)) < 0)
+	    return r;
+	num_frames -= n;
+    }
+    return r;
+}
+
+// synthesize num_frames missing frames, interpolate towards the next
+// packet when it is already in the jitter buffer
+long play_concealed(snd_pcm_t* handle, size_t bytes_per_frame,
+		    acast_resample_t* rs, acast_plc_t* plc,
+		    acast_jitter_t* jitter, uint8_t* buffer, size_t num_frames)
+{
+    uint8_t* next;
+    size_t next_frames = 0;
+
+    if (acast_jitter_peek(jitter, &next, &next_frames) != ACAST_JITTER_PLAY)
+	next = NULL;
+    acast_plc_conceal(plc, buffer, num_frames, next, next_frames);
+    return play_resampled(handle, bytes_per_frame, rs, buffer, num_frames);
+}
+
 int send_subscribe(int sock, struct sockaddr_in* addr, socklen_t addrlen,
 		   uint32_t id, uint32_t mask)
 {
@@ -135,25 +242,54 @@ int main(int argc, char** argv)
     socklen_t addrlen;
     struct sockaddr_in caddr;
     socklen_t caddrlen;    
-    uint8_t silence_buffer[BYTES_PER_PACKET];
     acast_t* silence;
-    uint32_t last_seqno = 0;
     acast_params_t iparam;
     acast_params_t sparam;
     acast_params_t lparam;
     snd_pcm_uframes_t frames_per_packet;
-    uint32_t drop = 0;
-    uint32_t seen_packet = 0;
+    uint32_t seen_packet = 0;  // playback started
+    uint32_t crc_errors = 0;
+    acast_recv_batch_t* rbatch;
+    size_t rnext = 0;
+    uint64_t num_batches = 0;
+    uint64_t batch_hist[RECV_BATCH+1];
     int num_output_channels = NUM_CHANNELS;
     char* map = CHANNEL_MAP;
     acast_channel_ctx_t chan_ctx;    
     size_t bytes_per_frame;
-    size_t network_bufsize = BYTES_PER_PACKET;
+    size_t network_bufsize;
+    size_t grow_size = 0;        // larger packet seen
     int mode = SND_PCM_NONBLOCK;
     uint32_t submask = 0;
     tick_t sub_time = 0;
     int client_mode = CLIENT_MODE_MIXED;
     uint32_t client_id = 0;
+    snd_pcm_format_t playback_format = SND_PCM_FORMAT_UNKNOWN;
+    acast_convert_t conv;
+    acast_jitter_t* jitter;
+    acast_jitter_stats_t jst;
+    acast_plc_t* plc;
+    acast_fec_dec_t* fec;
+    acast_resample_t* resample;
+    acast_resample_t* rs;        // resample or NULL if not supported
+    acast_drift_t drift;
+    acast_fec_stats_t fst;
+    uint64_t fec_repaired = 0;  // rebuilt packets stored before playout
+    int plc_ok;
+    int playing = 0;  // packets played since stream start
+    int min_latency = JITTER_MIN_LATENCY;
+    int max_latency = JITTER_MAX_LATENCY;
+    int sync_delay = 0;          // ms from capture to playout, 0 = off
+    acast_sr_t sr;               // latest sender report
+    int have_sr = 0;
+    uint32_t media_seqno = 0;    // next packet expected after the report
+    uint64_t media_next = 0;     // its media time
+    uint64_t media_time = 0;     // media time of the latest packet
+    long skew = 0;               // frames to skip (> 0) or insert (< 0)
+    double sync_error = 0.0;     // frames played late at last packet
+    uint64_t sync_steps = 0;
+    int poll_timeout;
+    uint64_t num_packets = 0;
     
     while(1) {
 	int option_index = 0;
@@ -169,17 +305,21 @@ int main(int argc, char** argv)
 	    {"ttl",    required_argument, 0,  't'},
 	    {"loop",   no_argument,       0,  'l'},	    
 	    {"device", required_argument, 0,  'd'},
+	    {"format", required_argument, 0,  'f'},
 	    {"channels",required_argument, 0, 'c'},
 	    {"map",     required_argument, 0, 'm'},
 	    {"sub",     required_argument, 0, 's'},
 	    {"unicast", no_argument,       0, 'U'},
 	    {"multicast", no_argument,     0, 'M'},
 	    {"id",      required_argument, 0, 'I'},
+	    {"latency", required_argument, 0, 'L'},
+	    {"sync",    required_argument, 0, 'S'},
+	    {"packet",  required_argument, 0, 'P'},
 	    {0,        0,                  0, 0}
 	};
 	
 
-	c = getopt_long(argc, argv, "lhvDUMa:i:p:t:d:c:m:s:I:",
+	c = getopt_long(argc, argv, "lhvDUMa:i:p:t:d:f:c:m:s:I:L:S:P:",
                         long_options, &option_index);
 	if (c == -1)
 	    break;
@@ -210,6 +350,13 @@ int main(int argc, char** argv)
 	case 'd':
 	    playback_device_name = strdup(optarg);
 	    break;
+	case 'f':
+	    playback_format = snd_pcm_format_value(optarg);
+	    if (!acast_convert_supported(playback_format)) {
+		fprintf(stderr, "unsupported format %s\n", optarg);
+		exit(1);
+	    }
+	    break;
 	case 'a':
 	    multicast_addr = strdup(optarg);
 	    break;
@@ -252,12 +399,45 @@ int main(int argc, char** argv)
 	case 'I':
 	    client_id = atoi(optarg);
 	    break;
+	case 'L': {  // min[:max] latency
+	    char* ptr;
+	    min_latency = atoi(optarg);
+	    if ((ptr = strchr(optarg, ':')) != NULL)
+		max_latency = atoi(ptr+1);
+	    if ((min_latency < 0) || (max_latency < min_latency)) {
+		fprintf(stderr, "latency out of range\n");
+		exit(1);
+	    }
+	    break;
+	}
+	case 'S':
+	    sync_delay = atoi(optarg);
+	    if (sync_delay < 0) {
+		fprintf(stderr, "sync delay out of range\n");
+		exit(1);
+	    }
+	    break;
+	case 'P':
+	    packet_size = atoi(optarg);
+	    if ((packet_size < MIN_PACKET_SIZE) ||
+		(packet_size > MAX_PACKET_SIZE)) {
+		fprintf(stderr, "packet size out of range %d..%d\n",
+			MIN_PACKET_SIZE, MAX_PACKET_SIZE);
+		exit(1);
+	    }
+	    break;
 	default:
 	    help();
 	    exit(1);	    
 	}
     }
 
+    if (alloc_buffers(packet_size) < 0) {
+	fprintf(stderr, "unable to allocate packet buffers\n");
+	exit(1);
+    }
+    network_bufsize = RECV_BATCH*packet_size;
+
     if ((err=snd_pcm_open(&handle,playback_device_name,
 			      SND_PCM_STREAM_PLAYBACK,mode)) < 0) {
 	fprintf(stderr, "snd_pcm_open failed %s\n", snd_strerror(err));
@@ -277,13 +457,19 @@ int main(int argc, char** argv)
     
     acast_clear_param(&iparam);
     // setup output parameters for sound card
-    iparam.format = SND_PCM_FORMAT_S16_LE;
+    if (playback_format != SND_PCM_FORMAT_UNKNOWN)
+	iparam.format = playback_format;
+    else
+	iparam.format = SND_PCM_FORMAT_S16_LE;
     iparam.sample_rate = 44100;
     iparam.channels_per_frame = num_output_channels;
-    acast_setup_param(handle, &iparam, &sparam, &frames_per_packet);
+    acast_setup_param(handle, &iparam, &sparam, packet_size,
+		      &frames_per_packet);
     bytes_per_frame = sparam.bytes_per_channel*sparam.channels_per_frame;
     acast_print_params(stderr, &sparam);
     lparam = sparam;
+    memset(&sr, 0, sizeof(sr));
+    acast_convert_setup(&conv, sparam.format, sparam.format);
 
     if ((sock=acast_receiver_open(multicast_addr,
 				  multicast_ifaddr,
@@ -303,7 +489,7 @@ int main(int argc, char** argv)
 				       multicast_ttl,
 				       multicast_loop,
 				       &caddr, &caddrlen,
-				       network_bufsize)) < 0) {
+				       network_bufsize, NULL)) < 0) {
 	fprintf(stderr, "unable to open multicast socket %s\n",
 		strerror(errno));
 	exit(1);
@@ -332,60 +518,178 @@ int main(int argc, char** argv)
 			       frames_per_packet*sparam.channels_per_frame);
 
     // flush_packets(sock);
+
+    if ((jitter = acast_jitter_new(JITTER_SLOTS, slot_size)) == NULL) {
+	fprintf(stderr, "unable to allocate jitter buffer\n");
+	exit(1);
+    }
+    // packets wait in the jitter buffer for their presentation time
+    if (max_latency < sync_delay)
+	max_latency = sync_delay;
+    acast_jitter_set_latency(jitter,
+			     time_tick_from_usec(min_latency*1000),
+			     time_tick_from_usec(max_latency*1000));
+    acast_jitter_reset(jitter, sparam.sample_rate);
+    if ((plc = acast_plc_new()) == NULL) {
+	fprintf(stderr, "unable to allocate concealment\n");
+	exit(1);
+    }
+    plc_ok = (acast_plc_setup(plc, sparam.format, sparam.channels_per_frame,
+			      sparam.sample_rate) == 0);
+    if ((fec = acast_fec_dec_new(packet_size)) == NULL) {
+	fprintf(stderr, "unable to allocate fec decoder\n");
+	exit(1);
+    }
+    if ((resample = acast_resample_new()) == NULL) {
+	fprintf(stderr, "unable to allocate resampler\n");
+	exit(1);
+    }
+    rs = (acast_resample_setup(resample, sparam.format,
+			       sparam.channels_per_frame) == 0) ?
+	resample : NULL;
+    acast_drift_reset(&drift, sparam.sample_rate);
+    // wake up at least once per packet to feed playback
+    poll_timeout = (frames_per_packet*1000) / sparam.sample_rate;
+    if (poll_timeout < 1)
+	poll_timeout = 1;
     
     if ((submask != 0) && (ctrl > -1)) {
 	send_subscribe(ctrl, &caddr, caddrlen, client_id, submask);
 	sub_time = time_tick_now();
     }
     
+    if ((rbatch = acast_recv_batch_new(RECV_BATCH, packet_size)) == NULL) {
+	fprintf(stderr, "unable to allocate receive batch\n");
+	exit(1);
+    }
+    memset(batch_hist, 0, sizeof(batch_hist));
+
     while(1) {
 	int r;
-	struct pollfd fds[2];
+	size_t rlen;
 	uint32_t crc;
-	
-	fds[0].fd = sock;
-	fds[0].events = POLLIN;
-	fds[1].fd = ctrl;
-	fds[1].events = POLLIN;	
 
-	if ((r = poll(fds, 2, 1000)) > 0) {
-	    acast_t* src;
-	    uint8_t src_buffer[BYTES_PER_PACKET];
-	    acast_t* dst;
-	    uint8_t dst_buffer[BYTES_PER_PACKET*SRC_CHANNELS];
-
-	    if (fds[0].revents & POLLIN) { // got multicast packet
-		src = (acast_t*) src_buffer;
-		r = recvfrom(sock, src_buffer, sizeof(src_buffer), 0, 
-			     (struct sockaddr *) &addr, &addrlen);
-		if (verbose) {
-//		    fprintf(stderr, "data packet from multicast %s:%d\n",
-//			    inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
-		}
-		if (r < 0) {
-		    perror("recvfrom");
+	if ((rnext == acast_recv_batch_count(rbatch)) &&
+	    (acast_fec_dec_pending(fec) == 0)) {
+	    // ring is drained, wait for packets and receive all queued
+	    struct pollfd fds[2];
+	    size_t n;
+
+	    fds[0].fd = sock;
+	    fds[0].events = POLLIN;
+	    fds[1].fd = ctrl;
+	    fds[1].events = POLLIN;
+
+	    // the sender uses larger packets, make room for them and set
+	    // up playback again with the next packet
+	    if (grow_size > packet_size) {
+		int val;
+		if (verbose)
+		    fprintf(stderr, "packet size %zu\n", grow_size);
+		acast_recv_batch_free(rbatch);
+		acast_fec_dec_free(fec);
+		acast_jitter_free(jitter);
+		if ((alloc_buffers(grow_size) < 0) ||
+		    ((rbatch = acast_recv_batch_new(RECV_BATCH,
+						    packet_size)) == NULL) ||
+		    ((fec = acast_fec_dec_new(packet_size)) == NULL) ||
+		    ((jitter = acast_jitter_new(JITTER_SLOTS,
+						slot_size)) == NULL)) {
+		    fprintf(stderr, "unable to allocate packet buffers\n");
 		    exit(1);
 		}
-		if (r == 0)
-		    continue;
+		acast_jitter_set_latency(jitter,
+					 time_tick_from_usec(min_latency*1000),
+					 time_tick_from_usec(max_latency*1000));
+		acast_jitter_reset(jitter, sparam.sample_rate);
+		silence = (acast_t*) silence_buffer;
+		silence->num_frames = frames_per_packet;
+		snd_pcm_format_set_silence(sparam.format, silence->data,
+				   frames_per_packet*sparam.channels_per_frame);
+		val = RECV_BATCH*packet_size;
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (void*)&val, sizeof(val));
+		acast_clear_param(&lparam);
 	    }
-	    else if (fds[1].revents & POLLIN) { // got unicast packet
-		src = (acast_t*) src_buffer;
-		r = recvfrom(ctrl, src_buffer, sizeof(src_buffer), 0, 
-			     (struct sockaddr *) &addr, &addrlen);
-		if (verbose) {
-//		    fprintf(stderr, "data packet from unicast %s:%d\n",
-//			    inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+
+	    acast_recv_batch_reset(rbatch);
+	    rnext = 0;
+	    if ((r = poll(fds, 2, poll_timeout)) > 0) {
+		// multicast packets then unicast packets
+		if ((fds[0].revents & POLLIN) &&
+		    (acast_recv_batch_fill(rbatch, sock) < 0)) {
+		    perror("recvmmsg");
+		    exit(1);
 		}
-		if (r < 0) {
-		    perror("recvfrom");
+		if ((fds[1].revents & POLLIN) &&
+		    (acast_recv_batch_fill(rbatch, ctrl) < 0)) {
+		    perror("recvmmsg");
 		    exit(1);
 		}
-		if (r == 0)
+		if ((n = acast_recv_batch_count(rbatch)) > 0) {
+		    batch_hist[n]++;
+		    if ((verbose > 1) && (++num_batches % 1000 == 0)) {
+			size_t k;
+			fprintf(stderr, "recv batch sizes:");
+			for (k = 1; k <= RECV_BATCH; k++) {
+			    if (batch_hist[k])
+				fprintf(stderr, " %zu:%lu", k,
+					(unsigned long) batch_hist[k]);
+			}
+			fprintf(stderr, "\n");
+		    }
+		}
+	    }
+	}
+
+	if ((rnext < acast_recv_batch_count(rbatch)) ||
+	    (acast_fec_dec_pending(fec) > 0)) {
+	    acast_t* src;
+	    acast_t* dst;
+	    snd_pcm_sframes_t delay;
+	    int rebuilt = 1;
+
+	    // rebuilt packets first, they are already late
+	    if ((src = acast_fec_dec_recovered(fec, &rlen)) == NULL) {
+		rebuilt = 0;
+		if (rnext == acast_recv_batch_count(rbatch))
 		    continue;
+		src = (acast_t*) acast_recv_batch_data(rbatch, rnext++, &rlen,
+						       &addr);
+		// truncated, grow when the ring is drained
+		if (rlen > packet_size) {
+		    if ((rlen > grow_size) && (rlen <= MAX_PACKET_SIZE))
+			grow_size = rlen;
+		    continue;
+		}
 	    }
+	    r = rlen;
+	    if (r == 0)
+		continue;
 
-	    if (src->magic != ACAST_MAGIC)
+	    if (src->magic == ACAST_MAGIC_FEC) {
+		if (acast_fec_dec_parity(fec, (acast_fec_t*) src, r) < 0)
+		    fprintf(stderr, "crc error parity header corrupt\n");
+		continue;
+	    }
+	    if (src->magic == ACAST_MAGIC_SR) {
+		acast_sr_t* rp = (acast_sr_t*) src;
+		if (r < (int) sizeof(acast_sr_t))
+		    continue;
+		crc = rp->crc;
+		rp->crc = 0;
+		if (crc32((uint8_t*) rp, sizeof(acast_sr_t)) != crc) {
+		    fprintf(stderr, "crc error sender report corrupt\n");
+		    continue;
+		}
+		if (rp->sample_rate != 0) {
+		    sr = *rp;
+		    have_sr = 1;
+		    media_seqno = sr.seqno;
+		    media_next = sr.timestamp;
+		}
+		continue;
+	    }
+	    if ((src->magic != ACAST_MAGIC) && (src->magic != ACAST_MAGIC_CRC))
 		continue;
 	    crc = src->crc;
 	    src->crc = 0;
@@ -393,9 +697,20 @@ int main(int argc, char** argv)
 		fprintf(stderr, "crc error packet header corrupt\n");
 		continue;
 	    }
+	    // drop packets with corrupt audio data
+	    if ((len = acast_check_payload_crc(src, r)) < 0) {
+		crc_errors++;
+		if (verbose)
+		    fprintf(stderr, "crc error packet data corrupt (%u)\n",
+			    crc_errors);
+		continue;
+	    }
+	    // keep the packet as sent for parity recovery
+	    src->crc = crc;
+	    acast_fec_dec_data(fec, src, r);
 
 	    if (debug) {
-		if ((r - sizeof(acast_t)) !=
+		if (len !=
 		    src->param.bytes_per_channel *
 		    src->param.channels_per_frame*src->num_frames) {
 		    fprintf(stderr, "param data mismatch r=%d\n", r);
@@ -416,17 +731,57 @@ int main(int argc, char** argv)
 		lparam = src->param;
 		iparam = lparam;
 		num_output_channels = iparam.channels_per_frame;
-
-		acast_setup_param(handle, &iparam, &sparam, &frames_per_packet);
+		// play in our own format and convert, not in alsa plug
+		if (playback_format != SND_PCM_FORMAT_UNKNOWN)
+		    iparam.format = playback_format;
+
+		acast_setup_param(handle, &iparam, &sparam, packet_size,
+				  &frames_per_packet);
+		if (acast_convert_setup(&conv, lparam.format, sparam.format) < 0) {
+		    fprintf(stderr, "can not convert from %s to %s\n",
+			    snd_pcm_format_name(lparam.format),
+			    snd_pcm_format_name(sparam.format));
+		    iparam.format = lparam.format;
+		    acast_setup_param(handle,&iparam,&sparam,packet_size,
+				      &frames_per_packet);
+		    acast_convert_setup(&conv, sparam.format, sparam.format);
+		}
 
 		bytes_per_frame = sparam.bytes_per_channel*
 		    sparam.channels_per_frame;
 		silence->num_frames = frames_per_packet;
 		snd_pcm_format_set_silence(sparam.format,silence->data,
 	                       frames_per_packet*sparam.channels_per_frame);
+		acast_jitter_reset(jitter, lparam.sample_rate);
+		plc_ok = (acast_plc_setup(plc, sparam.format,
+					  sparam.channels_per_frame,
+					  sparam.sample_rate) == 0);
+		rs = (acast_resample_setup(resample, sparam.format,
+					   sparam.channels_per_frame) == 0) ?
+		    resample : NULL;
+		acast_drift_reset(&drift, sparam.sample_rate);
+		playing = 0;
+		have_sr = 0;
+		skew = 0;
+		poll_timeout = (frames_per_packet*1000) / sparam.sample_rate;
+		if (poll_timeout < 1)
+		    poll_timeout = 1;
 		seen_packet = 0;
 	    }
 
+	    if (conv.convert != NULL) {
+		acast_t* cnv = (acast_t*) cnv_buffer;
+		size_t n = src->num_frames*src->param.channels_per_frame;
+		if (n*conv.dst_bytes > 4*packet_size-sizeof(acast_t))
+		    continue;
+		*cnv = *src;
+		acast_convert(&conv, src->data, cnv->data, n);
+		src = cnv;
+	    }
+
+	    // map the frames the packet holds, they must fit in a slot
+	    if (src->num_frames*bytes_per_frame > slot_size-sizeof(acast_t))
+		continue;
 	    switch(chan_ctx.type) {
 	    case ACAST_MAP_PERMUTE:		
 		dst = (acast_t*) dst_buffer;
@@ -435,16 +790,25 @@ int main(int argc, char** argv)
 			   src->data, src->param.channels_per_frame,
 			   dst->data, num_output_channels, 
 			   chan_ctx.channel_map,
-			   frames_per_packet);
+			   src->num_frames);
 		break;
 	    case ACAST_MAP_OP:
 		dst = (acast_t*) dst_buffer;
 		dst->param = sparam;
-		scatter_gather_ii(sparam.format,
-				  src->data, src->param.channels_per_frame,
-				  dst->data, num_output_channels,
-				  chan_ctx.channel_op, chan_ctx.num_channel_ops,
-				  frames_per_packet);
+		channel_prog_ii(sparam.format,
+				src->data, src->param.channels_per_frame,
+				dst->data, num_output_channels,
+				&chan_ctx.prog,
+				src->num_frames);
+		break;
+	    case ACAST_MAP_MATRIX:
+		dst = (acast_t*) dst_buffer;
+		dst->param = sparam;
+		matrix_ii(sparam.format,
+			  src->data, src->param.channels_per_frame,
+			  dst->data, num_output_channels,
+			  &chan_ctx.matrix,
+			  src->num_frames);
 		break;
 	    case ACAST_MAP_ID:
 		dst = src;
@@ -463,34 +827,174 @@ int main(int argc, char** argv)
 		acast_print(stderr, dst);
 	    }
 	    
-	    if (!seen_packet) {
-		acast_play(handle,bytes_per_frame,
-			    silence->data,silence->num_frames);
-		acast_play(handle,bytes_per_frame,
-			   silence->data,silence->num_frames);
-		snd_pcm_start(handle);
+	    // played from the jitter buffer in seqno order
+	    r = acast_jitter_put(jitter, dst->seqno, time_tick_now(),
+				 dst->data, dst->num_frames*bytes_per_frame,
+				 dst->num_frames);
+	    if (debug && (r == ACAST_JITTER_LATE))
+		fprintf(stderr, "late packet %u\n", dst->seqno);
+	    // media time counts the frames of the packets since the
+	    // report, missing packets are taken to be as long as this one
+	    if (have_sr) {
+		int32_t d = (int32_t)(dst->seqno - media_seqno);
+		media_time = media_next + (int64_t) d*dst->num_frames;
+		if (d >= 0) {
+		    media_seqno = dst->seqno + 1;
+		    media_next = media_time + dst->num_frames;
+		}
 	    }
-
-	    if ((len=acast_play(handle, bytes_per_frame, dst->data, dst->num_frames)) < 0) {
-		err = len;
-		fprintf(stderr, "snd_pcm_writei %s\n", snd_strerror(err));
-		snd_pcm_reset(handle);
-		snd_pcm_prepare(handle);
-		seen_packet = 0;
-		continue;
+	    if (rebuilt && (r == ACAST_JITTER_STORED))
+		fec_repaired++;
+	    // audio buffered when a packet arrives is its latency, hold
+	    // it at the jitter target plus the two packets kept in the
+	    // device. the speed follows the sender and playback clock
+	    // difference
+	    if ((r == ACAST_JITTER_STORED) && playing &&
+		(snd_pcm_delay(handle, &delay) >= 0)) {
+		double error;
+
+		acast_jitter_stats(jitter, &jst);
+		if (sync_delay && have_sr) {
+		    // hold the packet at its presentation time instead
+		    double ahead = (double) delay - skew +
+			acast_jitter_frames_before(jitter, dst->seqno);
+		    double late = (double)(int64_t)(media_time - sr.timestamp) /
+			sr.sample_rate;
+		    int64_t pt = sr.wallclock + (int64_t)(late*1000000.0) +
+			sync_delay*1000;
+		    double wanted = (double)(pt - (int64_t) time_wall_usec())*
+			sparam.sample_rate / 1000000.0;
+		    error = ahead - wanted;
+		    // far off at start or after an xrun, step there
+		    if (fabs(error) >
+			(double) SYNC_MAX_SKEW*sparam.sample_rate/1000000.0) {
+			skew += lround(error);
+			acast_drift_step(&drift);
+			sync_steps++;
+			error = 0.0;
+		    }
+		    sync_error = error;
+		}
+		else
+		    error = (double) jst.depth + delay -
+			(double)(jst.target + 2*frames_per_packet);
+		if (rs != NULL) {
+		    acast_drift_update(&drift, error, dst->num_frames);
+		    acast_resample_set_ratio(rs, drift.ratio);
+		}
 	    }
-	    if (len < dst->num_frames) {
-		fprintf(stderr, "short write %d\n", len);
+	    if (!seen_packet) {
+		start_playback(handle, bytes_per_frame, silence);
+		seen_packet = 1;
 	    }
-
-	    if (verbose && seen_packet &&
-		((drop=(dst->seqno - last_seqno)) != 1))
-		fprintf(stderr, "dropped %u frames\n", drop);
 	    if ((verbose > 1) && (dst->seqno % 100) == 0) {
 		acast_print(stderr, dst);
 	    }
-	    seen_packet = 1;
-	    last_seqno = dst->seqno;
+	    if ((verbose > 1) && (++num_packets % 1000) == 0) {
+		acast_jitter_stats(jitter, &jst);
+		fprintf(stderr, "jitter %.0fus depth %zu target %zu "
+			"lost %lu late %lu reordered %lu duplicate %lu "
+			"underrun %lu overflow %lu\n",
+			jst.jitter_us, jst.depth, jst.target,
+			(unsigned long) jst.lost, (unsigned long) jst.late,
+			(unsigned long) jst.reordered,
+			(unsigned long) jst.duplicate,
+			(unsigned long) jst.underrun,
+			(unsigned long) jst.overflow);
+		if (rs != NULL)
+		    fprintf(stderr, "drift %+.1fppm level %.0f frames\n",
+			    acast_drift_ppm(&drift), drift.level);
+		if (sync_delay && have_sr)
+		    fprintf(stderr, "sync error %.3fms steps %lu\n",
+			    (1000.0*sync_error)/sparam.sample_rate,
+			    (unsigned long) sync_steps);
+		acast_fec_dec_stats(fec, &fst);
+		if (fst.parity > 0) {
+		    // losses repaired in time out of all losses
+		    uint64_t losses = fec_repaired + jst.lost;
+		    fprintf(stderr, "fec parity %lu recovered %lu "
+			    "repaired %lu (%.1f%%) failed %lu corrupt %lu\n",
+			    (unsigned long) fst.parity,
+			    (unsigned long) fst.recovered,
+			    (unsigned long) fec_repaired,
+			    losses ? (100.0*fec_repaired)/losses : 100.0,
+			    (unsigned long) fst.failed,
+			    (unsigned long) fst.corrupt);
+		}
+	    }
+	}
+
+	// feed playback from the jitter buffer at the device rate,
+	// keep about two packets queued in the device
+	if (seen_packet) {
+	    snd_pcm_sframes_t delay;
+
+	    while(((err = snd_pcm_delay(handle, &delay)) >= 0) &&
+		  (delay < (snd_pcm_sframes_t) (2*frames_per_packet))) {
+		uint8_t* data;
+		size_t num_frames;
+		int status;
+
+		if (skew < 0) {  // insert silence to play later
+		    size_t n = ((size_t) -skew < silence->num_frames) ?
+			(size_t) -skew : silence->num_frames;
+		    if ((len = play_silence(handle, bytes_per_frame, rs,
+					    silence, n)) < 0) {
+			err = len;
+			break;
+		    }
+		    skew += n;
+		    continue;
+		}
+		status = acast_jitter_get(jitter, &data, &num_frames);
+		if ((skew > 0) && (status != ACAST_JITTER_WAIT)) {
+		    // skip frames to play earlier
+		    size_t n = ((size_t) skew < num_frames) ?
+			(size_t) skew : num_frames;
+		    if (status == ACAST_JITTER_PLAY)
+			data += n*bytes_per_frame;
+		    num_frames -= n;
+		    skew -= n;
+		}
+		switch(status) {
+		case ACAST_JITTER_PLAY:
+		    if (plc_ok)
+			acast_plc_update(plc, data, num_frames);
+		    len = play_resampled(handle, bytes_per_frame, rs,
+					 data, num_frames);
+		    playing = 1;
+		    break;
+		case ACAST_JITTER_LOST:
+		    if (verbose)
+			fprintf(stderr, "lost packet\n");
+		    if (plc_ok)
+			len = play_concealed(handle, bytes_per_frame, rs, plc,
+					     jitter, plc_buffer, num_frames);
+		    else
+			len = play_silence(handle, bytes_per_frame, rs,
+					   silence, num_frames);
+		    break;
+		default:
+		    // conceal an underrun, or play silence while the
+		    // buffer fills up at start
+		    if (plc_ok && playing)
+			len = play_concealed(handle, bytes_per_frame, rs, plc,
+					     jitter, plc_buffer,
+					     silence->num_frames);
+		    else
+			len = play_silence(handle, bytes_per_frame, rs,
+					   silence, silence->num_frames);
+		    break;
+		}
+		if (len < 0) {
+		    err = len;
+		    break;
+		}
+	    }
+	    if (err < 0) {
+		fprintf(stderr, "snd_pcm_writei %s\n", snd_strerror(err));
+		start_playback(handle, bytes_per_frame, silence);
+	    }
 	}
 
 	if ((submask != 0) && (ctrl > -1)) {
@@ -0,0 +1,189 @@
+//
+//  Asynchronous resampling for clock drift compensation
+//
+//  Input is decoded to native S32 and kept as interleaved float, the
+//  read position advances by ratio input frames per output frame. The
+//  last frames are kept between calls so the interpolation continues
+//  across packets.
+//
+//  The drift estimator is a PI controller on a low pass filtered
+//  buffer level: the proportional part corrects a level error over
+//  DRIFT_CORRECT_S seconds, the integral part takes over the steady
+//  clock difference so no level error remains.
+//
+#include <stdlib.h>
+#include <string.h>
+
+#include "acast.h"
+#include "acast_resample.h"
+#include "acast_convert.h"
+
+#define RS_BLOCK         256     // input frames per decode block
+#define RS_HIST          3       // frames kept for interpolation
+
+#define DRIFT_FILTER_S   2.0     // level filter time constant
+#define DRIFT_CORRECT_S  10.0    // time to correct a level error
+#define DRIFT_INTEGRAL_S 100.0   // integral time
+
+struct _acast_resample_t
+{
+    size_t channels;
+    acast_convert_t dec;    // stream format -> S32
+    acast_convert_t enc;    // S32 -> stream format
+    double ratio;
+    double pos;             // read position in buf
+    size_t used;            // frames in buf
+    float buf[(RS_HIST+1+RS_BLOCK)*MAX_CHANNELS];
+    int32_t tmp[RS_BLOCK*MAX_CHANNELS];
+};
+
+acast_resample_t* acast_resample_new(void)
+{
+    return calloc(1, sizeof(acast_resample_t));
+}
+
+void acast_resample_free(acast_resample_t* rs)
+{
+    free(rs);
+}
+
+int acast_resample_setup(acast_resample_t* rs, snd_pcm_format_t fmt,
+			 size_t channels)
+{
+    rs->channels = 0;
+    if ((channels == 0) || (channels > MAX_CHANNELS))
+	return -1;
+    if ((acast_convert_setup(&rs->dec, fmt, SND_PCM_FORMAT_S32) < 0) ||
+	(acast_convert_setup(&rs->enc, SND_PCM_FORMAT_S32, fmt) < 0))
+	return -1;
+    rs->channels = channels;
+    rs->ratio = 1.0;
+    // start with silence so the first frame is interpolated as usual
+    memset(rs->buf, 0, sizeof(rs->buf));
+    rs->used = RS_HIST;
+    rs->pos = 1.0;
+    return 0;
+}
+
+void acast_resample_set_ratio(acast_resample_t* rs, double ratio)
+{
+    rs->ratio = ratio;
+}
+
+// Catmull-Rom spline through x1 and x2 at t in [0,1)
+static inline float cubic(float x0, float x1, float x2, float x3, float t)
+{
+    float c1 = 0.5f*(x2 - x0);
+    float c2 = x0 - 2.5f*x1 + 2.0f*x2 - 0.5f*x3;
+    float c3 = 0.5f*(x3 - x0) + 1.5f*(x1 - x2);
+    return ((c3*t + c2)*t + c1)*t + x1;
+}
+
+// encode k interpolated frames from tmp to dst
+static uint8_t* rs_flush(acast_resample_t* rs, uint8_t* dst, size_t k)
+{
+    acast_convert(&rs->enc, rs->tmp, dst, k*rs->channels);
+    return dst + k*rs->channels*rs->enc.dst_bytes;
+}
+
+size_t acast_resample(acast_resample_t* rs, void* src, size_t num_frames,
+		      void* dst, size_t max_frames)
+{
+    size_t nch = rs->channels;
+    size_t src_bytes_per_frame = nch*rs->dec.src_bytes;
+    uint8_t* sp = src;
+    uint8_t* dp = dst;
+    size_t out = 0;
+    size_t k = 0;       // frames in tmp
+
+    if (nch == 0)
+	return 0;
+    while(num_frames > 0) {
+	size_t n = (num_frames < RS_BLOCK) ? num_frames : RS_BLOCK;
+	float* x = rs->buf + rs->used*nch;
+	size_t i, keep;
+
+	acast_convert(&rs->dec, sp, rs->tmp, n*nch);
+	for (i = 0; i < n*nch; i++)
+	    x[i] = rs->tmp[i] / ACAST_S32_SCALE;
+	rs->used += n;
+	sp += n*src_bytes_per_frame;
+	num_frames -= n;
+
+	// tmp is free now, reuse it for output frames
+	while((rs->pos + 2 < rs->used) && (out < max_frames)) {
+	    size_t j = (size_t) rs->pos;
+	    float t = rs->pos - j;
+	    float* p = rs->buf + (j-1)*nch;
+	    int32_t* y = rs->tmp + k*nch;
+
+	    for (i = 0; i < nch; i++)
+		y[i] = acast_float_to_s32(cubic(p[i], p[nch+i],
+						p[2*nch+i], p[3*nch+i], t));
+	    out++;
+	    rs->pos += rs->ratio;
+	    if (++k == RS_BLOCK) {
+		dp = rs_flush(rs, dp, k);
+		k = 0;
+	    }
+	}
+	// keep the frames needed from the current position on
+	keep = rs->used - ((size_t) rs->pos - 1);
+	if (keep > RS_HIST+1) {  // output full, skip input
+	    rs->pos += keep - (RS_HIST+1);
+	    keep = RS_HIST+1;
+	}
+	memmove(rs->buf, rs->buf + (rs->used - keep)*nch,
+		keep*nch*sizeof(float));
+	rs->pos -= rs->used - keep;
+	rs->used = keep;
+	// flush before tmp is used for decoding again
+	if (k > 0) {
+	    dp = rs_flush(rs, dp, k);
+	    k = 0;
+	}
+    }
+    return out;
+}
+
+void acast_drift_reset(acast_drift_t* d, uint32_t sample_rate)
+{
+    d->sample_rate = sample_rate ? sample_rate : 48000;
+    d->level = 0.0;
+    d->integral = 0.0;
+    d->ratio = 1.0;
+}
+
+double acast_drift_update(acast_drift_t* d, double error, size_t num_frames)
+{
+    double max = ACAST_DRIFT_MAX_PPM*1e-6;
+    double dt = (double) num_frames / d->sample_rate;
+    double a = dt / DRIFT_FILTER_S;
+    double p;
+    double c;
+
+    d->level += ((a < 1.0) ? a : 1.0)*(error - d->level);
+    p = d->level / (d->sample_rate*DRIFT_CORRECT_S);
+    d->integral += p*dt/DRIFT_INTEGRAL_S;
+    if (d->integral > max)
+	d->integral = max;
+    else if (d->integral < -max)
+	d->integral = -max;
+    c = p + d->integral;
+    if (c > max)
+	c = max;
+    else if (c < -max)
+	c = -max;
+    d->ratio = 1.0 + c;
+    return d->ratio;
+}
+
+void acast_drift_step(acast_drift_t* d)
+{
+    d->level = 0.0;
+}
+
+double acast_drift_ppm(acast_drift_t* d)
+{
+    return d->integral*1e6;
+}
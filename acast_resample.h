@@ -0,0 +1,56 @@
+//
+//  Asynchronous resampling for clock drift compensation
+//
+//  The resampler plays the stream at a slightly different speed with
+//  cubic (Catmull-Rom) interpolation between input frames. The drift
+//  estimator turns the number of buffered frames (jitter buffer plus
+//  device delay) into a speed that holds the latency at its target
+//  while the sender and playback clocks differ.
+//
+#ifndef __ACAST_RESAMPLE_H__
+#define __ACAST_RESAMPLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <alsa/asoundlib.h>
+
+#define ACAST_DRIFT_MAX_PPM 1000   // max speed correction
+
+typedef struct _acast_resample_t acast_resample_t;
+
+extern acast_resample_t* acast_resample_new(void);
+extern void acast_resample_free(acast_resample_t* rs);
+// set interleaved stream format, speed 1 and clear history,
+// return -1 if the format is not supported
+extern int acast_resample_setup(acast_resample_t* rs, snd_pcm_format_t fmt,
+				size_t channels);
+// input frames consumed per output frame
+extern void acast_resample_set_ratio(acast_resample_t* rs, double ratio);
+// resample num_frames frames from src to at most max_frames frames
+// in dst, return number of frames written to dst
+extern size_t acast_resample(acast_resample_t* rs, void* src,
+			     size_t num_frames, void* dst, size_t max_frames);
+
+typedef struct
+{
+    uint32_t sample_rate;
+    double level;          // filtered buffer level error in frames
+    double integral;       // correction for steady drift
+    double ratio;          // current speed
+} acast_drift_t;
+
+extern void acast_drift_reset(acast_drift_t* d, uint32_t sample_rate);
+// error is buffered minus wanted frames, measured when a packet of
+// num_frames frames arrives. return new speed (input frames per output
+// frame)
+extern double acast_drift_update(acast_drift_t* d, double error,
+				 size_t num_frames);
+// the buffer level was set to the wanted level in one step, restart
+// the level filter and keep the drift estimate
+extern void acast_drift_step(acast_drift_t* d);
+// estimated clock difference in parts per million, positive when the
+// sender clock is faster
+extern double acast_drift_ppm(acast_drift_t* d);
+
+#endif
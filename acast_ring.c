@@ -0,0 +1,155 @@
+//
+//  Block ring
+//
+//  head and tail count blocks from the start and only grow, each is
+//  stored by one side only, with release order so the other side sees
+//  the block contents before the index. They are kept on separate
+//  cache lines. A commit also bumps an eventfd that a waiting
+//  consumer sleeps on, the ring itself never blocks.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "acast_ring.h"
+
+#define CACHE_LINE 64
+
+struct _acast_ring_t
+{
+    // producer
+    _Alignas(CACHE_LINE) _Atomic size_t head;   // blocks committed
+    _Atomic uint64_t overruns;
+    // consumer
+    _Alignas(CACHE_LINE) _Atomic size_t tail;   // blocks released
+    size_t peak;
+    // constant
+    _Alignas(CACHE_LINE) size_t num_blocks;     // power of two
+    size_t block_size;
+    uint8_t* block;
+    int efd;
+};
+
+acast_ring_t* acast_ring_new(size_t num_blocks, size_t block_size)
+{
+    acast_ring_t* r;
+    size_t n = 1;
+
+    while(n < num_blocks)
+	n <<= 1;
+    block_size = (block_size + 7) & ~(size_t)7;
+    if ((r = aligned_alloc(CACHE_LINE, sizeof(acast_ring_t))) == NULL)
+	return NULL;
+    memset(r, 0, sizeof(acast_ring_t));
+    r->num_blocks = n;
+    r->block_size = block_size;
+    r->efd = -1;
+    if (((r->block = malloc(n*block_size)) == NULL) ||
+	((r->efd = eventfd(0, EFD_NONBLOCK)) < 0)) {
+	acast_ring_free(r);
+	return NULL;
+    }
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->overruns, 0);
+    return r;
+}
+
+void acast_ring_free(acast_ring_t* r)
+{
+    if (r->efd >= 0)
+	close(r->efd);
+    free(r->block);
+    free(r);
+}
+
+size_t acast_ring_capacity(acast_ring_t* r)
+{
+    return r->num_blocks;
+}
+
+size_t acast_ring_block_size(acast_ring_t* r)
+{
+    return r->block_size;
+}
+
+void* acast_ring_write_ptr(acast_ring_t* r)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head - tail >= r->num_blocks) {
+	atomic_fetch_add_explicit(&r->overruns, 1, memory_order_relaxed);
+	return NULL;
+    }
+    return r->block + (head & (r->num_blocks-1))*r->block_size;
+}
+
+void acast_ring_write_commit(acast_ring_t* r)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t one = 1;
+
+    atomic_store_explicit(&r->head, head+1, memory_order_release);
+    // a full counter is still readable, nothing to do then
+    if (write(r->efd, &one, sizeof(one)) < 0)
+	return;
+}
+
+uint64_t acast_ring_overruns(acast_ring_t* r)
+{
+    return atomic_load_explicit(&r->overruns, memory_order_relaxed);
+}
+
+void* acast_ring_read_ptr(acast_ring_t* r)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (head == tail)
+	return NULL;
+    if (head - tail > r->peak)
+	r->peak = head - tail;
+    return r->block + (tail & (r->num_blocks-1))*r->block_size;
+}
+
+void acast_ring_read_release(acast_ring_t* r)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&r->tail, tail+1, memory_order_release);
+}
+
+void acast_ring_wait(acast_ring_t* r)
+{
+    struct pollfd fds;
+    uint64_t val;
+
+    // clear the counter first, a commit after that wakes the poll
+    if (read(r->efd, &val, sizeof(val)) > 0)
+	return;
+    if (acast_ring_count(r) > 0)
+	return;
+    fds.fd = r->efd;
+    fds.events = POLLIN;
+    poll(&fds, 1, -1);
+}
+
+size_t acast_ring_count(acast_ring_t* r)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    return head - tail;
+}
+
+size_t acast_ring_peak(acast_ring_t* r)
+{
+    size_t peak = r->peak;
+
+    r->peak = acast_ring_count(r);
+    return peak;
+}
@@ -0,0 +1,44 @@
+//
+//  Block ring
+//
+//  Single producer single consumer ring of fixed size blocks. The
+//  producer fills the block returned by acast_ring_write_ptr and
+//  commits it, the consumer reads the oldest block and releases it.
+//  Neither side ever waits on the other: a full ring refuses the
+//  block (counted as an overrun) and an empty ring returns NULL. A
+//  consumer with nothing else to do may sleep in acast_ring_wait.
+//
+#ifndef __ACAST_RING_H__
+#define __ACAST_RING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct _acast_ring_t acast_ring_t;
+
+// ring of num_blocks (rounded up to a power of two) blocks of
+// block_size bytes, blocks are 8 byte aligned
+extern acast_ring_t* acast_ring_new(size_t num_blocks, size_t block_size);
+extern void acast_ring_free(acast_ring_t* r);
+extern size_t acast_ring_capacity(acast_ring_t* r);
+extern size_t acast_ring_block_size(acast_ring_t* r);
+
+// producer: next free block, or NULL and one more overrun when full
+extern void* acast_ring_write_ptr(acast_ring_t* r);
+// producer: publish the block from acast_ring_write_ptr
+extern void acast_ring_write_commit(acast_ring_t* r);
+// overruns so far, may be read by either side
+extern uint64_t acast_ring_overruns(acast_ring_t* r);
+
+// consumer: oldest block, or NULL when empty
+extern void* acast_ring_read_ptr(acast_ring_t* r);
+// consumer: give the block from acast_ring_read_ptr back
+extern void acast_ring_read_release(acast_ring_t* r);
+// consumer: sleep until a block is committed, may return early
+extern void acast_ring_wait(acast_ring_t* r);
+// consumer: blocks queued
+extern size_t acast_ring_count(acast_ring_t* r);
+// consumer: most blocks queued since the last call
+extern size_t acast_ring_peak(acast_ring_t* r);
+
+#endif
@@ -10,18 +10,30 @@
 #include <string.h>
 #include <getopt.h>
 #include <sched.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "acast.h"
+#include "acast_client.h"
+#include "acast_group.h"
+#include "acast_wheel.h"
+#include "acast_fec.h"
+#include "acast_ring.h"
 #include "tick.h"
 #include "crc32.h"
 
-#define MAX_CLIENTS     9
+#define MAX_UCLIENTS    8    // -u clients, one channel each
+#define BUFFER_CLIENTS  9    // clients the socket buffers are sized for
+#define MAX_SEGMENTS    16   // max packets per client and send
+#define CAPTURE_PACKETS 4    // packets per capture read
+#define MAX_CAPTURE_PACKETS 64
+#define RING_BLOCKS     16   // capture reads queued for sending
 
 #define CAPTURE_DEVICE "default"
+#define CAPTURE_FORMAT "S16_LE"
 #define NUM_CHANNELS  6
 #define CHANNEL_MAP   "auto"
 
@@ -30,8 +42,44 @@
 #define MULTICAST_LOOP 0
 
 // client 0 is the default multicast client
-static int num_clients = 1;
-client_t client[MAX_CLIENTS];
+static acast_clients_t* clients;
+// subscription timeouts of unicast clients
+static acast_wheel_t* expiry;
+// clients with the same mapping share packets
+static acast_groups_t* groups;
+
+// packet of a stream group, built for the first member sent to
+typedef struct
+{
+    acast_t* hdr;            // NULL until built
+    uint8_t* data;
+    size_t len;
+    uint32_t* trailer;
+    size_t trailer_len;
+    int np;                  // parity packets
+    uint8_t* out[2];
+    size_t out_len[2];
+} group_packet_t;
+
+// capture read as queued in the ring, frames follow the header
+typedef struct
+{
+    uint64_t media_time;     // frames captured before this block
+    uint64_t wallclock;      // usec when the first frame was captured
+    uint32_t num_frames;
+    uint32_t xruns;          // device overruns so far
+    uint8_t  data[];
+} capture_block_t;
+
+// state owned by the capture thread once started
+typedef struct
+{
+    snd_pcm_t* handle;
+    acast_ring_t* ring;
+    size_t bytes_per_frame;
+    size_t block_frames;     // frames per read
+    unsigned int sample_rate;
+} capture_t;
 
 #define min(a,b) (((a)<(b)) ? (a) : (b))
 #define max(a,b) (((a)>(b)) ? (a) : (b))
@@ -56,9 +104,18 @@ printf("usage: acast_sender [options]\n"
 "  -l, --loop      enable multi cast loop (%d)\n"
 "  -t, --ttl       multicast ttl (%d)\n"
 "  -d, --device    capture device (%s)\n"
+"  -f, --format    capture format (%s)\n"
+"  -F, --netformat network format (same as capture)\n"
+"  -K, --crc       add crc32c checksum of audio data\n"
+"  -G, --gso       packets per client and send using UDP_SEGMENT (1)\n"
+"  -E, --fec       parity packet every K packets, K:D adds column\n"
+"                  parity over blocks of D rows (off)\n"
+"  -P, --packet    packet size in bytes, \"mtu\" for the path mtu (%d)\n"
+"  -B, --capture   packets per capture device read (%d)\n"
 "  -c, --channels  number of output channels (%d)\n"
 "  -C, --ichannels  number of input channels (%d)\n"
-"  -m, --map       channel map (%s)\n",
+"  -m, --map       channel map (%s)\n"
+"                  dN is N in sample units, N/32768 for float formats\n",
        MULTICAST_ADDR,
        INTERFACE_ADDR,
        MULTICAST_PORT,
@@ -66,6 +123,9 @@ printf("usage: acast_sender [options]\n"
        MULTICAST_LOOP,       
        MULTICAST_TTL,
        CAPTURE_DEVICE,
+       CAPTURE_FORMAT,
+       BYTES_PER_PACKET,
+       CAPTURE_PACKETS,
        NUM_CHANNELS,
        NUM_CHANNELS,       
        CHANNEL_MAP);
@@ -90,53 +150,108 @@ void set_client_mask(client_t* cp, uint32_t mask)
     cp->chan_ctx.type = ACAST_MAP_PERMUTE;
     cp->chan_ctx.num_channel_ops = j;
     cp->num_output_channels = j;
+    compile_channel_ctx(&cp->chan_ctx);
 }
 
-// fixme store compare struct sockaddr ?
+// remove cp from its group, the last member releases the group
+void client_leave_group(client_t* cp)
+{
+    int g = cp->group;
+
+    if (acast_groups_leave(groups, cp)) {
+	client_t* gp = &acast_groups_array(groups)[g];
+	if (gp->fec != NULL) {
+	    acast_fec_enc_free(gp->fec);
+	    gp->fec = NULL;
+	}
+    }
+}
+
+// set the channel mask of cp and move it to the group with its
+// mapping, return the group or -1
+int client_set_group(client_t* cp, uint32_t mask)
+{
+    client_leave_group(cp);
+    set_client_mask(cp, mask);
+    return acast_groups_join(groups, cp);
+}
+
+// add a client or refresh its subscription, a client added with
+// timeout 0 never expires
 int client_add(uint32_t id,struct sockaddr_in* addr,socklen_t addrlen,
-	       uint32_t mask)
+	       uint32_t mask, tick_t timeout)
 {
+    client_t* cp;
     int i;
-    for (i = 0; i < num_clients; i++) {
-	// maybe compare components?
-	if ((client[i].id && (client[i].id == id)) ||
-	    ((client[i].id == 0) && (id == 0) &&
-	     (memcmp(&client[i].addr, &addr, addrlen) == 0))) {
-	    int updated = 0;
-	    client[i].tmo = time_tick_now() + CLIENT_TIMEOUT;
-	    if (mask != client[i].mask) {
-		set_client_mask(&client[i], mask);
-		updated = 1;
-	    }
-	    if (memcmp(&client[i].addr, &addr, addrlen) != 0) {
-		client[i].addr = *addr;
-		updated = 1;
-	    }
-	    if (updated && verbose) {
-		fprintf(stderr, "unicast client [%d] id=%d %s:%d updated\n",
-			i, client[i].id,
-			inet_ntoa(addr->sin_addr),
-			ntohs(addr->sin_port));
-	    }
-	    return 0;
+
+    if ((i = acast_clients_find(clients, id, addr)) >= 0) {
+	int updated = 0;
+	cp = &acast_clients_array(clients)[i];
+	if (cp->tmo && timeout) {
+	    cp->tmo = time_tick_now() + timeout;
+	    acast_wheel_set(expiry, i, cp->tmo);
+	}
+	if (mask != cp->mask) {
+	    client_set_group(cp, mask);
+	    updated = 1;
+	}
+	if (memcmp(&cp->addr, addr, addrlen) != 0) {
+	    cp->addr = *addr;
+	    updated = 1;
+	}
+	if (updated && verbose) {
+	    fprintf(stderr, "unicast client [%d] id=%d %s:%d updated\n",
+		    i, cp->id,
+		    inet_ntoa(addr->sin_addr),
+		    ntohs(addr->sin_port));
+	}
+	return 0;
+    }
+    if ((i = acast_clients_add(clients, id, addr, addrlen)) < 0)
+	return -1;
+    cp = &acast_clients_array(clients)[i];
+    if (client_set_group(cp, mask) < 0) {
+	acast_clients_remove(clients, i);
+	return -1;
+    }
+    if (timeout) {
+	cp->tmo = time_tick_now() + timeout;
+	if (acast_wheel_set(expiry, i, cp->tmo) < 0) {
+	    client_leave_group(cp);
+	    acast_clients_remove(clients, i);
+	    return -1;
 	}
     }
-    if (num_clients < MAX_CLIENTS) {
-	i = num_clients++;
-	client[i].id   = id;
-	client[i].addr = *addr;
-	client[i].addrlen = addrlen;
-	client[i].tmo = time_tick_now() + CLIENT_TIMEOUT;
-	client[i].ptr = client[i].buffer;	
-	set_client_mask(&client[i], mask);
+
+    if (verbose) {
+	fprintf(stderr, "unicast client[%d] id=%d %s:%d added\n",
+		i, id, inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+    }
+    return 0;
+}
+
+// remove unicast clients whose subscription was not refreshed in
+// time, return the number of clients removed
+size_t client_expire(tick_t now)
+{
+    size_t n = 0;
+    int i;
+
+    while((i = acast_wheel_expired(expiry, now)) >= 0) {
+	client_t* cp = &acast_clients_array(clients)[i];
+	int moved;
 
 	if (verbose) {
-	    fprintf(stderr, "unicast client[%d] id=%d %s:%d added\n",
-		    i, id, inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+	    fprintf(stderr, "unicast client[%d] id=%d %s:%d expired\n",
+		    i, cp->id, inet_ntoa(cp->addr.sin_addr),
+		    ntohs(cp->addr.sin_port));
 	}
-	return 0;
+	client_leave_group(cp);
+	if ((moved = acast_clients_remove(clients, i)) >= 0)
+	    acast_wheel_move(expiry, moved, i);
+	n++;
     }
-    return -1;
+    return n;
 }
 
 // parse client list -u <ip>:<port> -u <ip>:<port> ...
@@ -166,13 +281,57 @@ int parse_clients(char** uclient, size_t num_uclients, uint16_t default_port)
 	uaddr.sin_family = AF_INET;
 	uaddr.sin_port = htons(uport);
 	// fixme, make channels flexibel
-	if (client_add(0, &uaddr, uaddrlen, (1<<i)) < 0)
+	if (client_add(0, &uaddr, uaddrlen, (1<<i), 0) < 0)
 	    return -1;
     }
     return 0;
 }
 
 
+// read the capture device into ring blocks, a read is dropped when
+// the sending thread is behind and the ring is full
+static void* capture_thread(void* arg)
+{
+    capture_t* cap = (capture_t*) arg;
+    capture_block_t* spill;  // read when the ring is full
+    uint64_t media_time = 0;
+    uint32_t xruns = 0;
+
+    if ((spill = malloc(acast_ring_block_size(cap->ring))) == NULL) {
+	fprintf(stderr, "unable to allocate capture buffer\n");
+	exit(1);
+    }
+    while(1) {
+	capture_block_t* blk;
+	snd_pcm_sframes_t avail = 0;
+	long r;
+
+	if ((blk = acast_ring_write_ptr(cap->ring)) == NULL)
+	    blk = spill;
+	if ((r = acast_record(cap->handle, cap->bytes_per_frame,
+			      blk->data, cap->block_frames)) < 0) {
+	    if (snd_pcm_recover(cap->handle, r, 1) < 0) {
+		fprintf(stderr, "acast_read failed: %s\n", snd_strerror(r));
+		exit(1);
+	    }
+	    xruns++;
+	    continue;
+	}
+	// frames still in the capture buffer were captured after these
+	if (snd_pcm_delay(cap->handle, &avail) < 0)
+	    avail = 0;
+	blk->wallclock = time_wall_usec() -
+	    ((uint64_t)(avail + r)*1000000) / cap->sample_rate;
+	blk->media_time = media_time;
+	blk->num_frames = r;
+	blk->xruns = xruns;
+	media_time += r;
+	if (blk != spill)
+	    acast_ring_write_commit(cap->ring);
+    }
+    return NULL;
+}
+
 int main(int argc, char** argv)
 {
     char* capture_device_name = CAPTURE_DEVICE;
@@ -180,11 +339,13 @@ int main(int argc, char** argv)
     acast_params_t iparam;
     acast_params_t sparam;
     acast_params_t mparam;    
+    acast_params_t pparam;       // sizes packets for the widest group
     uint32_t seqno = 0;
     snd_pcm_uframes_t snd_frames_per_packet = 0;
     snd_pcm_uframes_t mcast_frames_per_packet = 0;        
     snd_pcm_uframes_t frames_per_packet = 0;
     size_t mcast_bytes_per_frame;
+    size_t snd_bytes_per_frame;
     size_t bytes_per_frame;
     int err;
     int sock, ctrl;
@@ -202,18 +363,62 @@ int main(int argc, char** argv)
     socklen_t iaddrlen;
     struct sockaddr_in addr;
     socklen_t addrlen;        
-    size_t bytes_to_send;    
-    size_t network_bufsize = 2*BYTES_PER_PACKET;
+    size_t network_bufsize;
+    size_t packet_size = BYTES_PER_PACKET;
+    size_t payload_size;      // packet_size less the crc trailer
+    int probe_mtu = 0;
     tick_t     last_time;
     tick_t     report_time;    
     uint64_t   sent_frames = 0;
     uint64_t   sent_bytes  = 0;    
     int pcm_mode = 0; // SND_PCM_NONBLOCK;
-    char src_buffer[BYTES_PER_PACKET];
+    uint8_t* src_buffer;     // captured packet per segment
+    client_t* client;        // the registry array
+    client_t* group;         // stream per group
+    size_t max_clients = 0;  // clients the buffers below have room for
+    size_t max_groups = 0;   // groups the buffers below have room for
+    uint8_t* burst_buffer = NULL; // group packets per segment
+    uint32_t* trailer = NULL;     // group crc trailers per segment
+    uint8_t* parity = NULL;  // group parity packets per segment
+    group_packet_t* gpkt = NULL;  // group packets of this segment
+    int fec_k = 0;           // packets per row parity, 0 = off
+    int fec_d = 0;           // rows per column parity block
+    size_t slot_size;        // mapped client packet
+    size_t num_segments = 1;
+    size_t seg = 0;
+    int* item = NULL;        // batch index per client
+    size_t ngroups;
     acast_t* src;
     size_t num_uclients = 0;
-    char* uclient[MAX_CLIENTS];
+    char* uclient[MAX_UCLIENTS];
     int client_mode = CLIENT_MODE_MIXED;
+    snd_pcm_format_t capture_format = snd_pcm_format_value(CAPTURE_FORMAT);
+    snd_pcm_format_t network_format = SND_PCM_FORMAT_UNKNOWN;
+    acast_convert_t conv;
+    int payload_crc = 0;
+    acast_batch_t* batch = NULL;
+    uint64_t send_errors = 0;
+    uint64_t expired_clients = 0;
+    uint64_t media_time = 0; // frames captured
+    size_t capture_packets = CAPTURE_PACKETS;
+    capture_t cap;           // given to the capture thread
+    pthread_t capture_tid;
+    capture_block_t* blk = NULL;  // block being packetized
+    size_t blk_pos = 0;      // frames of blk sent
+    uint32_t xruns = 0;
+    acast_sr_t sr;           // sender report
+    tick_t sr_time = 0;
+    int sr_due = 0;
+
+    if ((clients = acast_clients_new(1, ACAST_MAX_CLIENTS)) == NULL) {
+	fprintf(stderr, "unable to allocate clients\n");
+	exit(1);
+    }
+    client = acast_clients_array(clients);
+    if ((groups = acast_groups_new()) == NULL) {
+	fprintf(stderr, "unable to allocate groups\n");
+	exit(1);
+    }
 
     while(1) {
 	int option_index = 0;
@@ -229,6 +434,13 @@ int main(int argc, char** argv)
 	    {"ttl",    required_argument,   0, 't'},
 	    {"loop",   no_argument,         0, 'l'},
 	    {"device", required_argument,   0, 'd'},
+	    {"format", required_argument,   0, 'f'},
+	    {"netformat",required_argument, 0, 'F'},
+	    {"crc",    no_argument,         0, 'K'},
+	    {"gso",    required_argument,   0, 'G'},
+	    {"fec",    required_argument,   0, 'E'},
+	    {"packet", required_argument,   0, 'P'},
+	    {"capture", required_argument,  0, 'B'},
 	    {"channels",required_argument,  0, 'c'},
 	    {"ichannels",required_argument, 0, 'C'},	    
 	    {"map",     required_argument,  0, 'm'},
@@ -237,7 +449,7 @@ int main(int argc, char** argv)
 	    {0,        0,                   0, 0}
 	};
 	
-	c = getopt_long(argc, argv, "lhvDUMa:u:i:p:q:t:d:c:C:m:",
+	c = getopt_long(argc, argv, "lhvDUMKa:u:i:p:q:t:d:f:F:G:E:P:B:c:C:m:",
                         long_options, &option_index);
 	if (c == -1)
 	    break;
@@ -268,6 +480,67 @@ int main(int argc, char** argv)
 	case 'd':
 	    capture_device_name = strdup(optarg);
 	    break;
+	case 'f':
+	    capture_format = snd_pcm_format_value(optarg);
+	    if (!acast_convert_supported(capture_format)) {
+		fprintf(stderr, "unsupported format %s\n", optarg);
+		exit(1);
+	    }
+	    break;
+	case 'F':
+	    network_format = snd_pcm_format_value(optarg);
+	    if (!acast_convert_supported(network_format)) {
+		fprintf(stderr, "unsupported format %s\n", optarg);
+		exit(1);
+	    }
+	    break;
+	case 'K':
+	    payload_crc = 1;
+	    break;
+	case 'G':
+	    num_segments = atoi(optarg);
+	    if ((num_segments < 1) || (num_segments > MAX_SEGMENTS)) {
+		fprintf(stderr, "gso segments out of range 1..%d\n",
+			MAX_SEGMENTS);
+		exit(1);
+	    }
+	    break;
+	case 'E': {  // K[:D]
+	    char* ptr;
+	    fec_k = atoi(optarg);
+	    if ((ptr = strchr(optarg, ':')) != NULL)
+		fec_d = atoi(ptr+1);
+	    if ((fec_k < 1) || (fec_k > ACAST_FEC_MAX_K) ||
+		(fec_d < 0) || (fec_d > ACAST_FEC_MAX_D) ||
+		(fec_k*fec_d > ACAST_FEC_MAX_SPAN)) {
+		fprintf(stderr, "fec K 1..%d, D 0..%d and K*D <= %d\n",
+			ACAST_FEC_MAX_K, ACAST_FEC_MAX_D, ACAST_FEC_MAX_SPAN);
+		exit(1);
+	    }
+	    break;
+	}
+	case 'P':
+	    if (strcmp(optarg, "mtu") == 0) {
+		probe_mtu = 1;
+		break;
+	    }
+	    packet_size = atoi(optarg);
+	    if ((packet_size < MIN_PACKET_SIZE) ||
+		(packet_size > MAX_PACKET_SIZE)) {
+		fprintf(stderr, "packet size out of range %d..%d\n",
+			MIN_PACKET_SIZE, MAX_PACKET_SIZE);
+		exit(1);
+	    }
+	    break;
+	case 'B':
+	    capture_packets = atoi(optarg);
+	    if ((capture_packets < 1) ||
+		(capture_packets > MAX_CAPTURE_PACKETS)) {
+		fprintf(stderr, "capture packets out of range 1..%d\n",
+			MAX_CAPTURE_PACKETS);
+		exit(1);
+	    }
+	    break;
 	case 'a':
 	    multicast_addr = strdup(optarg);
 	    break;
@@ -275,9 +548,10 @@ int main(int argc, char** argv)
 	    multicast_ifaddr = strdup(optarg);
 	    break;
 	case 'u':
-	    if (num_uclients >= MAX_CLIENTS-1) {
+	    if (num_uclients >= MAX_UCLIENTS) {
 		fprintf(stderr, "too many clients max %d\n",
-			MAX_CLIENTS-1);
+			MAX_UCLIENTS);
+		exit(1);
 	    }
 	    uclient[num_uclients++] = strdup(optarg);
 	    break;
@@ -310,9 +584,32 @@ int main(int argc, char** argv)
 	}
     }
 
-    parse_clients(uclient, num_uclients, multicast_port);
+    // unicast clients are not sent to in multicast mode
+    if (client_mode != CLIENT_MODE_MULTICAST)
+	parse_clients(uclient, num_uclients, multicast_port);
+    client = acast_clients_array(clients);
+
+    if (probe_mtu) {
+	size_t size = acast_probe_packet_size(multicast_addr,
+					      multicast_ifaddr,
+					      multicast_port);
+	if (size < MIN_PACKET_SIZE)
+	    fprintf(stderr, "path mtu unknown, packet size %zu\n",
+		    packet_size);
+	else
+	    packet_size = size;
+    }
+    if (verbose)
+	fprintf(stderr, "packet size %zu\n", packet_size);
+    payload_size = packet_size - (payload_crc ? PAYLOAD_CRC_SIZE : 0);
+    network_bufsize = 2*BUFFER_CLIENTS*packet_size*num_segments;
 
     time_tick_init();    
+    if ((expiry = acast_wheel_new(CLIENT_EXPIRY_SLOTS, CLIENT_EXPIRY_TICK,
+				  time_tick_now())) == NULL) {
+	fprintf(stderr, "unable to allocate client timers\n");
+	exit(1);
+    }
 
     if ((err = snd_pcm_open(&handle, capture_device_name,
 			    SND_PCM_STREAM_CAPTURE, pcm_mode)) < 0) {
@@ -322,11 +619,14 @@ int main(int argc, char** argv)
     
     acast_clear_param(&iparam);
     // setup wanted paramters
-    iparam.format = SND_PCM_FORMAT_S16_LE;
+    iparam.format = capture_format;
     iparam.sample_rate = 48000;
     iparam.channels_per_frame = num_input_channels;
-    acast_setup_param(handle, &iparam, &sparam, &snd_frames_per_packet);
-    bytes_per_frame = sparam.bytes_per_channel * sparam.channels_per_frame;
+    // the device period is sized for a capture read
+    acast_setup_param(handle, &iparam, &sparam, capture_packets*packet_size,
+		      &snd_frames_per_packet);
+    snd_frames_per_packet = acast_get_frames_per_packet(&sparam, payload_size);
+    snd_bytes_per_frame = sparam.bytes_per_channel*sparam.channels_per_frame;
 
     if (parse_channel_ctx(map,&client[0].chan_ctx,sparam.channels_per_frame,
 			  &client[0].num_output_channels) < 0) {
@@ -338,12 +638,46 @@ int main(int argc, char** argv)
 	print_channel_ctx(stdout, &client[0].chan_ctx);
 	printf("num_output_channels = %d\n", client[0].num_output_channels);
     }
+    if ((client_mode != CLIENT_MODE_UNICAST) &&
+	(acast_groups_join(groups, &client[0]) < 0)) {
+	fprintf(stderr, "unable to allocate groups\n");
+	exit(1);
+    }
 
     mparam = sparam;
     mparam.channels_per_frame = client[0].num_output_channels;
+    if (network_format != SND_PCM_FORMAT_UNKNOWN) {
+	mparam.format = network_format;
+	mparam.bits_per_channel = snd_pcm_format_width(network_format);
+	mparam.bytes_per_channel =
+	    snd_pcm_format_physical_width(network_format) / 8;
+    }
+    // convert from capture format while mapping channels
+    if (acast_convert_setup(&conv, sparam.format, mparam.format) < 0) {
+	fprintf(stderr, "can not convert from %s to %s\n",
+		snd_pcm_format_name(sparam.format),
+		snd_pcm_format_name(mparam.format));
+	exit(1);
+    }
     mcast_bytes_per_frame =
 	mparam.bytes_per_channel*mparam.channels_per_frame;    
-    mcast_frames_per_packet = acast_get_frames_per_packet(&mparam);
+    // every group sends the same frames per packet, so size packets
+    // for the widest group, unicast clients may ask for up to
+    // MAX_CHANNEL_MAP channels. parity packets must fit as well
+    pparam = mparam;
+    if (client_mode != CLIENT_MODE_MULTICAST)
+	pparam.channels_per_frame = max(MAX_CHANNEL_MAP,
+					mparam.channels_per_frame);
+    if (fec_k)
+	mcast_frames_per_packet = acast_fec_frames_per_packet(&pparam,
+							      payload_size);
+    else
+	mcast_frames_per_packet = acast_get_frames_per_packet(&pparam,
+							      payload_size);
+    // unicast clients may ask for up to MAX_CHANNEL_MAP channels
+    slot_size = sizeof(acast_t) + mcast_frames_per_packet*
+	max(MAX_CHANNEL_MAP, mparam.channels_per_frame)*
+	mparam.bytes_per_channel;
 
     if (verbose) {
 	fprintf(stderr, "mcast params:\n");
@@ -355,25 +689,51 @@ int main(int argc, char** argv)
 	fprintf(stderr, "----------------\n");
     }
     
-    // fill in "constant" values in the acast header
-    src = (acast_t*) src_buffer;
-    src->seqno       = seqno;
-    src->num_frames  = 0;
-    src->param       = sparam;
-
-    acast_print(stderr, src);
-
     if ((sock = acast_sender_open(multicast_addr,
 				  multicast_ifaddr,
 				  multicast_port,
 				  multicast_ttl,
 				  multicast_loop,
 				  &maddr, &maddrlen,
-				  network_bufsize)) < 0) {
+				  network_bufsize, &num_segments)) < 0) {
 	fprintf(stderr, "unable to open multicast socket %s\n",
 		strerror(errno));
 	exit(1);
     }
+    if (verbose && (num_segments > 1))
+	fprintf(stderr, "sending %zu packets per client with UDP_SEGMENT\n",
+		num_segments);
+
+    // client packet buffers are allocated in the main loop
+    src_buffer = malloc(num_segments*packet_size);
+    if (!src_buffer) {
+	fprintf(stderr, "unable to allocate packet buffers\n");
+	exit(1);
+    }
+    // groups get their encoder when first sent to
+    if (fec_k) {
+	acast_fec_enc_t* enc;
+	if ((enc = acast_fec_enc_new(fec_k, fec_d, packet_size)) == NULL) {
+	    fprintf(stderr, "unable to allocate fec buffers\n");
+	    exit(1);
+	}
+	if (verbose)
+	    fprintf(stderr, "fec %d:%d overhead %.1f%%\n", fec_k, fec_d,
+		    100.0*acast_fec_enc_overhead(enc));
+	acast_fec_enc_free(enc);
+    }
+
+    // fill in "constant" values in the acast header
+    for (seg = 0; seg < num_segments; seg++) {
+	src = (acast_t*) (src_buffer + seg*packet_size);
+	src->seqno       = seqno;
+	src->num_frames  = 0;
+	src->param       = sparam;
+    }
+    seg = 0;
+    src = (acast_t*) src_buffer;
+
+    acast_print(stderr, src);
     client[0].addr = maddr;
     client[0].addrlen = maddrlen;
     client[0].tmo = 0;
@@ -415,13 +775,39 @@ int main(int argc, char** argv)
     frames_per_packet = min(mcast_frames_per_packet,snd_frames_per_packet);
     bytes_per_frame = client[0].num_output_channels * mparam.bytes_per_channel;
 
+    // capture runs in its own thread, reading capture_packets packets
+    // at a time, the loop below packetizes and sends from the ring
+    cap.handle = handle;
+    cap.bytes_per_frame = snd_bytes_per_frame;
+    cap.block_frames = capture_packets*frames_per_packet;
+    cap.sample_rate = sparam.sample_rate;
+    if ((cap.ring = acast_ring_new(RING_BLOCKS, sizeof(capture_block_t) +
+				   cap.block_frames*snd_bytes_per_frame))
+	== NULL) {
+	fprintf(stderr, "unable to allocate capture ring\n");
+	exit(1);
+    }
+    if ((err = pthread_create(&capture_tid, NULL, capture_thread, &cap))
+	!= 0) {
+	fprintf(stderr, "unable to start capture thread %s\n",
+		strerror(err));
+	exit(1);
+    }
+
     last_time = time_tick_now();
     report_time = last_time;
     
     while(1) {
+	uint8_t* packet;
+	uint64_t wallclock;
+	int cstart=0, cnum=0;
+	int i=0;
+	size_t g;
 	int r;
 
-	if (ctrl >= 0) {  // client_mode != CLIENT_MODE_MULTICAST
+	// clients change between bursts only, their packets are kept
+	// at a fixed index until the burst is sent
+	if ((ctrl >= 0) && (seg == 0)) {  // != CLIENT_MODE_MULTICAST
 	    struct pollfd fds;
 	    fds.fd = ctrl;
 	    fds.events = POLLIN;
@@ -432,6 +818,7 @@ int main(int argc, char** argv)
 		uint8_t  ctl_buffer[BYTES_PER_PACKET];
 
 		ctl = (actl_t*) ctl_buffer;
+		addrlen = sizeof(addr);
 		r = recvfrom(ctrl, (void*) ctl, sizeof(ctl_buffer), 0,
 			     (struct sockaddr *) &addr, &addrlen);
 		if (verbose) {
@@ -442,109 +829,241 @@ int main(int argc, char** argv)
 
 		crc = ctl->crc;
 		ctl->crc = 0;
-		if ((ctl->magic != CONTROL_MAGIC) &&
+		if ((ctl->magic == CONTROL_MAGIC) &&
 		    crc32((uint8_t*) ctl, sizeof(actl_t)) == crc) {
-		    client_add(ctl->id, &addr, addrlen, ctl->mask);
+		    client_add(ctl->id, &addr, addrlen, ctl->mask,
+			       CLIENT_TIMEOUT);
 		}
 	    }
 	}
-	
-	if ((r = acast_record(handle, bytes_per_frame,
-			      src->data, frames_per_packet)) < 0) {
-	    fprintf(stderr, "acast_read failed: %s\n", snd_strerror(r));
-	    exit(1);
+	if (seg == 0)
+	    expired_clients += client_expire(time_tick_now());
+	client = acast_clients_array(clients);
+	group = acast_groups_array(groups);
+	ngroups = acast_groups_count(groups);
+
+	// room for a burst of num_segments packets and their parity per
+	// group, the batch has them and a sender report per client
+	if ((max_clients != acast_clients_capacity(clients)) ||
+	    (max_groups != acast_groups_capacity(groups))) {
+	    size_t n, m;
+
+	    max_clients = acast_clients_capacity(clients);
+	    max_groups = acast_groups_capacity(groups);
+	    free(burst_buffer);
+	    free(trailer);
+	    free(parity);
+	    free(gpkt);
+	    free(item);
+	    if (batch != NULL)
+		acast_batch_free(batch);
+	    n = num_segments*max_groups;
+	    m = num_segments*max_clients;
+	    burst_buffer = malloc(n*slot_size);
+	    trailer = malloc(n*sizeof(uint32_t));
+	    parity = fec_k ? malloc(n*2*packet_size) : NULL;
+	    gpkt = malloc(max_groups*sizeof(group_packet_t));
+	    item = malloc(max_clients*sizeof(int));
+	    batch = acast_batch_new((fec_k ? 3 : 1)*m + max_clients,
+				    num_segments);
+	    if (!burst_buffer || !trailer || (fec_k && !parity) ||
+		!gpkt || !item || !batch) {
+		fprintf(stderr, "unable to allocate client buffers\n");
+		exit(1);
+	    }
+	    // the socket must hold the whole batch, twice over
+	    network_bufsize = 2*((fec_k ? 3 : 1)*m + max_clients)*packet_size;
+	    if ((acast_set_sndbuf(sock, network_bufsize) <
+		 (int) network_bufsize) && verbose)
+		fprintf(stderr, "send buffer below %zu bytes for %zu clients, "
+			"raise net.core.wmem_max\n",
+			network_bufsize, max_clients);
 	}
-	else if (r == 0) {
-	    fprintf(stderr, "acast_read read zero bytes\n");
+
+	// next packet of frames from the capture thread
+	while((blk == NULL) &&
+	      ((blk = acast_ring_read_ptr(cap.ring)) == NULL))
+	    acast_ring_wait(cap.ring);
+	src = (acast_t*) (src_buffer + seg*packet_size);
+	r = min(frames_per_packet, blk->num_frames - blk_pos);
+	memcpy(src->data, blk->data + blk_pos*snd_bytes_per_frame,
+	       r*snd_bytes_per_frame);
+	// frames dropped on a full ring are lost packets to receivers
+	if (blk->media_time + blk_pos > media_time)
+	    seqno += (blk->media_time + blk_pos - media_time +
+		      frames_per_packet - 1) / frames_per_packet;
+	media_time = blk->media_time + blk_pos;
+	wallclock = blk->wallclock +
+	    ((uint64_t)blk_pos*1000000) / sparam.sample_rate;
+	xruns = blk->xruns;
+	if ((blk_pos += r) == blk->num_frames) {
+	    acast_ring_read_release(cap.ring);
+	    blk = NULL;
+	    blk_pos = 0;
 	}
-	else {
-	    char dst_buffer[BYTES_PER_PACKET];
-	    acast_t* dst;
-	    int cstart=0, cnum=0;
-	    int i=0;
-	    
-	    if (r < frames_per_packet)
-		fprintf(stderr, "acast_read read short bytes\n");
+	packet = burst_buffer + seg*max_groups*slot_size;
 
-	    switch(client_mode) {
-	    case CLIENT_MODE_UNICAST:
-		cstart = 1; cnum = num_clients;
-		break;
-	    case CLIENT_MODE_MULTICAST:
-		cstart = 0; cnum = 1;
-		break;
-	    case CLIENT_MODE_MIXED:
-		cstart = 0; cnum = num_clients;
-		break;
-	    default:
-		break;
-	    }
-	    for (i=cstart; i<cnum; i++) {
-		switch(client[i].chan_ctx.type) {
-		case ACAST_MAP_PERMUTE:
-		    dst = (acast_t*) dst_buffer;
-		    dst->param = mparam;
-		    permute_ii(mparam.format,
-			       src->data, sparam.channels_per_frame,
-			       dst->data, client[i].num_output_channels,
-			       client[i].chan_ctx.channel_map,
-			       frames_per_packet);
-		    break;
-		case ACAST_MAP_OP:
-		    dst = (acast_t*) dst_buffer;
-		    dst->param = mparam;
-		    scatter_gather_ii(mparam.format,
-				      src->data, sparam.channels_per_frame,
-				      dst->data, client[i].num_output_channels,
-				      client[i].chan_ctx.channel_op,
-				      client[i].chan_ctx.num_channel_ops,
-				      frames_per_packet);
-		    break;
-		case ACAST_MAP_ID:
-		    dst = src;
-		    dst->param = mparam;
-		    break;
-		default:
-		    dst = src;
-		    // error
-		    break;
-		}
-		dst->magic = ACAST_MAGIC;
-		dst->seqno = seqno++;
+	// report when the first frame of this packet was captured
+	sr_due = 0;
+	if ((time_tick_now() - sr_time) >= ACAST_SR_INTERVAL) {
+	    sr.magic = ACAST_MAGIC_SR;
+	    sr.seqno = seqno;
+	    sr.timestamp = media_time;
+	    sr.wallclock = wallclock;
+	    sr.sample_rate = mparam.sample_rate;
+	    sr.crc = 0;
+	    sr.crc = crc32((uint8_t*) &sr, sizeof(acast_sr_t));
+	    sr_time = time_tick_now();
+	    sr_due = 1;
+	}
+	media_time += r;
+
+	switch(client_mode) {
+	case CLIENT_MODE_UNICAST:
+	    cstart = 1; cnum = acast_clients_count(clients);
+	    break;
+	case CLIENT_MODE_MULTICAST:
+	    cstart = 0; cnum = 1;
+	    break;
+	case CLIENT_MODE_MIXED:
+	    cstart = 0; cnum = acast_clients_count(clients);
+	    break;
+	default:
+	    break;
+	}
+	// map captured frames once per group with members in one
+	// pass, the ACAST_MAP_ID group sends the captured data unless
+	// it is converted
+	for (g = 0; g < ngroups; g++) {
+	    gpkt[g].hdr = NULL;
+	    if (acast_groups_members(groups, g) == 0)
+		group[g].ptr = NULL;
+	    else if ((group[g].chan_ctx.type == ACAST_MAP_ID) &&
+		     (conv.convert == NULL))
+		group[g].ptr = NULL;
+	    else
+		group[g].ptr = ((acast_t*)(packet + g*slot_size))->data;
+	}
+	fanout_ii(mparam.format, &conv,
+		  src->data, sparam.channels_per_frame,
+		  group, ngroups, frames_per_packet);
+
+	if (seg == 0) {
+	    acast_batch_reset(batch);
+	    for (i=0; i<max_clients; i++)
+		item[i] = -1;
+	}
+	// header, crc and parity are made for the first member of a
+	// group, all members are sent the same packets from where
+	// they were built without copying
+	for (i=cstart; i<cnum; i++) {
+	    group_packet_t* gp = &gpkt[client[i].group];
+	    int j;
+
+	    if (gp->hdr == NULL) {
+		client_t* sp = &group[client[i].group];
+		acast_t* dst;
+
+		g = client[i].group;
+		dst = (acast_t*) (packet + g*slot_size);
+		dst->param = mparam;
+		dst->seqno = seqno;
 		dst->num_frames = r;
-		dst->param.channels_per_frame = client[i].num_output_channels;
+		dst->param.channels_per_frame = sp->num_output_channels;
+		gp->hdr = dst;
+		gp->data = (sp->ptr != NULL) ? sp->ptr : src->data;
+		bytes_per_frame = sp->num_output_channels *
+		    mparam.bytes_per_channel;
+		gp->len = bytes_per_frame*dst->num_frames;
+		gp->trailer = &trailer[seg*max_groups+g];
+		gp->trailer_len = acast_set_payload_crc(dst, gp->data,
+							gp->len,
+							payload_crc,
+							gp->trailer);
 		dst->crc = 0;
 		dst->crc = crc32((uint8_t*) dst, sizeof(acast_t));
 
-		bytes_per_frame = client[i].num_output_channels *
-		    mparam.bytes_per_channel;		
-		bytes_to_send = bytes_per_frame*dst->num_frames;
-
-		if (sendto(sock, (void*)dst, sizeof(acast_t)+bytes_to_send, 0,
-			   (struct sockaddr *) &client[i].addr,
-			   client[i].addrlen) < 0) {
-		    fprintf(stderr, "failed to send frame %s\n",
-			    strerror(errno));
+		if (fec_k && (sp->fec == NULL))
+		    sp->fec = acast_fec_enc_new(fec_k, fec_d, packet_size);
+		gp->np = 0;
+		if (sp->fec != NULL) {
+		    gp->out[0] = parity + (seg*max_groups+g)*2*packet_size;
+		    gp->out[1] = gp->out[0] + packet_size;
+		    gp->np = acast_fec_encode(sp->fec, dst, gp->data,
+					      gp->len, gp->trailer,
+					      gp->trailer_len,
+					      gp->out, gp->out_len);
 		}
-		sent_frames += dst->num_frames;
-		sent_bytes  += bytes_to_send;
 	    }
-	    if (sent_frames >= 100000) {
-		if (verbose > 1) {
-		    tick_t now = time_tick_now();
-		    fprintf(stderr, "SEND RATE = %.2fKHz, %.2fMb/s\n",
-			    (1000*sent_frames)/
-			    ((double)(now - report_time)),
-			    ((1000000*sent_bytes)/
-			     (double)(now - report_time)) /
-			    (double)(1024*1024));
-		    report_time = now;
-		}
-		if (verbose > 3)
-		    acast_print(stderr, src);
-		sent_frames = 0;
-		sent_bytes = 0;
+	    // the report goes ahead of the packet it refers to
+	    if (sr_due)
+		acast_batch_add(batch, &client[i].addr, client[i].addrlen,
+				&sr, sizeof(acast_sr_t), NULL, 0, NULL, 0);
+	    item[i] = acast_batch_add(batch,
+				      &client[i].addr, client[i].addrlen,
+				      gp->hdr, sizeof(acast_t),
+				      gp->data, gp->len,
+				      gp->trailer, gp->trailer_len);
+	    // parity follows the packets it protects
+	    for (j = 0; j < gp->np; j++)
+		acast_batch_add(batch, &client[i].addr, client[i].addrlen,
+				gp->out[j], gp->out_len[j],
+				NULL, 0, NULL, 0);
+	    sent_frames += r;
+	    sent_bytes  += gp->len;
+	}
+	// all clients get the same seqno for the same frames
+	seqno++;
+
+	// send when all segments of the burst are mapped
+	if (++seg < num_segments)
+	    continue;
+	seg = 0;
+	if (acast_batch_send(batch, sock) > 0) {
+	    for (i=cstart; i<cnum; i++) {
+		int err = acast_batch_error(batch, item[i]);
+		if (err == 0)
+		    continue;
+		send_errors++;
+		fprintf(stderr, "failed to send frame to %s:%d %s\n",
+			inet_ntoa(client[i].addr.sin_addr),
+			ntohs(client[i].addr.sin_port),
+			strerror(err));
+	    }
+	}
+	if ((num_segments > 1) && (acast_batch_segments(batch) == 1)) {
+	    fprintf(stderr, "UDP_SEGMENT refused, sending single packets\n");
+	    num_segments = 1;
+	}
+	if (sent_frames >= 100000) {
+	    if (verbose > 1) {
+		tick_t now = time_tick_now();
+		fprintf(stderr, "SEND RATE = %.2fKHz, %.2fMb/s, %lu errors\n",
+			(1000*sent_frames)/
+			((double)(now - report_time)),
+			((1000000*sent_bytes)/
+			 (double)(now - report_time)) /
+			(double)(1024*1024),
+			(unsigned long) send_errors);
+		fprintf(stderr, "CLIENTS = %zu, %zu groups, %zu timers, "
+			"%lu expired\n",
+			acast_clients_count(clients),
+			acast_groups_used(groups),
+			acast_wheel_count(expiry),
+			(unsigned long) expired_clients);
+		fprintf(stderr, "RING = %zu/%zu blocks, %zu peak, "
+			"%lu overruns, %u xruns\n",
+			acast_ring_count(cap.ring),
+			acast_ring_capacity(cap.ring),
+			acast_ring_peak(cap.ring),
+			(unsigned long) acast_ring_overruns(cap.ring),
+			xruns);
+		report_time = now;
 	    }
+	    if (verbose > 3)
+		acast_print(stderr, src);
+	    sent_frames = 0;
+	    sent_bytes = 0;
 	}
     }
     exit(0);
@@ -0,0 +1,1238 @@
+//
+//  SIMD kernels for channel mapping
+//
+//  Each kernel process as many frames as it safely can and return the
+//  number of frames done, the caller finish the tail with scalar code.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acast_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ACAST_X86
+#include <immintrin.h>
+#endif
+
+#define SHUFFLE_MAX_IN   4    // max 16 byte source chunks per block
+#define SHUFFLE_MAX_OUT  2    // max 16 byte destination chunks per block
+
+static int simd_level = -1;
+
+int acast_simd_level(void)
+{
+    if (simd_level < 0) {
+	char* env;
+	simd_level = ACAST_SIMD_NONE;
+#ifdef ACAST_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	    simd_level = ACAST_SIMD_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+	    simd_level = ACAST_SIMD_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+	    simd_level = ACAST_SIMD_AVX2;
+#endif
+	// allow user to limit simd level, ACAST_SIMD=0 disable
+	if ((env = getenv("ACAST_SIMD")) != NULL) {
+	    int level = atoi(env);
+	    if (level < simd_level)
+		simd_level = level;
+	}
+    }
+    return simd_level;
+}
+
+void acast_simd_set_level(int level)
+{
+    simd_level = -1;
+    if (level >= 0) {
+	if (level > acast_simd_level())
+	    level = acast_simd_level();
+	simd_level = level;
+    }
+}
+
+#ifdef ACAST_X86
+
+// Shuffle plan, k frames are moved per block, the source block is
+// loaded as nin 16 byte chunks and the destination block is built
+// from nout 16 byte chunks. mask[o][c] select bytes from source chunk c
+// to destination chunk o (0x80 = zero)
+typedef struct
+{
+    size_t k;
+    size_t nin;
+    size_t nout;
+    size_t sbytes;    // source bytes per block
+    size_t dbytes;    // destination bytes per block
+    uint8_t used[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    uint8_t mask[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN][16];
+} shuffle_plan_t;
+
+// build shuffle masks from map, map[i] < 0 gives a zero channel
+// return 0 if map does not fit
+static int shuffle_plan_map(shuffle_plan_t* plan, size_t width,
+			    size_t nsrc, size_t ndst, int* map)
+{
+    size_t sframe = nsrc*width;
+    size_t dframe = ndst*width;
+    size_t k, p, f, i;
+
+    if ((sframe == 0) || (dframe == 0))
+	return 0;
+    if ((sframe > 16*SHUFFLE_MAX_IN) || (dframe > 16*SHUFFLE_MAX_OUT))
+	return 0;
+    for (i = 0; i < ndst; i++)
+	if (map[i] >= (int) nsrc)
+	    return 0;
+
+    k = (16*SHUFFLE_MAX_IN) / sframe;
+    if ((16*SHUFFLE_MAX_OUT) / dframe < k)
+	k = (16*SHUFFLE_MAX_OUT) / dframe;
+
+    plan->k = k;
+    plan->sbytes = k*sframe;
+    plan->dbytes = k*dframe;
+    plan->nin  = (plan->sbytes + 15) / 16;
+    plan->nout = (plan->dbytes + 15) / 16;
+    memset(plan->used, 0, sizeof(plan->used));
+    memset(plan->mask, 0x80, sizeof(plan->mask));
+
+    p = 0;
+    for (f = 0; f < k; f++) {
+	for (i = 0; i < ndst; i++) {
+	    size_t sp = f*sframe + map[i]*width;
+	    size_t b;
+	    if (map[i] < 0) {
+		p += width;
+		continue;
+	    }
+	    for (b = 0; b < width; b++, p++, sp++) {
+		plan->mask[p >> 4][sp >> 4][p & 15] = sp & 15;
+		plan->used[p >> 4][sp >> 4] = 1;
+	    }
+	}
+    }
+    return 1;
+}
+
+static int shuffle_plan(shuffle_plan_t* plan, size_t width,
+			size_t nsrc, size_t ndst, uint8_t* channel_map)
+{
+    int map[16*SHUFFLE_MAX_OUT];
+    size_t i;
+
+    if (ndst > 16*SHUFFLE_MAX_OUT)
+	return 0;
+    for (i = 0; i < ndst; i++)
+	map[i] = channel_map[i];
+    return shuffle_plan_map(plan, width, nsrc, ndst, map);
+}
+
+// Kernels are written for a fixed block shape (nin,nout), they are
+// always inlined into a switch on the shape so that the chunk loops
+// unroll and the masks stay in registers. Unused masks are all 0x80 and
+// shuffle in zeros, so no need to test for them.
+#define SIMD_INLINE static inline __attribute__((always_inline))
+
+#define SHUFFLE_SHAPE(nin, nout) ((nin)*4 + (nout))
+#define SHUFFLE_SHAPES(CASE) \
+    CASE(1,1) CASE(2,1) CASE(3,1) CASE(4,1) \
+    CASE(1,2) CASE(2,2) CASE(3,2) CASE(4,2)
+
+// build destination chunk from the source chunks
+__attribute__((target("ssse3")))
+SIMD_INLINE __m128i shuffle_out_128(__m128i* mask, __m128i* in,
+				    const size_t nin)
+{
+    __m128i r = _mm_shuffle_epi8(in[0], mask[0]);
+    size_t c;
+    for (c = 1; c < nin; c++)
+	r = _mm_or_si128(r, _mm_shuffle_epi8(in[c], mask[c]));
+    return r;
+}
+
+__attribute__((target("avx2")))
+SIMD_INLINE __m256i shuffle_out_256(__m256i* mask, __m256i* in,
+				    const size_t nin)
+{
+    __m256i r = _mm256_shuffle_epi8(in[0], mask[0]);
+    size_t c;
+    for (c = 1; c < nin; c++)
+	r = _mm256_or_si256(r, _mm256_shuffle_epi8(in[c], mask[c]));
+    return r;
+}
+
+__attribute__((target("ssse3")))
+SIMD_INLINE size_t permute_ii_ssse3_k(shuffle_plan_t* plan,
+				      uint8_t* src, uint8_t* dst,
+				      size_t frames,
+				      const size_t nin, const size_t nout)
+{
+    __m128i mask[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    size_t sframe = plan->sbytes / plan->k;
+    size_t dframe = plan->dbytes / plan->k;
+    size_t sload  = nin*16;
+    size_t dstore = nout*16;
+    size_t n = 0;
+    size_t o, c;
+
+    for (o = 0; o < nout; o++)
+	for (c = 0; c < nin; c++)
+	    mask[o][c] = _mm_loadu_si128((__m128i*) plan->mask[o][c]);
+
+    // keep all loads and stores inside the buffers
+    while ((frames - n >= plan->k) &&
+	   ((frames - n)*sframe >= sload) &&
+	   ((frames - n)*dframe >= dstore)) {
+	__m128i in[SHUFFLE_MAX_IN];
+
+	for (c = 0; c < nin; c++)
+	    in[c] = _mm_loadu_si128((__m128i*)(src + 16*c));
+	for (o = 0; o < nout; o++)
+	    _mm_storeu_si128((__m128i*)(dst + 16*o),
+			     shuffle_out_128(mask[o], in, nin));
+	src += plan->sbytes;
+	dst += plan->dbytes;
+	n += plan->k;
+    }
+    return n;
+}
+
+// two blocks per iteration, one in each 128 bit lane
+__attribute__((target("avx2")))
+SIMD_INLINE size_t permute_ii_avx2_k(shuffle_plan_t* plan,
+				     uint8_t* src, uint8_t* dst,
+				     size_t frames,
+				     const size_t nin, const size_t nout)
+{
+    __m256i mask[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    size_t sframe = plan->sbytes / plan->k;
+    size_t dframe = plan->dbytes / plan->k;
+    size_t sload  = plan->sbytes + nin*16;
+    size_t dstore = plan->dbytes + nout*16;
+    size_t n = 0;
+    size_t o, c;
+
+    for (o = 0; o < nout; o++)
+	for (c = 0; c < nin; c++)
+	    mask[o][c] = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i*) plan->mask[o][c]));
+
+    while ((frames - n >= 2*plan->k) &&
+	   ((frames - n)*sframe >= sload) &&
+	   ((frames - n)*dframe >= dstore)) {
+	__m256i in[SHUFFLE_MAX_IN];
+	__m256i r[SHUFFLE_MAX_OUT];
+
+	for (c = 0; c < nin; c++) {
+	    __m128i lo = _mm_loadu_si128((__m128i*)(src + 16*c));
+	    __m128i hi = _mm_loadu_si128((__m128i*)(src+plan->sbytes+16*c));
+	    in[c] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+	}
+	for (o = 0; o < nout; o++)
+	    r[o] = shuffle_out_256(mask[o], in, nin);
+	// store first block before second block, since the first
+	// block may spill zeros into the second
+	for (o = 0; o < nout; o++)
+	    _mm_storeu_si128((__m128i*)(dst + 16*o),
+			     _mm256_castsi256_si128(r[o]));
+	for (o = 0; o < nout; o++)
+	    _mm_storeu_si128((__m128i*)(dst + plan->dbytes + 16*o),
+			     _mm256_extracti128_si256(r[o], 1));
+	src += 2*plan->sbytes;
+	dst += 2*plan->dbytes;
+	n += 2*plan->k;
+    }
+    return n;
+}
+
+__attribute__((target("ssse3")))
+static size_t permute_ii_ssse3(shuffle_plan_t* plan,
+			       uint8_t* src, uint8_t* dst, size_t frames)
+{
+#define PERMUTE_SSSE3(i,o) case SHUFFLE_SHAPE(i,o): \
+    return permute_ii_ssse3_k(plan, src, dst, frames, i, o);
+    switch(SHUFFLE_SHAPE(plan->nin, plan->nout)) {
+	SHUFFLE_SHAPES(PERMUTE_SSSE3)
+    default: return 0;
+    }
+#undef PERMUTE_SSSE3
+}
+
+__attribute__((target("avx2")))
+static size_t permute_ii_avx2(shuffle_plan_t* plan,
+			      uint8_t* src, uint8_t* dst, size_t frames)
+{
+#define PERMUTE_AVX2(i,o) case SHUFFLE_SHAPE(i,o): \
+    return permute_ii_avx2_k(plan, src, dst, frames, i, o);
+    switch(SHUFFLE_SHAPE(plan->nin, plan->nout)) {
+	SHUFFLE_SHAPES(PERMUTE_AVX2)
+    default: return 0;
+    }
+#undef PERMUTE_AVX2
+}
+
+// Channel op plan, every destination channel is computed as
+//   d = subs(adds(a, badd|cadd), bsub|csub)
+// a is the src1 operand, badd/bsub the src2 operand of ADD/SUB and
+// cadd/csub the constants of CONST/ADDC/SUBC, unused terms are zero.
+// This gives the same result as sum_TYPE/diff_TYPE in map.i
+// For float samples an unused add term is -0.0, since a + 0.0 would
+// turn -0.0 into +0.0, while a - 0.0 keeps all values.
+typedef struct
+{
+    shuffle_plan_t a;
+    shuffle_plan_t badd;
+    shuffle_plan_t bsub;
+    uint8_t cadd[SHUFFLE_MAX_OUT*16];
+    uint8_t csub[SHUFFLE_MAX_OUT*16];
+} op_plan_t;
+
+static void op_plan_const(uint8_t* cvec, shuffle_plan_t* plan,
+			  int type, size_t ndst, int64_t* cval, uint8_t* neg0)
+{
+    size_t width = ACAST_SAMPLE_WIDTH(type);
+    size_t f, i;
+
+    memset(cvec, 0, SHUFFLE_MAX_OUT*16);
+    for (f = 0; f < plan->k; f++) {
+	for (i = 0; i < ndst; i++) {
+	    uint8_t* ptr = cvec + (f*ndst + i)*width;
+	    switch(type) {
+	    case ACAST_SAMPLE_S16: {
+		int16_t v = cval[i];
+		memcpy(ptr, &v, 2);
+		break;
+	    }
+	    case ACAST_SAMPLE_S32: {
+		int32_t v = cval[i];
+		memcpy(ptr, &v, 4);
+		break;
+	    }
+	    case ACAST_SAMPLE_F32: {
+		float v = (neg0 && neg0[i]) ? -0.0f :
+		    (float) cval[i] * (float) MAP_FLOAT_CONST_SCALE;
+		memcpy(ptr, &v, 4);
+		break;
+	    }
+	    case ACAST_SAMPLE_F64: {
+		double v = (neg0 && neg0[i]) ? -0.0 :
+		    (double) cval[i] * MAP_FLOAT_CONST_SCALE;
+		memcpy(ptr, &v, 8);
+		break;
+	    }
+	    }
+	}
+    }
+}
+
+// build op plan from channel program, return 0 if not possible
+static int op_plan(op_plan_t* op, int type, size_t nsrc, size_t ndst,
+		   acast_channel_prog_t* prog)
+{
+    size_t width = ACAST_SAMPLE_WIDTH(type);
+    int a[16*SHUFFLE_MAX_OUT];
+    int badd[16*SHUFFLE_MAX_OUT];
+    int bsub[16*SHUFFLE_MAX_OUT];
+    int64_t cadd[16*SHUFFLE_MAX_OUT];
+    int64_t csub[16*SHUFFLE_MAX_OUT];
+    uint8_t seen[16*SHUFFLE_MAX_OUT];
+    uint8_t neg0[16*SHUFFLE_MAX_OUT];
+    int i, k;
+
+    if (ndst > 16*SHUFFLE_MAX_OUT)
+	return 0;
+    for (i = 0; i < ndst; i++) {
+	a[i] = badd[i] = bsub[i] = -1;
+	cadd[i] = csub[i] = 0;
+	seen[i] = neg0[i] = 0;
+    }
+    for (i = 0; i < prog->num_ops; i++) {
+	acast_prog_op_t* p = &prog->op[i];
+	for (k = 0; k < p->len; k++) {
+	    int d = p->dst + k;
+	    if ((d < 0) || (d >= ndst) || seen[d])
+		return 0;
+	    seen[d] = 1;
+	    if ((p->src1 + k < 0) ||
+		(((p->op == ACAST_OP_ADD) || (p->op == ACAST_OP_SUB)) &&
+		 (p->src2 < 0)))
+		return 0;
+	    switch(p->op) {
+	    case ACAST_OP_SRC:  a[d] = p->src1 + k; break;
+	    case ACAST_OP_CONST: cadd[d] = p->src1; break;
+	    case ACAST_OP_ADD:  a[d] = p->src1; badd[d] = p->src2; break;
+	    case ACAST_OP_ADDC: a[d] = p->src1; cadd[d] = p->src2; break;
+	    case ACAST_OP_SUB:  a[d] = p->src1; bsub[d] = p->src2; break;
+	    case ACAST_OP_SUBC: a[d] = p->src1; csub[d] = p->src2; break;
+	    default: break;
+	    }
+	    // no add term
+	    neg0[d] = (p->op == ACAST_OP_SRC) || (p->op == ACAST_OP_SUB) ||
+		(p->op == ACAST_OP_SUBC);
+	}
+    }
+    for (i = 0; i < ndst; i++)
+	if (!seen[i])  // untouched channels are kept by the scalar code
+	    return 0;
+    if (!shuffle_plan_map(&op->a, width, nsrc, ndst, a) ||
+	!shuffle_plan_map(&op->badd, width, nsrc, ndst, badd) ||
+	!shuffle_plan_map(&op->bsub, width, nsrc, ndst, bsub))
+	return 0;
+    op_plan_const(op->cadd, &op->a, type, ndst, cadd, neg0);
+    op_plan_const(op->csub, &op->a, type, ndst, csub, NULL);
+    return 1;
+}
+
+// saturating int32 add/sub, saturate where the sign of the result is wrong
+__attribute__((target("sse2")))
+static inline __m128i adds_epi32_128(__m128i a, __m128i b)
+{
+    __m128i s = _mm_add_epi32(a, b);
+    __m128i o = _mm_srai_epi32(_mm_andnot_si128(_mm_xor_si128(a, b),
+						_mm_xor_si128(a, s)), 31);
+    __m128i m = _mm_xor_si128(_mm_srai_epi32(a, 31),
+			      _mm_set1_epi32(0x7fffffff));
+    return _mm_or_si128(_mm_and_si128(o, m), _mm_andnot_si128(o, s));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i subs_epi32_128(__m128i a, __m128i b)
+{
+    __m128i d = _mm_sub_epi32(a, b);
+    __m128i o = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(a, b),
+					     _mm_xor_si128(a, d)), 31);
+    __m128i m = _mm_xor_si128(_mm_srai_epi32(a, 31),
+			      _mm_set1_epi32(0x7fffffff));
+    return _mm_or_si128(_mm_and_si128(o, m), _mm_andnot_si128(o, d));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i adds_epi32_256(__m256i a, __m256i b)
+{
+    __m256i s = _mm256_add_epi32(a, b);
+    __m256i o = _mm256_srai_epi32(_mm256_andnot_si256(_mm256_xor_si256(a, b),
+						      _mm256_xor_si256(a, s)),
+				  31);
+    __m256i m = _mm256_xor_si256(_mm256_srai_epi32(a, 31),
+				 _mm256_set1_epi32(0x7fffffff));
+    return _mm256_blendv_epi8(s, m, o);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i subs_epi32_256(__m256i a, __m256i b)
+{
+    __m256i d = _mm256_sub_epi32(a, b);
+    __m256i o = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(a, b),
+						   _mm256_xor_si256(a, d)),
+				  31);
+    __m256i m = _mm256_xor_si256(_mm256_srai_epi32(a, 31),
+				 _mm256_set1_epi32(0x7fffffff));
+    return _mm256_blendv_epi8(d, m, o);
+}
+
+// d = (a + b) - s, saturating for integer samples
+__attribute__((target("ssse3")))
+SIMD_INLINE __m128i op_128(__m128i a, __m128i b, __m128i s, const int type)
+{
+    switch(type) {
+    case ACAST_SAMPLE_S16:
+	return _mm_subs_epi16(_mm_adds_epi16(a, b), s);
+    case ACAST_SAMPLE_S32:
+	return subs_epi32_128(adds_epi32_128(a, b), s);
+    case ACAST_SAMPLE_F32:
+	return _mm_castps_si128(
+	    _mm_sub_ps(_mm_add_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b)),
+		       _mm_castsi128_ps(s)));
+    default:
+	return _mm_castpd_si128(
+	    _mm_sub_pd(_mm_add_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b)),
+		       _mm_castsi128_pd(s)));
+    }
+}
+
+__attribute__((target("avx2")))
+SIMD_INLINE __m256i op_256(__m256i a, __m256i b, __m256i s, const int type)
+{
+    switch(type) {
+    case ACAST_SAMPLE_S16:
+	return _mm256_subs_epi16(_mm256_adds_epi16(a, b), s);
+    case ACAST_SAMPLE_S32:
+	return subs_epi32_256(adds_epi32_256(a, b), s);
+    case ACAST_SAMPLE_F32:
+	return _mm256_castps_si256(
+	    _mm256_sub_ps(_mm256_add_ps(_mm256_castsi256_ps(a),
+					_mm256_castsi256_ps(b)),
+			  _mm256_castsi256_ps(s)));
+    default:
+	return _mm256_castpd_si256(
+	    _mm256_sub_pd(_mm256_add_pd(_mm256_castsi256_pd(a),
+					_mm256_castsi256_pd(b)),
+			  _mm256_castsi256_pd(s)));
+    }
+}
+
+// true if any source chunk contribute to the plan
+static int shuffle_plan_used(shuffle_plan_t* plan)
+{
+    size_t o, c;
+    for (o = 0; o < plan->nout; o++)
+	for (c = 0; c < plan->nin; c++)
+	    if (plan->used[o][c])
+		return 1;
+    return 0;
+}
+
+__attribute__((target("ssse3")))
+SIMD_INLINE size_t channel_prog_ii_ssse3_k(op_plan_t* op, const int type,
+					   uint8_t* src, uint8_t* dst,
+					   size_t frames,
+					   const size_t nin, const size_t nout)
+{
+    shuffle_plan_t* plan = &op->a;
+    __m128i ma[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    __m128i mb[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    __m128i ms[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    __m128i cadd[SHUFFLE_MAX_OUT];
+    __m128i csub[SHUFFLE_MAX_OUT];
+    int use_b = shuffle_plan_used(&op->badd);
+    int use_s = shuffle_plan_used(&op->bsub);
+    size_t sframe = plan->sbytes / plan->k;
+    size_t dframe = plan->dbytes / plan->k;
+    size_t sload  = nin*16;
+    size_t dstore = nout*16;
+    size_t n = 0;
+    size_t o, c;
+
+    for (o = 0; o < nout; o++) {
+	for (c = 0; c < nin; c++) {
+	    ma[o][c] = _mm_loadu_si128((__m128i*) op->a.mask[o][c]);
+	    mb[o][c] = _mm_loadu_si128((__m128i*) op->badd.mask[o][c]);
+	    ms[o][c] = _mm_loadu_si128((__m128i*) op->bsub.mask[o][c]);
+	}
+	cadd[o] = _mm_loadu_si128((__m128i*)(op->cadd + 16*o));
+	csub[o] = _mm_loadu_si128((__m128i*)(op->csub + 16*o));
+    }
+
+    while ((frames - n >= plan->k) &&
+	   ((frames - n)*sframe >= sload) &&
+	   ((frames - n)*dframe >= dstore)) {
+	__m128i in[SHUFFLE_MAX_IN];
+
+	for (c = 0; c < nin; c++)
+	    in[c] = _mm_loadu_si128((__m128i*)(src + 16*c));
+	for (o = 0; o < nout; o++) {
+	    __m128i a = shuffle_out_128(ma[o], in, nin);
+	    __m128i b = cadd[o];
+	    __m128i s = csub[o];
+	    if (use_b)
+		b = _mm_or_si128(b, shuffle_out_128(mb[o], in, nin));
+	    if (use_s)
+		s = _mm_or_si128(s, shuffle_out_128(ms[o], in, nin));
+	    _mm_storeu_si128((__m128i*)(dst + 16*o), op_128(a, b, s, type));
+	}
+	src += plan->sbytes;
+	dst += plan->dbytes;
+	n += plan->k;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+SIMD_INLINE size_t channel_prog_ii_avx2_k(op_plan_t* op, const int type,
+					  uint8_t* src, uint8_t* dst,
+					  size_t frames,
+					  const size_t nin, const size_t nout)
+{
+    shuffle_plan_t* plan = &op->a;
+    __m256i ma[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    __m256i mb[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    __m256i ms[SHUFFLE_MAX_OUT][SHUFFLE_MAX_IN];
+    __m256i cadd[SHUFFLE_MAX_OUT];
+    __m256i csub[SHUFFLE_MAX_OUT];
+    int use_b = shuffle_plan_used(&op->badd);
+    int use_s = shuffle_plan_used(&op->bsub);
+    size_t sframe = plan->sbytes / plan->k;
+    size_t dframe = plan->dbytes / plan->k;
+    size_t sload  = plan->sbytes + nin*16;
+    size_t dstore = plan->dbytes + nout*16;
+    size_t n = 0;
+    size_t o, c;
+
+#define BROADCAST128(p) \
+    _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)(p)))
+    for (o = 0; o < nout; o++) {
+	for (c = 0; c < nin; c++) {
+	    ma[o][c] = BROADCAST128(op->a.mask[o][c]);
+	    mb[o][c] = BROADCAST128(op->badd.mask[o][c]);
+	    ms[o][c] = BROADCAST128(op->bsub.mask[o][c]);
+	}
+	cadd[o] = BROADCAST128(op->cadd + 16*o);
+	csub[o] = BROADCAST128(op->csub + 16*o);
+    }
+#undef BROADCAST128
+
+    while ((frames - n >= 2*plan->k) &&
+	   ((frames - n)*sframe >= sload) &&
+	   ((frames - n)*dframe >= dstore)) {
+	__m256i in[SHUFFLE_MAX_IN];
+	__m256i r[SHUFFLE_MAX_OUT];
+
+	for (c = 0; c < nin; c++) {
+	    __m128i lo = _mm_loadu_si128((__m128i*)(src + 16*c));
+	    __m128i hi = _mm_loadu_si128((__m128i*)(src+plan->sbytes+16*c));
+	    in[c] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+	}
+	for (o = 0; o < nout; o++) {
+	    __m256i a = shuffle_out_256(ma[o], in, nin);
+	    __m256i b = cadd[o];
+	    __m256i s = csub[o];
+	    if (use_b)
+		b = _mm256_or_si256(b, shuffle_out_256(mb[o], in, nin));
+	    if (use_s)
+		s = _mm256_or_si256(s, shuffle_out_256(ms[o], in, nin));
+	    r[o] = op_256(a, b, s, type);
+	}
+	for (o = 0; o < nout; o++)
+	    _mm_storeu_si128((__m128i*)(dst + 16*o),
+			     _mm256_castsi256_si128(r[o]));
+	for (o = 0; o < nout; o++)
+	    _mm_storeu_si128((__m128i*)(dst + plan->dbytes + 16*o),
+			     _mm256_extracti128_si256(r[o], 1));
+	src += 2*plan->sbytes;
+	dst += 2*plan->dbytes;
+	n += 2*plan->k;
+    }
+    return n;
+}
+
+// one specialized kernel per shape and sample type
+#define PROG_TYPE(k,t,i,o)						\
+    case t: return k(op, t, src, dst, frames, i, o);
+#define PROG_TYPES(k,i,o)						\
+    switch(type) {							\
+    PROG_TYPE(k,ACAST_SAMPLE_S16,i,o)					\
+    PROG_TYPE(k,ACAST_SAMPLE_S32,i,o)					\
+    PROG_TYPE(k,ACAST_SAMPLE_F32,i,o)					\
+    PROG_TYPE(k,ACAST_SAMPLE_F64,i,o)					\
+    default: return 0;							\
+    }
+
+__attribute__((target("ssse3")))
+static size_t channel_prog_ii_ssse3(op_plan_t* op, int type,
+				    uint8_t* src, uint8_t* dst, size_t frames)
+{
+#define PROG_SSSE3(i,o) case SHUFFLE_SHAPE(i,o):			\
+    PROG_TYPES(channel_prog_ii_ssse3_k,i,o)
+    switch(SHUFFLE_SHAPE(op->a.nin, op->a.nout)) {
+	SHUFFLE_SHAPES(PROG_SSSE3)
+    default: return 0;
+    }
+#undef PROG_SSSE3
+}
+
+__attribute__((target("avx2")))
+static size_t channel_prog_ii_avx2(op_plan_t* op, int type,
+				   uint8_t* src, uint8_t* dst, size_t frames)
+{
+#define PROG_AVX2(i,o) case SHUFFLE_SHAPE(i,o):				\
+    PROG_TYPES(channel_prog_ii_avx2_k,i,o)
+    switch(SHUFFLE_SHAPE(op->a.nin, op->a.nout)) {
+	SHUFFLE_SHAPES(PROG_AVX2)
+    default: return 0;
+    }
+#undef PROG_AVX2
+}
+
+// g711 decode, 16 table lookups per iteration with gather
+__attribute__((target("avx2")))
+static size_t g711_decode_avx2(const int32_t* table,
+			       uint8_t* src, int16_t* dst, size_t n)
+{
+    size_t i = 0;
+
+    while(n - i >= 16) {
+	__m128i b  = _mm_loadu_si128((__m128i*)(src + i));
+	__m256i i0 = _mm256_cvtepu8_epi32(b);
+	__m256i i1 = _mm256_cvtepu8_epi32(_mm_srli_si128(b, 8));
+	__m256i v0 = _mm256_i32gather_epi32((const int*) table, i0, 4);
+	__m256i v1 = _mm256_i32gather_epi32((const int*) table, i1, 4);
+	// packs work per lane, put the quad words back in order
+	__m256i r  = _mm256_permute4x64_epi64(_mm256_packs_epi32(v0, v1),
+					      0xD8);
+	_mm256_storeu_si256((__m256i*)(dst + i), r);
+	i += 16;
+    }
+    return i;
+}
+
+// float to integer, scale, clamp then round to nearest even.
+// max_ps returns the second operand for NaN so NaN ends up as the minimum
+__attribute__((target("avx2")))
+static size_t float_to_s16_avx2(float* src, int16_t* dst, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 lo = _mm256_set1_ps(-32768.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    size_t i = 0;
+
+    while(n - i >= 16) {
+	__m256 x0 = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+	__m256 x1 = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+	__m256i v0, v1;
+	x0 = _mm256_min_ps(_mm256_max_ps(x0, lo), hi);
+	x1 = _mm256_min_ps(_mm256_max_ps(x1, lo), hi);
+	v0 = _mm256_cvtps_epi32(x0);
+	v1 = _mm256_cvtps_epi32(x1);
+	_mm256_storeu_si256((__m256i*)(dst + i),
+			    _mm256_permute4x64_epi64(
+				_mm256_packs_epi32(v0, v1), 0xD8));
+	i += 16;
+    }
+    return i;
+}
+
+// 2^31-1 is not a float, S32 is converted over double
+__attribute__((target("avx2")))
+SIMD_INLINE __m128i double_to_s32_256(__m256d x, __m256d scale)
+{
+    const __m256d lo = _mm256_set1_pd(-2147483648.0);
+    const __m256d hi = _mm256_set1_pd(2147483647.0);
+    x = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(x, scale), lo), hi);
+    return _mm256_cvtpd_epi32(x);
+}
+
+__attribute__((target("avx2")))
+static size_t float_to_s32_avx2(float* src, int32_t* dst, size_t n)
+{
+    const __m256d scale = _mm256_set1_pd(2147483648.0);
+    size_t i = 0;
+
+    while(n - i >= 8) {
+	__m128 x0 = _mm_loadu_ps(src + i);
+	__m128 x1 = _mm_loadu_ps(src + i + 4);
+	__m128i v0 = double_to_s32_256(_mm256_cvtps_pd(x0), scale);
+	__m128i v1 = double_to_s32_256(_mm256_cvtps_pd(x1), scale);
+	_mm256_storeu_si256((__m256i*)(dst + i),
+			    _mm256_inserti128_si256(
+				_mm256_castsi128_si256(v0), v1, 1));
+	i += 8;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t double_to_s16_avx2(double* src, int16_t* dst, size_t n)
+{
+    const __m256d scale = _mm256_set1_pd(32768.0);
+    const __m256d lo = _mm256_set1_pd(-32768.0);
+    const __m256d hi = _mm256_set1_pd(32767.0);
+    size_t i = 0;
+
+    while(n - i >= 8) {
+	__m256d x0 = _mm256_mul_pd(_mm256_loadu_pd(src + i), scale);
+	__m256d x1 = _mm256_mul_pd(_mm256_loadu_pd(src + i + 4), scale);
+	__m128i v0, v1;
+	x0 = _mm256_min_pd(_mm256_max_pd(x0, lo), hi);
+	x1 = _mm256_min_pd(_mm256_max_pd(x1, lo), hi);
+	v0 = _mm256_cvtpd_epi32(x0);
+	v1 = _mm256_cvtpd_epi32(x1);
+	_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(v0, v1));
+	i += 8;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t double_to_s32_avx2(double* src, int32_t* dst, size_t n)
+{
+    const __m256d scale = _mm256_set1_pd(2147483648.0);
+    size_t i = 0;
+
+    while(n - i >= 8) {
+	__m128i v0 = double_to_s32_256(_mm256_loadu_pd(src + i), scale);
+	__m128i v1 = double_to_s32_256(_mm256_loadu_pd(src + i + 4), scale);
+	_mm256_storeu_si256((__m256i*)(dst + i),
+			    _mm256_inserti128_si256(
+				_mm256_castsi128_si256(v0), v1, 1));
+	i += 8;
+    }
+    return i;
+}
+
+// gain matrix, one frame per iteration with the output channels in
+// the lanes, out += in[j]*column j. Products are added in the same
+// order as matrix_ii_TYPE in map.i so the results are the same.
+// Stores are full vectors, the lanes past nout land in the next frame
+// and are overwritten by it, so stop while a full store still fits.
+// With at most 4 outputs two frames are done per vector, frame n in
+// the low lane and n+1 in the high lane.
+#define MATRIX_PAIR(a, b) _mm256_set_m128(_mm_set1_ps(b), _mm_set1_ps(a))
+__attribute__((target("avx2")))
+static size_t matrix_ii_s16_avx2(acast_matrix_t* mx,
+				 int16_t* src, size_t nsrc,
+				 int16_t* dst, size_t ndst, size_t frames)
+{
+    const __m256 lo = _mm256_set1_ps(-32768.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    __m256 g[MAX_MATRIX_IN];
+    float col[8];
+    size_t n = 0;
+    int i, j;
+
+    if (mx->nout <= 4) {
+	for (j = 0; j < mx->nin; j++) {
+	    for (i = 0; i < 8; i++)
+		col[i] = ((i & 3) < mx->nout) ? mx->gain[i & 3][j] : 0.0f;
+	    g[j] = _mm256_loadu_ps(col);
+	}
+	while((frames - n >= 2) && ((frames - n - 1)*ndst >= 4)) {
+	    __m256 acc = _mm256_setzero_ps();
+	    __m256i v;
+	    for (j = 0; j < mx->nin; j++)
+		acc = _mm256_add_ps(acc,
+				    _mm256_mul_ps(MATRIX_PAIR(src[j],
+							      src[nsrc+j]),
+						  g[j]));
+	    acc = _mm256_min_ps(_mm256_max_ps(acc, lo), hi);
+	    v = _mm256_cvtps_epi32(acc);
+	    v = _mm256_packs_epi32(v, v);
+	    _mm_storel_epi64((__m128i*) dst, _mm256_castsi256_si128(v));
+	    _mm_storel_epi64((__m128i*)(dst + ndst),
+			     _mm256_extracti128_si256(v, 1));
+	    src += 2*nsrc;
+	    dst += 2*ndst;
+	    n += 2;
+	}
+    }
+    for (j = 0; j < mx->nin; j++) {
+	for (i = 0; i < 8; i++)
+	    col[i] = (i < mx->nout) ? mx->gain[i][j] : 0.0f;
+	g[j] = _mm256_loadu_ps(col);
+    }
+    while((frames - n)*ndst >= 8) {
+	__m256 acc = _mm256_setzero_ps();
+	__m256i v;
+	for (j = 0; j < mx->nin; j++)
+	    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(src[j]),
+						   g[j]));
+	acc = _mm256_min_ps(_mm256_max_ps(acc, lo), hi);
+	v = _mm256_cvtps_epi32(acc);
+	v = _mm256_permute4x64_epi64(_mm256_packs_epi32(v, v), 0x08);
+	_mm_storeu_si128((__m128i*) dst, _mm256_castsi256_si128(v));
+	src += nsrc;
+	dst += ndst;
+	n++;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t matrix_ii_f32_avx2(acast_matrix_t* mx,
+				 float* src, size_t nsrc,
+				 float* dst, size_t ndst, size_t frames)
+{
+    __m256 g[MAX_MATRIX_IN];
+    float col[8];
+    size_t n = 0;
+    int i, j;
+
+    if (mx->nout <= 4) {
+	for (j = 0; j < mx->nin; j++) {
+	    for (i = 0; i < 8; i++)
+		col[i] = ((i & 3) < mx->nout) ? mx->gain[i & 3][j] : 0.0f;
+	    g[j] = _mm256_loadu_ps(col);
+	}
+	while((frames - n >= 2) && ((frames - n - 1)*ndst >= 4)) {
+	    __m256 acc = _mm256_setzero_ps();
+	    for (j = 0; j < mx->nin; j++)
+		acc = _mm256_add_ps(acc,
+				    _mm256_mul_ps(MATRIX_PAIR(src[j],
+							      src[nsrc+j]),
+						  g[j]));
+	    _mm_storeu_ps(dst, _mm256_castps256_ps128(acc));
+	    _mm_storeu_ps(dst + ndst, _mm256_extractf128_ps(acc, 1));
+	    src += 2*nsrc;
+	    dst += 2*ndst;
+	    n += 2;
+	}
+    }
+    for (j = 0; j < mx->nin; j++) {
+	for (i = 0; i < 8; i++)
+	    col[i] = (i < mx->nout) ? mx->gain[i][j] : 0.0f;
+	g[j] = _mm256_loadu_ps(col);
+    }
+    while((frames - n)*ndst >= 8) {
+	__m256 acc = _mm256_setzero_ps();
+	for (j = 0; j < mx->nin; j++)
+	    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(src[j]),
+						   g[j]));
+	_mm256_storeu_ps(dst, acc);
+	src += nsrc;
+	dst += ndst;
+	n++;
+    }
+    return n;
+}
+
+// 32 bit samples and doubles accumulate in double, 4 lanes per vector
+__attribute__((target("avx2")))
+SIMD_INLINE size_t matrix_ii_d_avx2_k(acast_matrix_t* mx,
+				      void* src, size_t nsrc,
+				      void* dst, size_t ndst, size_t frames,
+				      const int type)
+{
+    const __m256d lo = _mm256_set1_pd(-2147483648.0);
+    const __m256d hi = _mm256_set1_pd(2147483647.0);
+    __m256d g[2][MAX_MATRIX_IN];
+    double col[8];
+    size_t nv = (mx->nout + 3) / 4;
+    size_t n = 0;
+    int i, j, k;
+
+    for (j = 0; j < mx->nin; j++) {
+	for (i = 0; i < 8; i++)
+	    col[i] = (i < mx->nout) ? mx->dgain[i][j] : 0.0;
+	g[0][j] = _mm256_loadu_pd(col);
+	g[1][j] = _mm256_loadu_pd(col+4);
+    }
+    while((frames - n)*ndst >= 4*nv) {
+	for (k = 0; k < nv; k++) {
+	    __m256d acc = _mm256_setzero_pd();
+	    if (type == ACAST_SAMPLE_S32) {
+		int32_t* s = (int32_t*) src + n*nsrc;
+		for (j = 0; j < mx->nin; j++)
+		    acc = _mm256_add_pd(acc,
+					_mm256_mul_pd(_mm256_set1_pd(s[j]),
+						      g[k][j]));
+		acc = _mm256_min_pd(_mm256_max_pd(acc, lo), hi);
+		_mm_storeu_si128((__m128i*)((int32_t*) dst + n*ndst + 4*k),
+				 _mm256_cvtpd_epi32(acc));
+	    }
+	    else {
+		double* s = (double*) src + n*nsrc;
+		for (j = 0; j < mx->nin; j++)
+		    acc = _mm256_add_pd(acc,
+					_mm256_mul_pd(_mm256_set1_pd(s[j]),
+						      g[k][j]));
+		_mm256_storeu_pd((double*) dst + n*ndst + 4*k, acc);
+	    }
+	}
+	n++;
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t matrix_ii_s32_avx2(acast_matrix_t* mx,
+				 int32_t* src, size_t nsrc,
+				 int32_t* dst, size_t ndst, size_t frames)
+{
+    return matrix_ii_d_avx2_k(mx, src, nsrc, dst, ndst, frames,
+			      ACAST_SAMPLE_S32);
+}
+
+__attribute__((target("avx2")))
+static size_t matrix_ii_f64_avx2(acast_matrix_t* mx,
+				 double* src, size_t nsrc,
+				 double* dst, size_t ndst, size_t frames)
+{
+    return matrix_ii_d_avx2_k(mx, src, nsrc, dst, ndst, frames,
+			      ACAST_SAMPLE_F64);
+}
+
+// Plans are cached per thread, building a plan cost more than mapping
+// a small packet and the same maps are used for every packet. The
+// caches are hashed on the map, a lookup probes PLAN_CACHE_PROBE
+// entries from the hash slot, a miss takes the first free one or
+// replaces one of them round robin. acast_simd_plan_cache sizes the
+// caches for the maps in use, so a lookup does not grow with them.
+#define PLAN_CACHE_SIZE  16   // min entries, power of 2
+#define PLAN_CACHE_PROBE 4
+#define PLAN_HASH_INIT   2166136261u
+
+typedef struct
+{
+    size_t width;     // 0 = free entry
+    size_t nsrc;
+    size_t ndst;
+    uint8_t map[16*SHUFFLE_MAX_OUT];
+    int ok;           // 0 if map does not fit
+    shuffle_plan_t plan;
+} permute_cache_t;
+
+typedef struct
+{
+    int type;         // 0 = free entry
+    size_t nsrc;
+    size_t ndst;
+    acast_channel_prog_t prog;
+    int ok;           // 0 if prog does not fit
+    op_plan_t op;
+} op_cache_t;
+
+static __thread permute_cache_t* permute_cache = NULL;
+static __thread size_t permute_cache_size = 0;  // power of 2
+static __thread size_t permute_cache_next = 0;  // probe entry to replace
+static __thread op_cache_t* op_cache = NULL;
+static __thread size_t op_cache_size = 0;
+static __thread size_t op_cache_next = 0;
+
+// FNV-1a over n bytes of data
+static uint32_t plan_hash(uint32_t h, const void* data, size_t n)
+{
+    const uint8_t* p = data;
+
+    while(n--) {
+	h ^= *p++;
+	h *= 16777619;
+    }
+    return h;
+}
+
+// replace cache of *size entries of elem bytes with n zeroed entries,
+// cached plans hash to other entries in the new cache and are dropped.
+// return the new cache or NULL and keep the old one
+static void* plan_cache_grow(void* cache, size_t* size, size_t elem,
+			     size_t n)
+{
+    void* p;
+
+    if ((p = calloc(n, elem)) == NULL)
+	return NULL;
+    free(cache);
+    *size = n;
+    return p;
+}
+
+static int plan_cache_reserve(size_t n)
+{
+    size_t size = PLAN_CACHE_SIZE;
+    void* p;
+
+    while(size < 2*n)  // at most half full
+	size *= 2;
+    if (size > permute_cache_size) {
+	if ((p = plan_cache_grow(permute_cache, &permute_cache_size,
+				 sizeof(permute_cache_t), size)) == NULL)
+	    return -1;
+	permute_cache = p;
+    }
+    if (size > op_cache_size) {
+	if ((p = plan_cache_grow(op_cache, &op_cache_size,
+				 sizeof(op_cache_t), size)) == NULL)
+	    return -1;
+	op_cache = p;
+    }
+    return 0;
+}
+
+static shuffle_plan_t* permute_plan(size_t width, size_t nsrc, size_t ndst,
+				    uint8_t* channel_map)
+{
+    permute_cache_t* pc = NULL;
+    size_t mask;
+    uint32_t h;
+    size_t i;
+
+    if (ndst > 16*SHUFFLE_MAX_OUT)
+	return NULL;
+    if ((permute_cache_size == 0) && (plan_cache_reserve(0) < 0))
+	return NULL;
+    mask = permute_cache_size - 1;
+    h = plan_hash(PLAN_HASH_INIT, &width, sizeof(width));
+    h = plan_hash(h, &nsrc, sizeof(nsrc));
+    h = plan_hash(h, &ndst, sizeof(ndst));
+    h = plan_hash(h, channel_map, ndst);
+    // entries are only freed all at once, so a map is never cached
+    // after a free entry in its probe sequence
+    for (i = 0; i < PLAN_CACHE_PROBE; i++) {
+	pc = &permute_cache[(h + i) & mask];
+	if (pc->width == 0)
+	    break;
+	if ((pc->width == width) && (pc->nsrc == nsrc) && (pc->ndst == ndst) &&
+	    (memcmp(pc->map, channel_map, ndst) == 0))
+	    return pc->ok ? &pc->plan : NULL;
+    }
+    if (i == PLAN_CACHE_PROBE) {
+	pc = &permute_cache[(h + permute_cache_next) & mask];
+	permute_cache_next = (permute_cache_next + 1) % PLAN_CACHE_PROBE;
+    }
+    pc->width = width;
+    pc->nsrc  = nsrc;
+    pc->ndst  = ndst;
+    memcpy(pc->map, channel_map, ndst);
+    pc->ok = shuffle_plan(&pc->plan, width, nsrc, ndst, channel_map);
+    return pc->ok ? &pc->plan : NULL;
+}
+
+static op_plan_t* prog_plan(int type, size_t nsrc, size_t ndst,
+			    acast_channel_prog_t* prog)
+{
+    size_t len = prog->num_ops*sizeof(acast_prog_op_t);
+    op_cache_t* oc = NULL;
+    size_t mask;
+    uint32_t h;
+    size_t i;
+
+    if ((op_cache_size == 0) && (plan_cache_reserve(0) < 0))
+	return NULL;
+    mask = op_cache_size - 1;
+    h = plan_hash(PLAN_HASH_INIT, &type, sizeof(type));
+    h = plan_hash(h, &nsrc, sizeof(nsrc));
+    h = plan_hash(h, &ndst, sizeof(ndst));
+    h = plan_hash(h, prog->op, len);
+    for (i = 0; i < PLAN_CACHE_PROBE; i++) {
+	oc = &op_cache[(h + i) & mask];
+	if (oc->type == 0)
+	    break;
+	if ((oc->type == type) && (oc->nsrc == nsrc) && (oc->ndst == ndst) &&
+	    (oc->prog.num_ops == prog->num_ops) &&
+	    (memcmp(oc->prog.op, prog->op, len) == 0))
+	    return oc->ok ? &oc->op : NULL;
+    }
+    if (i == PLAN_CACHE_PROBE) {
+	oc = &op_cache[(h + op_cache_next) & mask];
+	op_cache_next = (op_cache_next + 1) % PLAN_CACHE_PROBE;
+    }
+    oc->type  = type;
+    oc->nsrc  = nsrc;
+    oc->ndst  = ndst;
+    oc->prog.num_ops = prog->num_ops;
+    memcpy(oc->prog.op, prog->op, len);
+    oc->ok = op_plan(&oc->op, type, nsrc, ndst, prog);
+    return oc->ok ? &oc->op : NULL;
+}
+
+#endif
+
+void acast_simd_plan_cache(size_t n)
+{
+#ifdef ACAST_X86
+    // too few entries only costs speed
+    plan_cache_reserve(n);
+#else
+    (void) n;
+#endif
+}
+
+size_t acast_permute_ii_simd(size_t width,
+			     void* src, size_t nsrc,
+			     void* dst, size_t ndst,
+			     uint8_t* channel_map,
+			     size_t frames)
+{
+#ifdef ACAST_X86
+    shuffle_plan_t* plan;
+    size_t n = 0;
+    int level = acast_simd_level();
+
+    if (level < ACAST_SIMD_SSSE3)
+	return 0;
+    if ((plan = permute_plan(width, nsrc, ndst, channel_map)) == NULL)
+	return 0;
+    if (level >= ACAST_SIMD_AVX2)
+	n = permute_ii_avx2(plan, src, dst, frames);
+    n += permute_ii_ssse3(plan,
+			  (uint8_t*)src + n*nsrc*width,
+			  (uint8_t*)dst + n*ndst*width,
+			  frames - n);
+    return n;
+#else
+    return 0;
+#endif
+}
+
+size_t acast_channel_prog_ii_simd(int type,
+				  void* src, size_t nsrc,
+				  void* dst, size_t ndst,
+				  acast_channel_prog_t* prog,
+				  size_t frames)
+{
+#ifdef ACAST_X86
+    size_t width = ACAST_SAMPLE_WIDTH(type);
+    op_plan_t* op;
+    size_t n = 0;
+    int level = acast_simd_level();
+
+    if (level < ACAST_SIMD_SSSE3)
+	return 0;
+    if ((type != ACAST_SAMPLE_S16) && (type != ACAST_SAMPLE_S32) &&
+	(type != ACAST_SAMPLE_F32) && (type != ACAST_SAMPLE_F64))
+	return 0;
+    if ((op = prog_plan(type, nsrc, ndst, prog)) == NULL)
+	return 0;
+    if (level >= ACAST_SIMD_AVX2)
+	n = channel_prog_ii_avx2(op, type, src, dst, frames);
+    n += channel_prog_ii_ssse3(op, type,
+			       (uint8_t*)src + n*nsrc*width,
+			       (uint8_t*)dst + n*ndst*width,
+			       frames - n);
+    return n;
+#else
+    return 0;
+#endif
+}
+
+size_t acast_matrix_ii_simd(int type,
+			    void* src, size_t nsrc,
+			    void* dst, size_t ndst,
+			    acast_matrix_t* mx,
+			    size_t frames)
+{
+#ifdef ACAST_X86
+    if (acast_simd_level() < ACAST_SIMD_AVX2)
+	return 0;
+    // lanes past nout are written, they must be the next frame
+    if ((ndst != mx->nout) || (mx->nout > 8) || (mx->nin > nsrc))
+	return 0;
+    switch(type) {
+    case ACAST_SAMPLE_S16:
+	return matrix_ii_s16_avx2(mx, src, nsrc, dst, ndst, frames);
+    case ACAST_SAMPLE_F32:
+	return matrix_ii_f32_avx2(mx, src, nsrc, dst, ndst, frames);
+    case ACAST_SAMPLE_S32:
+	return matrix_ii_s32_avx2(mx, src, nsrc, dst, ndst, frames);
+    case ACAST_SAMPLE_F64:
+	return matrix_ii_f64_avx2(mx, src, nsrc, dst, ndst, frames);
+    default:
+	return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+size_t acast_g711_decode_simd(const int32_t* table,
+			      uint8_t* src, int16_t* dst, size_t n)
+{
+#ifdef ACAST_X86
+    if (acast_simd_level() >= ACAST_SIMD_AVX2)
+	return g711_decode_avx2(table, src, dst, n);
+#endif
+    return 0;
+}
+
+#ifdef ACAST_X86
+#define FLOAT_CONV_SIMD(name, stype, dtype)				\
+size_t CAT2(acast_,CAT2(name,_simd))(stype* src, dtype* dst, size_t n)	\
+{									\
+    if (acast_simd_level() >= ACAST_SIMD_AVX2)				\
+	return CAT2(name,_avx2)(src, dst, n);				\
+    return 0;								\
+}
+#else
+#define FLOAT_CONV_SIMD(name, stype, dtype)				\
+size_t CAT2(acast_,CAT2(name,_simd))(stype* src, dtype* dst, size_t n)	\
+{									\
+    return 0;								\
+}
+#endif
+
+FLOAT_CONV_SIMD(float_to_s16, float, int16_t)
+FLOAT_CONV_SIMD(float_to_s32, float, int32_t)
+FLOAT_CONV_SIMD(double_to_s16, double, int16_t)
+FLOAT_CONV_SIMD(double_to_s32, double, int32_t)
@@ -0,0 +1,73 @@
+//
+//  SIMD kernels for channel mapping
+//
+#ifndef __ACAST_SIMD_H__
+#define __ACAST_SIMD_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "acast_channel.h"
+
+#define ACAST_SIMD_NONE   0
+#define ACAST_SIMD_SSE2   1
+#define ACAST_SIMD_SSSE3  2
+#define ACAST_SIMD_AVX2   3
+
+// detected (or forced) simd level
+extern int acast_simd_level(void);
+// force a simd level (for testing) -1 = redetect
+extern void acast_simd_set_level(int level);
+
+// keep plans for at least n maps per thread, a caller that cycles
+// through more maps than that rebuilds a plan on every call
+extern void acast_simd_plan_cache(size_t n);
+
+// permute interleaved frames with sample size width (bytes)
+// return number of frames processed, the rest must be done by caller
+extern size_t acast_permute_ii_simd(size_t width,
+				    void* src, size_t nsrc,
+				    void* dst, size_t ndst,
+				    uint8_t* channel_map,
+				    size_t frames);
+
+// sample types for channel programs, low bits are the width in bytes
+#define ACAST_SAMPLE_S16  0x02
+#define ACAST_SAMPLE_S32  0x04
+#define ACAST_SAMPLE_F32  0x14
+#define ACAST_SAMPLE_F64  0x18
+#define ACAST_SAMPLE_WIDTH(t)  ((t) & 0x0f)
+#define ACAST_SAMPLE_FLOAT(t)  ((t) & 0x10)
+
+// run channel program on interleaved frames, saturating ADD/SUB ops
+// for integer samples, plain add/sub for float samples
+// return number of frames processed, the rest must be done by caller
+extern size_t acast_channel_prog_ii_simd(int type,
+					 void* src, size_t nsrc,
+					 void* dst, size_t ndst,
+					 acast_channel_prog_t* prog,
+					 size_t frames);
+
+// apply gain matrix on interleaved frames
+// return number of frames processed, the rest must be done by caller
+extern size_t acast_matrix_ii_simd(int type,
+				   void* src, size_t nsrc,
+				   void* dst, size_t ndst,
+				   acast_matrix_t* mx,
+				   size_t frames);
+
+// decode g711 samples with a 256 entry table (int32 entries)
+// return number of samples processed, the rest must be done by caller
+extern size_t acast_g711_decode_simd(const int32_t* table,
+				     uint8_t* src, int16_t* dst, size_t n);
+
+// convert native float samples to S16/S32, scale by 2^15/2^31, saturate
+// and round to nearest even, NaN gives the minimum value
+// return number of samples processed, the rest must be done by caller
+extern size_t acast_float_to_s16_simd(float* src, int16_t* dst, size_t n);
+extern size_t acast_float_to_s32_simd(float* src, int32_t* dst, size_t n);
+extern size_t acast_double_to_s16_simd(double* src, int16_t* dst, size_t n);
+extern size_t acast_double_to_s32_simd(double* src, int32_t* dst, size_t n);
+
+#endif
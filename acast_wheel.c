@@ -0,0 +1,173 @@
+//
+//  Hashed timer wheel
+//
+//  A timer is stored with its absolute slot number, slot s holds the
+//  timers that expire in ((s-1)*granularity, s*granularity] and is
+//  emptied when the time passes its end. Timers beyond the wheel span
+//  share a slot with earlier ones and are skipped until their round.
+//  Links are entry numbers so the lists survive a reallocation.
+//
+#include <stdlib.h>
+#include <string.h>
+
+#include "acast_wheel.h"
+
+#define NIL      -1
+#define NO_SLOT  UINT64_MAX
+
+typedef struct
+{
+    int next;
+    int prev;               // NIL when first in slot
+    uint64_t slot;          // absolute slot number or NO_SLOT
+} wheel_entry_t;
+
+struct _acast_wheel_t
+{
+    size_t num_slots;       // power of two
+    tick_t granularity;
+    uint64_t cur;           // first slot not yet expired
+    int* head;              // first entry per slot
+    size_t num_entries;
+    wheel_entry_t* entry;
+    size_t count;           // running timers
+};
+
+acast_wheel_t* acast_wheel_new(size_t num_slots, tick_t granularity,
+			       tick_t now)
+{
+    acast_wheel_t* w;
+    size_t n = 1;
+    size_t i;
+
+    while(n < num_slots)
+	n <<= 1;
+    if ((w = calloc(1, sizeof(acast_wheel_t))) == NULL)
+	return NULL;
+    if ((w->head = malloc(n*sizeof(int))) == NULL) {
+	free(w);
+	return NULL;
+    }
+    for (i = 0; i < n; i++)
+	w->head[i] = NIL;
+    w->num_slots = n;
+    w->granularity = granularity ? granularity : 1;
+    w->cur = now / w->granularity + 1;
+    return w;
+}
+
+void acast_wheel_free(acast_wheel_t* w)
+{
+    free(w->head);
+    free(w->entry);
+    free(w);
+}
+
+static void wheel_unlink(acast_wheel_t* w, size_t i)
+{
+    wheel_entry_t* e = &w->entry[i];
+
+    if (e->prev == NIL)
+	w->head[e->slot & (w->num_slots-1)] = e->next;
+    else
+	w->entry[e->prev].next = e->next;
+    if (e->next != NIL)
+	w->entry[e->next].prev = e->prev;
+    e->slot = NO_SLOT;
+    w->count--;
+}
+
+static int wheel_grow(acast_wheel_t* w, size_t i)
+{
+    wheel_entry_t* entry;
+    size_t n = w->num_entries ? w->num_entries : 8;
+    size_t j;
+
+    while(n <= i)
+	n <<= 1;
+    if ((entry = realloc(w->entry, n*sizeof(wheel_entry_t))) == NULL)
+	return -1;
+    for (j = w->num_entries; j < n; j++)
+	entry[j].slot = NO_SLOT;
+    w->entry = entry;
+    w->num_entries = n;
+    return 0;
+}
+
+int acast_wheel_set(acast_wheel_t* w, size_t i, tick_t tmo)
+{
+    uint64_t slot = (tmo + w->granularity - 1) / w->granularity;
+    wheel_entry_t* e;
+    int* hp;
+
+    if ((i >= w->num_entries) && (wheel_grow(w, i) < 0))
+	return -1;
+    e = &w->entry[i];
+    if (e->slot != NO_SLOT)
+	wheel_unlink(w, i);
+    if (slot < w->cur)
+	slot = w->cur;
+    hp = &w->head[slot & (w->num_slots-1)];
+    e->slot = slot;
+    e->prev = NIL;
+    e->next = *hp;
+    if (*hp != NIL)
+	w->entry[*hp].prev = i;
+    *hp = i;
+    w->count++;
+    return 0;
+}
+
+void acast_wheel_clear(acast_wheel_t* w, size_t i)
+{
+    if ((i < w->num_entries) && (w->entry[i].slot != NO_SLOT))
+	wheel_unlink(w, i);
+}
+
+void acast_wheel_move(acast_wheel_t* w, size_t from, size_t to)
+{
+    wheel_entry_t* e;
+
+    if ((from >= w->num_entries) || (w->entry[from].slot == NO_SLOT))
+	return;
+    if ((to >= w->num_entries) && (wheel_grow(w, to) < 0)) {
+	wheel_unlink(w, from);  // lose the timer rather than the list
+	return;
+    }
+    e = &w->entry[to];
+    *e = w->entry[from];
+    w->entry[from].slot = NO_SLOT;
+    if (e->prev == NIL)
+	w->head[e->slot & (w->num_slots-1)] = to;
+    else
+	w->entry[e->prev].next = to;
+    if (e->next != NIL)
+	w->entry[e->next].prev = to;
+}
+
+int acast_wheel_expired(acast_wheel_t* w, tick_t now)
+{
+    uint64_t end = now / w->granularity;  // last slot that ended
+
+    while(w->cur <= end) {
+	int i = w->head[w->cur & (w->num_slots-1)];
+
+	// later rounds stay in the slot
+	while((i != NIL) && (w->entry[i].slot > w->cur))
+	    i = w->entry[i].next;
+	if (i != NIL) {
+	    wheel_unlink(w, i);
+	    return i;
+	}
+	if ((w->count == 0) && (w->cur < end))
+	    w->cur = end;  // nothing to walk through
+	else
+	    w->cur++;
+    }
+    return -1;
+}
+
+size_t acast_wheel_count(acast_wheel_t* w)
+{
+    return w->count;
+}
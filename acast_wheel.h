@@ -0,0 +1,35 @@
+//
+//  Hashed timer wheel
+//
+//  Timers are numbered entries (client indices) linked into the slot
+//  of their expiry time. Setting or clearing a timer is constant time
+//  and expiring walks only the slots that passed, so the cost follows
+//  the number of expired timers as long as timeouts are shorter than
+//  the wheel span (num_slots*granularity).
+//
+#ifndef __ACAST_WHEEL_H__
+#define __ACAST_WHEEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tick.h"
+
+typedef struct _acast_wheel_t acast_wheel_t;
+
+// num_slots is rounded up to a power of two, timers expire up to
+// granularity late
+extern acast_wheel_t* acast_wheel_new(size_t num_slots, tick_t granularity,
+				      tick_t now);
+extern void acast_wheel_free(acast_wheel_t* w);
+// (re)start timer i to expire at tmo, return -1 if out of memory
+extern int acast_wheel_set(acast_wheel_t* w, size_t i, tick_t tmo);
+extern void acast_wheel_clear(acast_wheel_t* w, size_t i);
+// timer from is renumbered to, timer to must not be running
+extern void acast_wheel_move(acast_wheel_t* w, size_t from, size_t to);
+// stop and return an expired timer, or -1 when none expired before now
+extern int acast_wheel_expired(acast_wheel_t* w, tick_t now);
+// number of running timers
+extern size_t acast_wheel_count(acast_wheel_t* w);
+
+#endif
@@ -36,7 +36,8 @@ printf("usage: acast_player [options] file\n"
 "  -D, --debug     debug verbosity\n"
 "  -d, --device    playback device (\"%s\")\n"
 "  -c, --channels  number of output channels (%d)\n"
-"  -m, --map       channel map (\"%s\")\n",       
+"  -m, --map       channel map (\"%s\")\n"
+"                  dN is N in sample units, N/32768 for float formats\n",       
        PLAYBACK_DEVICE,
        NUM_CHANNELS,
        CHANNEL_MAP);       
@@ -160,7 +161,8 @@ int main(int argc, char** argv)
     iparam.format = af->param.format;
     iparam.sample_rate = af->param.sample_rate;
     iparam.channels_per_frame = num_output_channels;
-    acast_setup_param(handle, &iparam, &sparam, &snd_frames_per_packet);
+    acast_setup_param(handle, &iparam, &sparam, BYTES_PER_PACKET,
+		      &snd_frames_per_packet);
     snd_bytes_per_frame =
 	sparam.bytes_per_channel*sparam.channels_per_frame;
     
@@ -221,11 +223,20 @@ int main(int argc, char** argv)
 	case ACAST_MAP_OP:
 	    dst = (acast_t*) dst_buffer;
 	    dst->param = sparam;
-	    scatter_gather_ni(sparam.format,
-			      abuf.data, abuf.stride, abuf.size,
-			      dst->data, num_output_channels,
-			      chan_ctx.channel_op, chan_ctx.num_channel_ops,
-			      n);
+	    channel_prog_ni(sparam.format,
+			    abuf.data, abuf.stride, abuf.size,
+			    dst->data, num_output_channels,
+			    &chan_ctx.prog,
+			    n);
+	    break;
+	case ACAST_MAP_MATRIX:
+	    dst = (acast_t*) dst_buffer;
+	    dst->param = sparam;
+	    matrix_ni(sparam.format,
+		      abuf.data, abuf.stride, abuf.size,
+		      dst->data, num_output_channels,
+		      &chan_ctx.matrix,
+		      n);
 	    break;
 	default:
 	    fprintf(stderr, "bad ctx type %d\n", chan_ctx.type);
@@ -9,26 +9,52 @@
 #include <stdint.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "acast.h"
+#include "acast_client.h"
+#include "acast_group.h"
+#include "acast_wheel.h"
 #include "acast_file.h"
 #include "tick.h"
 #include "crc32.h"
 
-#define MAX_CLIENTS     9
+#define MAX_UCLIENTS    8    // -u clients, one channel each
+#define BUFFER_CLIENTS  9    // clients the socket buffers are sized for
 // ttl=0 local host, ttl=1 local network
 #define MULTICAST_TTL  1
 #define MULTICAST_LOOP 0
 #define NUM_CHANNELS   0
 #define CHANNEL_MAP   "auto"
+#define TXTIME_LEAD    0     // ms packets are queued ahead, 0 = busy wait
+#define TX_SCHED_SIZE  4096  // scheduled times kept for tx time stamps
+#define TX_SCHED_REPORT INT64_MIN  // sender report, not timed
 
 // client 0 is the default multicast client
-static int num_clients = 1;
-client_t client[MAX_CLIENTS];
+static acast_clients_t* clients;
+// subscription timeouts of unicast clients
+static acast_wheel_t* expiry;
+// clients with the same mapping share packets and mapped frames
+static acast_groups_t* groups;
+
+// packet of a stream group, sent to all its members
+typedef struct
+{
+    acast_t hdr;
+    uint8_t* data;
+    size_t len;
+    uint32_t trailer;        // payload crc
+    size_t trailer_len;
+} group_packet_t;
+// mapped frames in file format, set when the packet size is known
+static size_t client_buffer_size = 0;
+static size_t file_bytes_per_channel;
+static int frames_remain = 0;   // frames that remain from last round
 
 int verbose = 0;
 int debug = 0;
@@ -49,7 +75,12 @@ printf("usage: afile_sender [options] file\n"
 "  -l, --loop      enable multi cast loop (%d)\n"
 "  -t, --ttl       multicast ttl (%d)\n"
 "  -c, --channels  number of output channels (%d)\n"
-"  -m, --map       channel map (\"%s\")\n",       
+"  -m, --map       channel map (\"%s\")\n"
+"                  dN is N in sample units, N/32768 for float formats\n"
+"  -F, --netformat network sample format (file format)\n"
+"  -K, --crc       add crc32c checksum of audio data\n"
+"  -T, --txtime    kernel pacing (SO_TXTIME, fq qdisc), queue ms ahead (%d)\n"
+"  -P, --packet    packet size in bytes, \"mtu\" for the path mtu (%d)\n",
        MULTICAST_ADDR,
        INTERFACE_ADDR,
        MULTICAST_PORT,
@@ -57,7 +88,46 @@ printf("usage: afile_sender [options] file\n"
        MULTICAST_LOOP,       
        MULTICAST_TTL,
        NUM_CHANNELS,
-       CHANNEL_MAP);       
+       CHANNEL_MAP,
+       TXTIME_LEAD,
+       BYTES_PER_PACKET);
+}
+
+// deviation of send times from the packet schedule, in ns
+typedef struct
+{
+    uint64_t n;
+    double sum;
+    double sum2;
+    double max;        // max absolute deviation
+} send_jitter_t;
+
+static void jitter_add(send_jitter_t* j, double e)
+{
+    j->n++;
+    j->sum += e;
+    j->sum2 += e*e;
+    if (fabs(e) > j->max)
+	j->max = fabs(e);
+}
+
+static void jitter_print(FILE* f, char* mode, send_jitter_t* j,
+			 struct rusage* ru0, struct rusage* ru1, double td)
+{
+    double mean = 0, sd = 0;
+    double cpu;
+
+    if (j->n > 0) {
+	mean = j->sum / j->n;
+	sd = sqrt(fmax(0, j->sum2 / j->n - mean*mean));
+    }
+    cpu = (ru1->ru_utime.tv_sec - ru0->ru_utime.tv_sec)*1e6 +
+	(ru1->ru_utime.tv_usec - ru0->ru_utime.tv_usec) +
+	(ru1->ru_stime.tv_sec - ru0->ru_stime.tv_sec)*1e6 +
+	(ru1->ru_stime.tv_usec - ru0->ru_stime.tv_usec);
+    fprintf(f, "SEND %s jitter mean %.1fus sd %.1fus max %.1fus, "
+	    "cpu %.1f%%\n", mode, mean/1000, sd/1000, j->max/1000,
+	    (td > 0) ? 100*cpu/td : 0.0);
 }
 
 void set_client_mask(client_t* cp, uint32_t mask)
@@ -79,53 +149,130 @@ void set_client_mask(client_t* cp, uint32_t mask)
     cp->chan_ctx.type = ACAST_MAP_PERMUTE;
     cp->chan_ctx.num_channel_ops = j;
     cp->num_output_channels = j;
+    compile_channel_ctx(&cp->chan_ctx);
 }
 
-// fixme store compare struct sockaddr ?
+// a new buffer starts with the frames that remain in the other groups
+// as silence, so the group sends the same frames from the same seqno
+int client_alloc_buffer(client_t* cp)
+{
+    size_t len;
+
+    if ((cp->buffer != NULL) || (client_buffer_size == 0))
+	return 0;
+    if ((cp->buffer = malloc(client_buffer_size)) == NULL)
+	return -1;
+    len = frames_remain*cp->num_output_channels*file_bytes_per_channel;
+    memset(cp->buffer, 0, len);
+    cp->ptr = cp->buffer + len;
+    return 0;
+}
+
+// remove cp from its group, the last member releases the group
+void client_leave_group(client_t* cp)
+{
+    int g = cp->group;
+
+    if (acast_groups_leave(groups, cp)) {
+	client_t* gp = &acast_groups_array(groups)[g];
+	free(gp->buffer);
+	gp->buffer = NULL;
+    }
+}
+
+// set the channel mask of cp and move it to the group with its
+// mapping, a new group gets its buffer. return the group or -1
+int client_set_group(client_t* cp, uint32_t mask)
+{
+    int g;
+
+    client_leave_group(cp);
+    set_client_mask(cp, mask);
+    if ((g = acast_groups_join(groups, cp)) < 0)
+	return -1;
+    if (client_alloc_buffer(&acast_groups_array(groups)[g]) < 0) {
+	client_leave_group(cp);
+	return -1;
+    }
+    return g;
+}
+
+// add a client or refresh its subscription, a client added with
+// timeout 0 never expires
 int client_add(uint32_t id,struct sockaddr_in* addr,socklen_t addrlen,
-	       uint32_t mask)
+	       uint32_t mask, tick_t timeout)
 {
+    client_t* cp;
     int i;
-    for (i = 0; i < num_clients; i++) {
-	// maybe compare components?
-	if ((client[i].id && (client[i].id == id)) ||
-	    ((client[i].id == 0) && (id == 0) &&
-	     (memcmp(&client[i].addr, &addr, addrlen) == 0))) {
-	    int updated = 0;
-	    client[i].tmo = time_tick_now() + CLIENT_TIMEOUT;
-	    if (mask != client[i].mask) {
-		set_client_mask(&client[i], mask);
-		updated = 1;
-	    }
-	    if (memcmp(&client[i].addr, &addr, addrlen) != 0) {
-		client[i].addr = *addr;
-		updated = 1;
-	    }
-	    if (updated && verbose) {
-		fprintf(stderr, "unicast client [%d] id=%d %s:%d updated\n",
-			i, client[i].id,
-			inet_ntoa(addr->sin_addr),
-			ntohs(addr->sin_port));
-	    }
-	    return 0;
+
+    if ((i = acast_clients_find(clients, id, addr)) >= 0) {
+	int updated = 0;
+	cp = &acast_clients_array(clients)[i];
+	if (cp->tmo && timeout) {
+	    cp->tmo = time_tick_now() + timeout;
+	    acast_wheel_set(expiry, i, cp->tmo);
+	}
+	if (mask != cp->mask) {
+	    client_set_group(cp, mask);
+	    updated = 1;
+	}
+	if (memcmp(&cp->addr, addr, addrlen) != 0) {
+	    cp->addr = *addr;
+	    updated = 1;
+	}
+	if (updated && verbose) {
+	    fprintf(stderr, "unicast client [%d] id=%d %s:%d updated\n",
+		    i, cp->id,
+		    inet_ntoa(addr->sin_addr),
+		    ntohs(addr->sin_port));
+	}
+	return 0;
+    }
+    if ((i = acast_clients_add(clients, id, addr, addrlen)) < 0)
+	return -1;
+    cp = &acast_clients_array(clients)[i];
+    if (client_set_group(cp, mask) < 0) {
+	acast_clients_remove(clients, i);
+	return -1;
+    }
+    if (timeout) {
+	cp->tmo = time_tick_now() + timeout;
+	if (acast_wheel_set(expiry, i, cp->tmo) < 0) {
+	    client_leave_group(cp);
+	    acast_clients_remove(clients, i);
+	    return -1;
 	}
     }
-    if (num_clients < MAX_CLIENTS) {
-	i = num_clients++;
-	client[i].id   = id;
-	client[i].addr = *addr;
-	client[i].addrlen = addrlen;
-	client[i].tmo = time_tick_now() + CLIENT_TIMEOUT;
-	client[i].ptr = client[i].buffer;	
-	set_client_mask(&client[i], mask);
+
+    if (verbose) {
+	fprintf(stderr, "unicast client[%d] id=%d %s:%d added\n",
+		i, id, inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+    }
+    return 0;
+}
+
+// remove unicast clients whose subscription was not refreshed in
+// time, return the number of clients removed
+size_t client_expire(tick_t now)
+{
+    size_t n = 0;
+    int i;
+
+    while((i = acast_wheel_expired(expiry, now)) >= 0) {
+	client_t* cp = &acast_clients_array(clients)[i];
+	int moved;
 
 	if (verbose) {
-	    fprintf(stderr, "unicast client[%d] id=%d %s:%d added\n",
-		    i, id, inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+	    fprintf(stderr, "unicast client[%d] id=%d %s:%d expired\n",
+		    i, cp->id, inet_ntoa(cp->addr.sin_addr),
+		    ntohs(cp->addr.sin_port));
 	}
-	return 0;
+	client_leave_group(cp);
+	if ((moved = acast_clients_remove(clients, i)) >= 0)
+	    acast_wheel_move(expiry, moved, i);
+	n++;
     }
-    return -1;
+    return n;
 }
 
 // parse client list -u <ip>:<port> -u <ip>:<port> ...
@@ -155,7 +302,7 @@ int parse_clients(char** uclient, size_t num_uclients, uint16_t default_port)
 	uaddr.sin_family = AF_INET;
 	uaddr.sin_port = htons(uport);
 	// fixme, make channels flexibel
-	if (client_add(0, &uaddr, uaddrlen, (1<<i)) < 0)
+	if (client_add(0, &uaddr, uaddrlen, (1<<i), 0) < 0)
 	    return -1;
     }
     return 0;
@@ -165,6 +312,7 @@ int main(int argc, char** argv)
 {
     char* filename;
     acast_params_t mparam;
+    acast_params_t pparam;     // sizes packets for the widest group
     snd_pcm_uframes_t af_frames_per_packet;    
     snd_pcm_uframes_t frames_per_packet;    
     uint32_t seqno = 0;
@@ -179,11 +327,15 @@ int main(int argc, char** argv)
     socklen_t addrlen;    
     struct sockaddr_in iaddr;
     socklen_t iaddrlen;    
-    uint8_t src_buffer[BYTES_PER_BUFFER];
-    int frames_remain;
+    uint8_t* src_buffer;       // frames read from file
+    size_t src_buffer_size;
     int num_frames;
+    int i;
     char* map = CHANNEL_MAP;
-    size_t network_bufsize = 4*BYTES_PER_PACKET;
+    size_t network_bufsize;
+    size_t packet_size = BYTES_PER_PACKET;
+    size_t payload_size;      // packet_size less the crc trailer
+    int probe_mtu = 0;
     tick_t report_time;
     int first_frame = 1;
     tick_t send_time = 0;
@@ -193,8 +345,50 @@ int main(int argc, char** argv)
     acast_file_t* af;
     acast_buffer_t abuf;
     size_t num_uclients = 0;
-    char* uclient[MAX_CLIENTS];
+    char* uclient[MAX_UCLIENTS];
     int client_mode = CLIENT_MODE_MIXED;
+    snd_pcm_format_t net_format = SND_PCM_FORMAT_UNKNOWN;
+    acast_convert_t conv;
+    snd_pcm_uframes_t read_frames;  // max frames from one file read
+    size_t max_channels;
+    size_t slot_size;                // converted frames per client
+    int payload_crc = 0;
+    client_t* client;                 // the registry array
+    client_t* group;                  // stream per group
+    size_t ngroups;
+    size_t max_clients = 0;           // clients the batch fits
+    size_t max_groups = 0;            // groups the buffers below fit
+    group_packet_t* gpkt = NULL;      // packet per group
+    uint8_t* packet_data = NULL;      // converted frames per group
+    acast_batch_t* batch = NULL;
+    int* item = NULL;                 // batch index of report and packet
+    uint64_t send_errors = 0;
+    uint64_t expired_clients = 0;
+    int txtime_lead = TXTIME_LEAD;   // ms, > 0 kernel paced
+    uint64_t tx_start = 0;     // departure of first packet (monotonic ns)
+    uint64_t tx_time = 0;      // departure of current packet
+    uint64_t tx_packets = 0;   // packets scheduled
+    int tx_stamps = 0;         // transmit time stamps are read
+    int64_t clock_offset = 0;  // CLOCK_REALTIME - schedule clock in ns
+    int64_t sched = 0;         // scheduled send time in ns
+    static int64_t tx_sched[TX_SCHED_SIZE]; // scheduled time per message
+    uint32_t tx_id = 0;        // number of messages sent
+    uint64_t media_time = 0;   // frames sent before this packet
+    acast_sr_t sr;             // sender report
+    tick_t sr_time = 0;
+    int sr_due = 0;
+    send_jitter_t jitter;
+    struct rusage report_usage;
+
+    if ((clients = acast_clients_new(1, ACAST_MAX_CLIENTS)) == NULL) {
+	fprintf(stderr, "unable to allocate clients\n");
+	exit(1);
+    }
+    client = acast_clients_array(clients);
+    if ((groups = acast_groups_new()) == NULL) {
+	fprintf(stderr, "unable to allocate groups\n");
+	exit(1);
+    }
 
     while(1) {
 	int option_index = 0;
@@ -214,10 +408,14 @@ int main(int argc, char** argv)
 	    {"map",     required_argument, 0, 'm'},
 	    {"unicast", no_argument,       0, 'U'},
 	    {"multicast", no_argument,     0, 'M'},	    
+	    {"netformat", required_argument, 0, 'F'},
+	    {"crc",     no_argument,       0, 'K'},
+	    {"txtime",  required_argument, 0, 'T'},
+	    {"packet",  required_argument, 0, 'P'},
 	    {0,        0,                 0, 0}
 	};
 	
-	c = getopt_long(argc, argv, "lhvDUMa:u:i:p:t:c:m:",
+	c = getopt_long(argc, argv, "lhvDUMKa:u:i:p:t:c:m:F:T:P:",
                         long_options, &option_index);
 	if (c == -1)
 	    break;
@@ -252,9 +450,10 @@ int main(int argc, char** argv)
 	    interface_addr = strdup(optarg);
 	    break;
 	case 'u':
-	    if (num_uclients >= MAX_CLIENTS-1) {
+	    if (num_uclients >= MAX_UCLIENTS) {
 		fprintf(stderr, "too many clients max %d\n",
-			MAX_CLIENTS-1);
+			MAX_UCLIENTS);
+		exit(1);
 	    }
 	    uclient[num_uclients++] = strdup(optarg);
 	    break;	    
@@ -278,6 +477,36 @@ int main(int argc, char** argv)
 	case 'm':
 	    map = strdup(optarg);
 	    break;
+	case 'F':
+	    net_format = snd_pcm_format_value(optarg);
+	    if (net_format == SND_PCM_FORMAT_UNKNOWN) {
+		fprintf(stderr, "unknown format %s\n", optarg);
+		exit(1);
+	    }
+	    break;
+	case 'K':
+	    payload_crc = 1;
+	    break;
+	case 'P':
+	    if (strcmp(optarg, "mtu") == 0) {
+		probe_mtu = 1;
+		break;
+	    }
+	    packet_size = atoi(optarg);
+	    if ((packet_size < MIN_PACKET_SIZE) ||
+		(packet_size > MAX_PACKET_SIZE)) {
+		fprintf(stderr, "packet size out of range %d..%d\n",
+			MIN_PACKET_SIZE, MAX_PACKET_SIZE);
+		exit(1);
+	    }
+	    break;
+	case 'T':
+	    txtime_lead = atoi(optarg);
+	    if ((txtime_lead < 0) || (txtime_lead > 1000)) {
+		fprintf(stderr, "txtime out of range\n");
+		exit(1);
+	    }
+	    break;
 	default:
 	    help();
 	    exit(1);
@@ -289,9 +518,31 @@ int main(int argc, char** argv)
 	exit(1);
     }
 
-    parse_clients(uclient, num_uclients, multicast_port);    
+    // unicast clients are not sent to in multicast mode
+    if (client_mode != CLIENT_MODE_MULTICAST)
+	parse_clients(uclient, num_uclients, multicast_port);
+    client = acast_clients_array(clients);
+
+    if (probe_mtu) {
+	size_t size = acast_probe_packet_size(multicast_addr, interface_addr,
+					      multicast_port);
+	if (size < MIN_PACKET_SIZE)
+	    fprintf(stderr, "path mtu unknown, packet size %zu\n",
+		    packet_size);
+	else
+	    packet_size = size;
+    }
+    if (verbose)
+	fprintf(stderr, "packet size %zu\n", packet_size);
+    payload_size = packet_size - (payload_crc ? PAYLOAD_CRC_SIZE : 0);
+    network_bufsize = 4*BUFFER_CLIENTS*packet_size;
 
     time_tick_init();    
+    if ((expiry = acast_wheel_new(CLIENT_EXPIRY_SLOTS, CLIENT_EXPIRY_TICK,
+				  time_tick_now())) == NULL) {
+	fprintf(stderr, "unable to allocate client timers\n");
+	exit(1);
+    }
     
     filename = argv[optind];
     if ((af = acast_file_open(filename, O_RDONLY)) == NULL) {
@@ -301,7 +552,7 @@ int main(int argc, char** argv)
     }
 
     af_frames_per_packet =
-	acast_file_frames_per_buffer(af,BYTES_PER_PACKET-sizeof(acast_t));    
+	acast_file_frames_per_buffer(af, packet_size-sizeof(acast_t));
 
     if (verbose > 1) {
 	acast_file_print(af, stderr);
@@ -320,28 +571,44 @@ int main(int argc, char** argv)
 	print_channel_ctx(stdout, &client[0].chan_ctx);
 	printf("num_output_channels = %d\n", client[0].num_output_channels);
     }    
+    if ((client_mode != CLIENT_MODE_UNICAST) &&
+	(acast_groups_join(groups, &client[0]) < 0)) {
+	fprintf(stderr, "unable to allocate groups\n");
+	exit(1);
+    }
 
     if (af->param.format == SND_PCM_FORMAT_UNKNOWN) {
 	fprintf(stderr, "unsupport audio format\n");
 	exit(1);
     }
     
+    // room for the packets queued ahead, up to 4 per ms and client
+    if (txtime_lead > 0)
+	network_bufsize += 4*txtime_lead*BUFFER_CLIENTS*packet_size;
+
     if ((sock = acast_sender_open(multicast_addr,
 				  interface_addr,
 				  multicast_port,
 				  multicast_ttl,
 				  multicast_loop,
 				  &addr, &addrlen,
-				  network_bufsize)) < 0) {
+				  network_bufsize, NULL)) < 0) {
 	fprintf(stderr, "unable to open multicast socket %s\n",
 		strerror(errno));
 	exit(1);
     }
     
+    if ((txtime_lead > 0) && (acast_set_txtime(sock) < 0)) {
+	fprintf(stderr, "SO_TXTIME not supported %s, busy wait pacing\n",
+		strerror(errno));
+	txtime_lead = 0;
+    }
+    if (verbose > 1)
+	tx_stamps = (acast_set_tx_timestamps(sock) == 0);
+
     client[0].addr = addr;
     client[0].addrlen = addrlen;
     client[0].tmo = 0;
-    client[0].ptr = client[0].buffer;
     
     if (client_mode == CLIENT_MODE_MULTICAST)
 	ctrl = -1;
@@ -377,10 +644,68 @@ int main(int argc, char** argv)
 	}
     }
     
+    // frames are mapped in file format, and converted to net_format
+    // when packets are built
+    if (net_format == SND_PCM_FORMAT_UNKNOWN)
+	net_format = af->param.format;
+    if (acast_convert_setup(&conv, af->param.format, net_format) < 0) {
+	fprintf(stderr, "unable to convert %s to %s\n",
+		snd_pcm_format_name(af->param.format),
+		snd_pcm_format_name(net_format));
+	exit(1);
+    }
+    file_bytes_per_channel = af->param.bytes_per_channel;
+
     mparam = af->param;
+    mparam.format = net_format;
+    mparam.bits_per_channel = snd_pcm_format_width(net_format);
+    mparam.bytes_per_channel = snd_pcm_format_physical_width(net_format)/8;
     mparam.channels_per_frame = client[0].num_output_channels;
-    frames_per_packet = acast_get_frames_per_packet(&mparam);
+    // every group sends the same frames per packet, so size packets
+    // for the widest group, unicast clients may ask for up to
+    // MAX_CHANNEL_MAP channels
+    pparam = mparam;
+    if ((client_mode != CLIENT_MODE_MULTICAST) &&
+	(pparam.channels_per_frame < MAX_CHANNEL_MAP))
+	pparam.channels_per_frame = MAX_CHANNEL_MAP;
+    frames_per_packet = acast_get_frames_per_packet(&pparam, payload_size);
+
+    // a read gives up to frames_per_packet frames, mp3 decodes a whole
+    // frame. group buffers keep the frames left over from the last
+    // read plus the next read in file format
+    read_frames = (frames_per_packet > PCM_BUFFER_SIZE) ?
+	frames_per_packet : PCM_BUFFER_SIZE;
+    max_channels = MAX_CHANNEL_MAP;  // unicast clients
+    if (client[0].num_output_channels > max_channels)
+	max_channels = client[0].num_output_channels;
+    if (af->param.channels_per_frame > max_channels)
+	max_channels = af->param.channels_per_frame;
+    client_buffer_size = (frames_per_packet + read_frames)*
+	max_channels*file_bytes_per_channel;
+    group = acast_groups_array(groups);
+    for (i = 0; i < acast_groups_count(groups); i++) {
+	if (client_alloc_buffer(&group[i]) < 0) {
+	    fprintf(stderr, "unable to allocate client buffers\n");
+	    exit(1);
+	}
+    }
+    src_buffer_size = sizeof(acast_t) + read_frames*max_channels*
+	file_bytes_per_channel;
+    if (src_buffer_size < BYTES_PER_BUFFER)
+	src_buffer_size = BYTES_PER_BUFFER;
+    slot_size = frames_per_packet*max_channels*mparam.bytes_per_channel;
+    src_buffer = malloc(src_buffer_size);
+    if (!src_buffer) {
+	fprintf(stderr, "unable to allocate packet buffers\n");
+	exit(1);
+    }
     frame_delay_us = (frames_per_packet*1000000) / mparam.sample_rate;
+    // send times are scheduled on the monotonic clock with txtime and
+    // on time_tick_now otherwise, tx time stamps use the real time clock
+    if (txtime_lead > 0)
+	clock_offset = time_wall_usec()*1000 - time_mono_nsec();
+    else
+	clock_offset = (time_wall_usec() - time_tick_now())*1000;
     
     if (verbose > 1) {
 	acast_print_params(stderr, &mparam);
@@ -390,12 +715,15 @@ int main(int argc, char** argv)
     frames_remain = 0;  // samples that remain from last round
     
     report_time = time_tick_now();
+    getrusage(RUSAGE_SELF, &report_usage);
+    memset(&jitter, 0, sizeof(jitter));
     
     while((num_frames = acast_file_read(af, &abuf, src_buffer,
-					BYTES_PER_BUFFER-sizeof(acast_t),
+					src_buffer_size-sizeof(acast_t),
 					frames_per_packet)) > 0) {
 	int cstart=0, cnum=0;
 	int i=0;
+	size_t g;
 	
 	if (ctrl >= 0) {  // client_mode != CLIENT_MODE_UNICAST
 	    int r;
@@ -424,117 +752,236 @@ int main(int argc, char** argv)
 		ctl->crc = 0;
 		if ((ctl->magic == CONTROL_MAGIC) &&
 		    crc32((uint8_t*) ctl, sizeof(actl_t)) == crc) {
-		    client_add(ctl->id, &addr, addrlen, ctl->mask);
+		    client_add(ctl->id, &addr, addrlen, ctl->mask,
+			       CLIENT_TIMEOUT);
 		}
 	    }
 	}
+	expired_clients += client_expire(time_tick_now());
+	client = acast_clients_array(clients);
+	group = acast_groups_array(groups);
+	ngroups = acast_groups_count(groups);
+
+	// packet buffers are sized as the groups, the send batch as
+	// the registry
+	if ((max_clients != acast_clients_capacity(clients)) ||
+	    (max_groups != acast_groups_capacity(groups))) {
+	    max_clients = acast_clients_capacity(clients);
+	    max_groups = acast_groups_capacity(groups);
+	    free(gpkt);
+	    free(packet_data);
+	    free(item);
+	    if (batch != NULL)
+		acast_batch_free(batch);
+	    gpkt = malloc(max_groups*sizeof(group_packet_t));
+	    packet_data = malloc(max_groups*slot_size);
+	    item = malloc(2*max_clients*sizeof(int));
+	    // a packet and a sender report per client
+	    batch = acast_batch_new(2*max_clients, 1);
+	    if (!gpkt || !packet_data || !item || !batch) {
+		fprintf(stderr, "unable to allocate client buffers\n");
+		exit(1);
+	    }
+	    // a batch per packet time plus the packets queued ahead, up
+	    // to 4 per ms and client
+	    network_bufsize = (4 + 4*txtime_lead)*max_clients*packet_size;
+	    if ((acast_set_sndbuf(sock, network_bufsize) <
+		 (int) network_bufsize) && verbose)
+		fprintf(stderr, "send buffer below %zu bytes for %zu clients, "
+			"raise net.core.wmem_max\n",
+			network_bufsize, max_clients);
+	}
 
 	switch(client_mode) {
 	case CLIENT_MODE_UNICAST:
-	    cstart = 1; cnum = num_clients;
+	    cstart = 1; cnum = acast_clients_count(clients);
 	    break;
 	case CLIENT_MODE_MULTICAST:
 	    cstart = 0; cnum = 1;
 	    break;
 	case CLIENT_MODE_MIXED:
-	    cstart = 0; cnum = num_clients;
+	    cstart = 0; cnum = acast_clients_count(clients);
 	    break;
 	default:
 	    break;
 	}
 
-	for (i = cstart; i < cnum; i++) {
-	    // convert all frames for all clients
-	    switch(client[i].chan_ctx.type) {
-	    case ACAST_MAP_ID:
-	    case ACAST_MAP_PERMUTE:
-		permute_ni(mparam.format,
-			   abuf.data, abuf.stride, abuf.size,
-			   client[i].ptr, client[i].num_output_channels,
-			   client[i].chan_ctx.channel_map,
-			   num_frames);
-		break;
-	    case ACAST_MAP_OP:
-		scatter_gather_ni(mparam.format,
-				  abuf.data, abuf.stride, abuf.size,
-				  client[i].ptr, client[i].num_output_channels,
-				  client[i].chan_ctx.channel_op,
-				  client[i].chan_ctx.num_channel_ops,
-				  num_frames);
-		break;
-	    default:
-		fprintf(stderr, "bad ctx type %d\n", client[i].chan_ctx.type);
-		exit(1);	
-	    }
-	    client[i].ptr = client[i].buffer;
-	}
+	// convert all frames once per group in one pass, groups without
+	// members have ptr == NULL
+	fanout_ni(af->param.format,
+		  abuf.data, abuf.stride, abuf.size,
+		  group, ngroups,
+		  num_frames);
+	for (g = 0; g < ngroups; g++)
+	    if (acast_groups_members(groups, g) > 0)
+		group[g].ptr = group[g].buffer;
 	
 	num_frames += frames_remain;
 
 	while(num_frames >= frames_per_packet) {
-	    uint8_t packet_buffer[BYTES_PER_PACKET];
-	    acast_t* packet;
-	    size_t  bytes_to_send;
-
-	    packet = (acast_t*) packet_buffer;
-	    packet->magic = ACAST_MAGIC;
-	    packet->param = mparam;
-	    packet->seqno = seqno++;
-	    packet->num_frames = frames_per_packet;
-
-	    for (i = cstart; i < cnum; i++) {
-		int num_channels = client[i].num_output_channels;
+	    acast_batch_reset(batch);
+	    if (first_frame) {
+		send_time = time_tick_now();
+		tx_start = time_mono_nsec() + txtime_lead*1000000ULL;
+		first_frame = 0;
+	    }
+	    if (txtime_lead > 0) {
+		// sleep until lead ms before departure, then queue the
+		// packets for the qdisc to release on time
+		tx_time = tx_start + (tx_packets*frames_per_packet*
+				      1000000000ULL) / mparam.sample_rate;
+		time_mono_sleep_until(tx_time - txtime_lead*1000000ULL);
+		acast_batch_set_txtime(batch, tx_time);
+		tx_packets++;
+		sched = tx_time;
+	    }
+	    else
+		sched = send_time*1000;
+	    // report when the first frame of this packet is sent
+	    sr_due = 0;
+	    if ((time_tick_now() - sr_time) >= ACAST_SR_INTERVAL) {
+		sr.magic = ACAST_MAGIC_SR;
+		sr.seqno = seqno;
+		sr.timestamp = media_time;
+		sr.wallclock = (sched + clock_offset) / 1000;
+		sr.sample_rate = mparam.sample_rate;
+		sr.crc = 0;
+		sr.crc = crc32((uint8_t*) &sr, sizeof(acast_sr_t));
+		sr_time = time_tick_now();
+		sr_due = 1;
+	    }
+	    // one packet per group, sent to each member
+	    for (g = 0; g < ngroups; g++) {
+		group_packet_t* gp = &gpkt[g];
+		acast_t* packet = &gp->hdr;
+		int num_channels = group[g].num_output_channels;
 		size_t bytes_per_frame = num_channels*mparam.bytes_per_channel;
+
+		if (acast_groups_members(groups, g) == 0)
+		    continue;
+		packet->param = mparam;
+		packet->seqno = seqno;
+		packet->num_frames = frames_per_packet;
 		packet->param.channels_per_frame = num_channels;
-		bytes_to_send = frames_per_packet*bytes_per_frame;
-		
-		memcpy(packet->data, client[i].ptr, bytes_to_send);
-		client[i].ptr += bytes_to_send;
+		gp->len = frames_per_packet*bytes_per_frame;
+
+		// send mapped frames directly unless they must be converted
+		if (conv.convert == NULL)
+		    gp->data = group[g].ptr;
+		else {
+		    gp->data = packet_data + g*slot_size;
+		    acast_convert(&conv, group[g].ptr, gp->data,
+				  frames_per_packet*num_channels);
+		}
+		group[g].ptr += frames_per_packet*num_channels*
+		    file_bytes_per_channel;
 	    
 		if ((verbose > 3) && (seqno % 100 == 0)) {
-		    acast_print(stderr, packet);
+		    fprintf(stderr, "seqno: %u\n", packet->seqno);
+		    acast_print_params(stderr, &packet->param);
 		}
+		gp->trailer_len = acast_set_payload_crc(packet, gp->data,
+							gp->len, payload_crc,
+							&gp->trailer);
 		packet->crc = 0;
 		packet->crc = crc32((uint8_t*)packet,sizeof(acast_t));
-
-		// fixme send using sendmsg! keep packet header separate
-		if (sendto(sock,(void*)packet,sizeof(acast_t)+bytes_to_send, 0,
-			   (struct sockaddr *) &client[i].addr,
-			   client[i].addrlen) < 0) {
-		    fprintf(stderr, "failed to send frame %s\n",
-			    strerror(errno));
+	    }
+	    for (i = cstart; i < cnum; i++) {
+		group_packet_t* gp = &gpkt[client[i].group];
+
+		// the report goes ahead of the packet it refers to
+		item[2*i] = -1;
+		if (sr_due)
+		    item[2*i] = acast_batch_add(batch, &client[i].addr,
+						client[i].addrlen,
+						&sr, sizeof(acast_sr_t),
+						NULL, 0, NULL, 0);
+		item[2*i+1] = acast_batch_add(batch,
+					      &client[i].addr, client[i].addrlen,
+					      &gp->hdr, sizeof(acast_t),
+					      gp->data, gp->len,
+					      &gp->trailer, gp->trailer_len);
+		sent_frames += frames_per_packet;
+		sent_bytes += gp->len;
+	    }
+	    seqno++;
+	    media_time += frames_per_packet;
+	    acast_batch_send(batch, sock);
+	    // every datagram sent takes a time stamp id, in send order
+	    for (i = cstart; i < cnum; i++) {
+		int err;
+		if ((item[2*i] >= 0) &&
+		    (acast_batch_error(batch, item[2*i]) == 0))
+		    tx_sched[tx_id++ % TX_SCHED_SIZE] = TX_SCHED_REPORT;
+		err = acast_batch_error(batch, item[2*i+1]);
+		if (err == 0) {
+		    tx_sched[tx_id++ % TX_SCHED_SIZE] = sched;
+		    continue;
 		}
-		if (first_frame) {
-		    send_time = time_tick_now();
-		    first_frame = 0;
+		send_errors++;
+		fprintf(stderr, "failed to send frame to %s:%d %s\n",
+			inet_ntoa(client[i].addr.sin_addr),
+			ntohs(client[i].addr.sin_port),
+			strerror(err));
+	    }
+	    if (tx_stamps) {
+		uint32_t id;
+		uint64_t t;
+		while(acast_read_tx_timestamp(sock, &id, &t) > 0) {
+		    if (((uint32_t)(tx_id - id - 1) < TX_SCHED_SIZE) &&
+			(tx_sched[id % TX_SCHED_SIZE] != TX_SCHED_REPORT))
+			jitter_add(&jitter, (double)((int64_t)(t - clock_offset)
+					     - tx_sched[id % TX_SCHED_SIZE]));
 		}
-		sent_frames += frames_per_packet;
-		sent_bytes += bytes_to_send;
 	    }
+	    else if (txtime_lead > 0)  // wakeup time
+		jitter_add(&jitter, (double)(time_mono_nsec() - tx_time) +
+			   txtime_lead*1000000.0);
+	    else
+		jitter_add(&jitter, (time_tick_now() - send_time)*1000.0);
 
 	    if (sent_frames >= 100000) {
 		if (verbose > 1) {
 		    tick_t now = time_tick_now();
 		    double td = (now - report_time);
-		    fprintf(stderr, "SEND RATE = %.2fKHz, %.2fMb/s\n",
+		    struct rusage usage;
+		    fprintf(stderr, "SEND RATE = %.2fKHz, %.2fMb/s, %lu errors\n",
 			    (1000*sent_frames)/td,
-			    ((1000000*sent_bytes)/td)/(double)(1024*1024));
+			    ((1000000*sent_bytes)/td)/(double)(1024*1024),
+			    (unsigned long) send_errors);
+		    fprintf(stderr, "CLIENTS = %zu, %zu groups, %zu timers, "
+			    "%lu expired\n",
+			    acast_clients_count(clients),
+			    acast_groups_used(groups),
+			    acast_wheel_count(expiry),
+			    (unsigned long) expired_clients);
+		    getrusage(RUSAGE_SELF, &usage);
+		    jitter_print(stderr, (txtime_lead > 0) ?
+				 (tx_stamps ? "txtime/tx" : "txtime/wakeup") :
+				 (tx_stamps ? "busy/tx" : "busy/wakeup"),
+				 &jitter, &report_usage, &usage, td);
 		    report_time = now;
+		    report_usage = usage;
+		    memset(&jitter, 0, sizeof(jitter));
 		}
 		sent_frames = 0;
 		sent_bytes = 0;
 	    }
-	    time_tick_wait_until(send_time + frame_delay_us);
-	    // send_time is the absolute send time mark
-	    send_time += frame_delay_us;
+	    if (txtime_lead == 0) {
+		time_tick_wait_until(send_time + frame_delay_us);
+		// send_time is the absolute send time mark
+		send_time += frame_delay_us;
+	    }
 	    num_frames -= frames_per_packet;
 	}
 
-	for (i = cstart; i < cnum; i++) {
-	    int num_channels = client[i].num_output_channels;
-	    size_t bytes_per_frame = num_channels*mparam.bytes_per_channel;
-	    memcpy(client[i].buffer, client[i].ptr, num_frames*bytes_per_frame);
-	    client[i].ptr = client[i].buffer + num_frames*bytes_per_frame;
+	for (g = 0; g < ngroups; g++) {
+	    int num_channels = group[g].num_output_channels;
+	    size_t bytes_per_frame = num_channels*file_bytes_per_channel;
+	    if (acast_groups_members(groups, g) == 0)
+		continue;
+	    memcpy(group[g].buffer, group[g].ptr, num_frames*bytes_per_frame);
+	    group[g].ptr = group[g].buffer + num_frames*bytes_per_frame;
 	}
 	frames_remain = num_frames;
     }
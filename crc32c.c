@@ -0,0 +1,250 @@
+//
+//  CRC32C (Castagnoli) used for packet payload checksums
+//
+//  The SSE4.2 crc32 instruction is used when available, long buffers
+//  are split into three streams that are combined with PCLMUL. Other
+//  cpus use a slicing-by-8 table loop.
+//
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32c.h"
+#include "acast_simd.h"
+
+#if defined(__x86_64__)
+#define CRC32C_X86
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY  0x82F63B78   // 0x1EDC6F41 reflected
+#define CRC32C_INIT  0xFFFFFFFF
+#define CRC32C_FINAL 0xFFFFFFFF
+
+#define CRC32C_LONG  2048   // stream length for long buffers
+#define CRC32C_SHORT 128    // stream length for short buffers
+
+static uint32_t crc32c_table[8][256];
+static int      crc32c_tables = 0;
+
+#define CRC32C_HW_NONE   0
+#define CRC32C_HW_SSE42  1  // crc32 instruction
+#define CRC32C_HW_PCLMUL 2  // crc32 and pclmulqdq
+
+static int crc32c_hw = -1;
+
+// shift constants for CRC32C_LONG and CRC32C_SHORT streams
+static uint64_t crc32c_klong[2];
+static uint64_t crc32c_kshort[2];
+
+// multiply a and b modulo the polynomial (reflected)
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t p = 0;
+
+    while(1) {
+	if (a & m) {
+	    p ^= b;
+	    if ((a & (m - 1)) == 0)
+		break;
+	}
+	m >>= 1;
+	b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : (b >> 1);
+    }
+    return p;
+}
+
+// x^n modulo the polynomial (reflected)
+static uint32_t xnmodp(uint64_t n)
+{
+    uint32_t p = (uint32_t)1 << 31;   // x^0
+    uint32_t x2n = (uint32_t)1 << 30; // x^1
+
+    while(n) {
+	if (n & 1)
+	    p = multmodp(x2n, p);
+	x2n = multmodp(x2n, x2n);
+	n >>= 1;
+    }
+    return p;
+}
+
+static void crc32c_init_tables(void)
+{
+    int i, j;
+
+    if (crc32c_tables)
+	return;
+    for (i = 0; i < 256; i++) {
+	uint32_t crc = i;
+	for (j = 0; j < 8; j++)
+	    crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : (crc >> 1);
+	crc32c_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+	uint32_t crc = crc32c_table[0][i];
+	for (j = 1; j < 8; j++) {
+	    crc = (crc >> 8) ^ crc32c_table[0][crc & 0xff];
+	    crc32c_table[j][i] = crc;
+	}
+    }
+    // clmul(crc, k) followed by a crc32 of the 64 bit product shift
+    // the crc over n zero bytes when k = x^(8n-33)
+    crc32c_klong[0]  = xnmodp(8*2*CRC32C_LONG - 33);
+    crc32c_klong[1]  = xnmodp(8*CRC32C_LONG - 33);
+    crc32c_kshort[0] = xnmodp(8*2*CRC32C_SHORT - 33);
+    crc32c_kshort[1] = xnmodp(8*CRC32C_SHORT - 33);
+    crc32c_tables = 1;
+}
+
+static uint32_t crc32c_update_sw(uint32_t crc, uint8_t* ptr, size_t len)
+{
+    while(len >= 8) {
+	uint32_t lo = crc ^ (ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) |
+			     ((uint32_t)ptr[3] << 24));
+	crc = crc32c_table[7][lo & 0xff] ^
+	    crc32c_table[6][(lo >> 8) & 0xff] ^
+	    crc32c_table[5][(lo >> 16) & 0xff] ^
+	    crc32c_table[4][lo >> 24] ^
+	    crc32c_table[3][ptr[4]] ^
+	    crc32c_table[2][ptr[5]] ^
+	    crc32c_table[1][ptr[6]] ^
+	    crc32c_table[0][ptr[7]];
+	ptr += 8;
+	len -= 8;
+    }
+    while(len--)
+	crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *ptr++) & 0xff];
+    return crc;
+}
+
+#ifdef CRC32C_X86
+
+static inline uint64_t load64(uint8_t* ptr)
+{
+    uint64_t w;
+    memcpy(&w, ptr, sizeof(w));
+    return w;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_update_sse42(uint32_t crc, uint8_t* ptr, size_t len)
+{
+    uint64_t c = crc;
+
+    while(len >= 8) {
+	c = _mm_crc32_u64(c, load64(ptr));
+	ptr += 8;
+	len -= 8;
+    }
+    crc = c;
+    while(len--)
+	crc = _mm_crc32_u8(crc, *ptr++);
+    return crc;
+}
+
+// shift crc1 over 2n and crc2 over n zero bytes and combine with crc3
+__attribute__((target("sse4.2,pclmul")))
+static inline uint64_t crc32c_shift3(uint64_t* k, uint64_t crc1,
+				     uint64_t crc2, uint64_t crc3)
+{
+    __m128i a = _mm_clmulepi64_si128(_mm_cvtsi64_si128(crc1),
+				     _mm_cvtsi64_si128(k[0]), 0x00);
+    __m128i b = _mm_clmulepi64_si128(_mm_cvtsi64_si128(crc2),
+				     _mm_cvtsi64_si128(k[1]), 0x00);
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(_mm_xor_si128(a, b))) ^ crc3;
+}
+
+// three independent crc32 streams hide the latency of the instruction
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_update_pclmul(uint32_t crc, uint8_t* ptr, size_t len)
+{
+    uint64_t c1 = crc;
+
+    while(len >= 3*CRC32C_LONG) {
+	uint64_t c2 = 0, c3 = 0;
+	size_t i;
+	for (i = 0; i < CRC32C_LONG; i += 8) {
+	    c1 = _mm_crc32_u64(c1, load64(ptr+i));
+	    c2 = _mm_crc32_u64(c2, load64(ptr+CRC32C_LONG+i));
+	    c3 = _mm_crc32_u64(c3, load64(ptr+2*CRC32C_LONG+i));
+	}
+	c1 = crc32c_shift3(crc32c_klong, c1, c2, c3);
+	ptr += 3*CRC32C_LONG;
+	len -= 3*CRC32C_LONG;
+    }
+    while(len >= 3*CRC32C_SHORT) {
+	uint64_t c2 = 0, c3 = 0;
+	size_t i;
+	for (i = 0; i < CRC32C_SHORT; i += 8) {
+	    c1 = _mm_crc32_u64(c1, load64(ptr+i));
+	    c2 = _mm_crc32_u64(c2, load64(ptr+CRC32C_SHORT+i));
+	    c3 = _mm_crc32_u64(c3, load64(ptr+2*CRC32C_SHORT+i));
+	}
+	c1 = crc32c_shift3(crc32c_kshort, c1, c2, c3);
+	ptr += 3*CRC32C_SHORT;
+	len -= 3*CRC32C_SHORT;
+    }
+    return crc32c_update_sse42(c1, ptr, len);
+}
+
+#endif
+
+static void crc32c_select(void)
+{
+    crc32c_init_tables();
+    crc32c_hw = CRC32C_HW_NONE;
+#ifdef CRC32C_X86
+    // ACAST_SIMD=0 also disable the crc32 instruction
+    if (acast_simd_level() > ACAST_SIMD_NONE) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+	    crc32c_hw = CRC32C_HW_SSE42;
+	    if (__builtin_cpu_supports("pclmul"))
+		crc32c_hw = CRC32C_HW_PCLMUL;
+	}
+    }
+#endif
+}
+
+uint32_t crc32c_init() { return CRC32C_INIT; }
+
+uint32_t crc32c_final(uint32_t crc) { return crc ^ CRC32C_FINAL; }
+
+uint32_t crc32c_update(uint32_t crc, uint8_t* ptr, size_t len)
+{
+    if (crc32c_hw < 0)
+	crc32c_select();
+    switch(crc32c_hw) {
+#ifdef CRC32C_X86
+    case CRC32C_HW_PCLMUL:
+	return crc32c_update_pclmul(crc, ptr, len);
+    case CRC32C_HW_SSE42:
+	return crc32c_update_sse42(crc, ptr, len);
+#endif
+    default:
+	return crc32c_update_sw(crc, ptr, len);
+    }
+}
+
+uint32_t crc32c(uint8_t* ptr, size_t len)
+{
+    uint32_t crc = crc32c_init();
+    crc = crc32c_update(crc, ptr, len);
+    return crc32c_final(crc);
+}
+
+#ifdef TEST
+#include <stdio.h>
+int main(int argc, char** argv)
+{
+    char* text = "123456789";
+    uint32_t crc = crc32c((uint8_t*)text, strlen(text));
+    if (crc == 0xe3069283)
+	printf("OK 0x%08x\n", crc);
+    else
+	printf("ERROR 0x%08x, should be 0xe3069283\n", crc);
+    exit(0);
+}
+#endif
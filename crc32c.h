@@ -0,0 +1,13 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC32C (Castagnoli), hardware accelerated when possible
+extern uint32_t crc32c_init(void);
+extern uint32_t crc32c_final(uint32_t crc);
+extern uint32_t crc32c_update(uint32_t crc, uint8_t* ptr, size_t len);
+extern uint32_t crc32c(uint8_t* ptr, size_t len);
+
+#endif
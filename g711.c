@@ -41,6 +41,7 @@
 #include <stdint.h>
 
 #include "g711.h"
+#include "acast_simd.h"
 
 /*
  * g711.c
@@ -294,4 +295,79 @@ uint8_t ulaw2alaw(uint8_t uval)
 		      (0x55 ^ (_u2a[0x7F ^ uval] - 1)));
 }
 
+/*
+ * Block conversions
+ *
+ * Encoding only look at the top 14 bits of the sample (13 for A-law),
+ * so a 16K entry table indexed by (uint16_t)pcm >> 2 gives the same
+ * code as linear2alaw/linear2ulaw. Decoding use a 256 entry table, the
+ * entries are int32 so that it can be used for SIMD gather.
+ */
+#define ENCODE_TABLE_SIZE  16384
+
+static uint8_t alaw_etab[ENCODE_TABLE_SIZE];
+static uint8_t ulaw_etab[ENCODE_TABLE_SIZE];
+static int32_t alaw_dtab[256];
+static int32_t ulaw_dtab[256];
+static int     g711_tables = 0;
+
+static void g711_init_tables(void)
+{
+    int i;
+
+    if (g711_tables)
+	return;
+    for (i = 0; i < ENCODE_TABLE_SIZE; i++) {
+	int16_t pcm_val = (int16_t) (uint16_t) (i << 2);
+	alaw_etab[i] = linear2alaw(pcm_val);
+	ulaw_etab[i] = linear2ulaw(pcm_val);
+    }
+    for (i = 0; i < 256; i++) {
+	alaw_dtab[i] = alaw2linear(i);
+	ulaw_dtab[i] = ulaw2linear(i);
+    }
+    g711_tables = 1;
+}
+
+static void encode_block(uint8_t* table, int16_t* src, uint8_t* dst, size_t n)
+{
+    while(n--)
+	*dst++ = table[(uint16_t) *src++ >> 2];
+}
+
+static void decode_block(int32_t* table, uint8_t* src, int16_t* dst, size_t n)
+{
+    size_t i = acast_g711_decode_simd(table, src, dst, n);
+
+    src += i;
+    dst += i;
+    n   -= i;
+    while(n--)
+	*dst++ = table[*src++];
+}
+
+void g711_alaw_encode_block(int16_t* src, uint8_t* dst, size_t n)
+{
+    g711_init_tables();
+    encode_block(alaw_etab, src, dst, n);
+}
+
+void g711_ulaw_encode_block(int16_t* src, uint8_t* dst, size_t n)
+{
+    g711_init_tables();
+    encode_block(ulaw_etab, src, dst, n);
+}
+
+void g711_alaw_decode_block(uint8_t* src, int16_t* dst, size_t n)
+{
+    g711_init_tables();
+    decode_block(alaw_dtab, src, dst, n);
+}
+
+void g711_ulaw_decode_block(uint8_t* src, int16_t* dst, size_t n)
+{
+    g711_init_tables();
+    decode_block(ulaw_dtab, src, dst, n);
+}
+
 /* ---------- end of g711.c ----------------------------------------------------- */
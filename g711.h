@@ -2,10 +2,17 @@
 #define __G711_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 extern uint8_t linear2alaw(int16_t pcm_val);
 extern int16_t alaw2linear(uint8_t a_val);
 extern uint8_t linear2ulaw(int16_t pcm_val);
 extern int16_t ulaw2linear(uint8_t u_val);
 
+// convert n samples at the time
+extern void g711_alaw_encode_block(int16_t* src, uint8_t* dst, size_t n);
+extern void g711_ulaw_encode_block(int16_t* src, uint8_t* dst, size_t n);
+extern void g711_alaw_decode_block(uint8_t* src, int16_t* dst, size_t n);
+extern void g711_ulaw_decode_block(uint8_t* src, int16_t* dst, size_t n);
+
 #endif
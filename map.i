@@ -1,8 +1,20 @@
 // typed map operation
 
+#ifdef TYPE_FLOAT
+// float samples do not saturate
 static inline TYPE CAT2(sum_,TYPE)(TYPE a, TYPE b)
 {
-    TYPE2 s = a+b;
+    return a + b;
+}
+
+static inline TYPE CAT2(diff_,TYPE)(TYPE a, TYPE b)
+{
+    return a - b;
+}
+#else
+static inline TYPE CAT2(sum_,TYPE)(TYPE a, TYPE b)
+{
+    TYPE2 s = (TYPE2)a + b;   // widen before add, int32 must not wrap
     if (s > CAT2(TYPE_MAX_,TYPE)) return CAT2(TYPE_MAX_,TYPE);
     else if (s < CAT2(TYPE_MIN_,TYPE)) return CAT2(TYPE_MIN_,TYPE);
     return s;
@@ -10,11 +22,19 @@ static inline TYPE CAT2(sum_,TYPE)(TYPE a, TYPE b)
 
 static inline TYPE CAT2(diff_,TYPE)(TYPE a, TYPE b)
 {
-    TYPE2 d = a-b;
+    TYPE2 d = (TYPE2)a - b;
     if (d > CAT2(TYPE_MAX_,TYPE)) return CAT2(TYPE_MAX_,TYPE);
     else if (d < CAT2(TYPE_MIN_,TYPE)) return CAT2(TYPE_MIN_,TYPE);
     return d;
 }
+#endif
+
+// value of map constant c
+#ifdef TYPE_FLOAT
+#define CONST_VALUE(c) ((TYPE)(c) * (TYPE)MAP_FLOAT_CONST_SCALE)
+#else
+#define CONST_VALUE(c) (c)
+#endif
 
 // permute channels
 static void CAT2(permute_ii_,TYPE)
@@ -73,7 +93,7 @@ static void CAT2(scatter_gather_nn_,TYPE)
 		v1 = *src1[map[i].src1];
 		break;
 	    case ACAST_OP_CONST:
-		v1 = map[i].src2;
+		v1 = CONST_VALUE(map[i].src2);
 		break;
 	    case ACAST_OP_ADD:
 		v1 = *src1[map[i].src1];
@@ -82,7 +102,7 @@ static void CAT2(scatter_gather_nn_,TYPE)
 		break;
 	    case ACAST_OP_ADDC:
 		v1 = *src1[map[i].src1];
-		v2 = map[i].src2;
+		v2 = CONST_VALUE(map[i].src2);
 		v1 = CAT2(sum_,TYPE)(v1,v2);
 		break;
 	    case ACAST_OP_SUB:
@@ -92,7 +112,7 @@ static void CAT2(scatter_gather_nn_,TYPE)
 		break;
 	    case ACAST_OP_SUBC:
 		v1 = *src1[map[i].src1];
-		v2 = map[i].src2;
+		v2 = CONST_VALUE(map[i].src2);
 		v1 = CAT2(diff_,TYPE)(v1,v2);
 		break;
 	    default:
@@ -122,19 +142,19 @@ static void CAT2(scatter_gather_ii_,TYPE)
 		v = src[map[i].src1];
 		break;
 	    case ACAST_OP_CONST:
-		v = map[i].src1;
+		v = CONST_VALUE(map[i].src1);
 		break;
 	    case ACAST_OP_ADD:
 		v = CAT2(sum_,TYPE)(src[map[i].src1],src[map[i].src2]);
 		break;
 	    case ACAST_OP_ADDC:
-		v = CAT2(sum_,TYPE)(src[map[i].src1],map[i].src2);
+		v = CAT2(sum_,TYPE)(src[map[i].src1],CONST_VALUE(map[i].src2));
 		break;
 	    case ACAST_OP_SUB:
 		v = CAT2(diff_,TYPE)(src[map[i].src1],src[map[i].src2]);
 		break;
 	    case ACAST_OP_SUBC:
-		v = CAT2(diff_,TYPE)(src[map[i].src1],map[i].src2);
+		v = CAT2(diff_,TYPE)(src[map[i].src1],CONST_VALUE(map[i].src2));
 		break;
 	    default:
 		v = 0;
@@ -167,7 +187,7 @@ static void CAT2(scatter_gather_ni_,TYPE)
 		v1 = *src1[map[i].src1];
 		break;
 	    case ACAST_OP_CONST:
-		v1 = map[i].src2;
+		v1 = CONST_VALUE(map[i].src2);
 		break;
 	    case ACAST_OP_ADD:
 		v1 = *src1[map[i].src1];
@@ -176,7 +196,7 @@ static void CAT2(scatter_gather_ni_,TYPE)
 		break;
 	    case ACAST_OP_ADDC:
 		v1 = *src1[map[i].src1];
-		v2 = map[i].src2;
+		v2 = CONST_VALUE(map[i].src2);
 		v1 = CAT2(sum_,TYPE)(v1,v2);
 		break;
 	    case ACAST_OP_SUB:
@@ -186,7 +206,7 @@ static void CAT2(scatter_gather_ni_,TYPE)
 		break;
 	    case ACAST_OP_SUBC:
 		v1 = *src1[map[i].src1];
-		v2 = map[i].src2;
+		v2 = CONST_VALUE(map[i].src2);
 		v1 = CAT2(diff_,TYPE)(v1,v2);
 		break;
 	    default:
@@ -200,6 +220,244 @@ static void CAT2(scatter_gather_ni_,TYPE)
     }
 }
 
+// run a compiled channel program, one tight loop per op over all frames
+static void CAT2(channel_prog_ii_,TYPE)
+    (TYPE* src, size_t src_stride,
+     TYPE* dst, size_t dst_stride,
+     acast_channel_prog_t* prog,
+     size_t frames)
+{
+    int j;
+
+    for (j = 0; j < prog->num_ops; j++) {
+	acast_prog_op_t* p = &prog->op[j];
+	TYPE* s1 = src + p->src1;
+	TYPE* s2;
+	TYPE* d  = dst + p->dst;
+	size_t n = frames;
+
+	switch(p->op) {
+	case ACAST_OP_SRC:
+	    if (p->len == 1) {
+		while(n--) {
+		    *d = *s1;
+		    s1 += src_stride; d += dst_stride;
+		}
+	    }
+	    else if ((p->len == src_stride) && (p->len == dst_stride)) {
+		memcpy(d, s1, frames*p->len*sizeof(TYPE));
+	    }
+	    else {
+		size_t len = p->len*sizeof(TYPE);
+		while(n--) {
+		    memcpy(d, s1, len);
+		    s1 += src_stride; d += dst_stride;
+		}
+	    }
+	    break;
+	case ACAST_OP_CONST: {
+	    TYPE v = CONST_VALUE(p->src1);
+	    while(n--) {
+		*d = v;
+		d += dst_stride;
+	    }
+	    break;
+	}
+	case ACAST_OP_ADD:
+	    s2 = src + p->src2;
+	    while(n--) {
+		*d = CAT2(sum_,TYPE)(*s1, *s2);
+		s1 += src_stride; s2 += src_stride; d += dst_stride;
+	    }
+	    break;
+	case ACAST_OP_ADDC: {
+	    TYPE v = CONST_VALUE(p->src2);
+	    while(n--) {
+		*d = CAT2(sum_,TYPE)(*s1, v);
+		s1 += src_stride; d += dst_stride;
+	    }
+	    break;
+	}
+	case ACAST_OP_SUB:
+	    s2 = src + p->src2;
+	    while(n--) {
+		*d = CAT2(diff_,TYPE)(*s1, *s2);
+		s1 += src_stride; s2 += src_stride; d += dst_stride;
+	    }
+	    break;
+	case ACAST_OP_SUBC: {
+	    TYPE v = CONST_VALUE(p->src2);
+	    while(n--) {
+		*d = CAT2(diff_,TYPE)(*s1, v);
+		s1 += src_stride; d += dst_stride;
+	    }
+	    break;
+	}
+	default:
+	    while(n--) {
+		*d = 0;
+		d += dst_stride;
+	    }
+	    break;
+	}
+    }
+}
+
+// run a compiled channel program on separate channels
+static void CAT2(channel_prog_nn_,TYPE)
+    (TYPE** src, size_t* src_stride,
+     TYPE** dst, size_t* dst_stride,
+     acast_channel_prog_t* prog,
+     size_t frames)
+{
+    int j;
+
+    for (j = 0; j < prog->num_ops; j++) {
+	acast_prog_op_t* p = &prog->op[j];
+	int k;
+
+	for (k = 0; k < p->len; k++) {
+	    TYPE* s1 = src[p->src1+k];
+	    TYPE* s2;
+	    TYPE* d  = dst[p->dst+k];
+	    size_t ss1 = src_stride[p->src1+k];
+	    size_t ss2;
+	    size_t ds  = dst_stride[p->dst+k];
+	    size_t n = frames;
+
+	    switch(p->op) {
+	    case ACAST_OP_SRC:
+		while(n--) {
+		    *d = *s1;
+		    s1 += ss1; d += ds;
+		}
+		break;
+	    case ACAST_OP_CONST: {
+		TYPE v = CONST_VALUE(p->src1);
+		while(n--) {
+		    *d = v;
+		    d += ds;
+		}
+		break;
+	    }
+	    case ACAST_OP_ADD:
+		s2 = src[p->src2]; ss2 = src_stride[p->src2];
+		while(n--) {
+		    *d = CAT2(sum_,TYPE)(*s1, *s2);
+		    s1 += ss1; s2 += ss2; d += ds;
+		}
+		break;
+	    case ACAST_OP_ADDC: {
+		TYPE v = CONST_VALUE(p->src2);
+		while(n--) {
+		    *d = CAT2(sum_,TYPE)(*s1, v);
+		    s1 += ss1; d += ds;
+		}
+		break;
+	    }
+	    case ACAST_OP_SUB:
+		s2 = src[p->src2]; ss2 = src_stride[p->src2];
+		while(n--) {
+		    *d = CAT2(diff_,TYPE)(*s1, *s2);
+		    s1 += ss1; s2 += ss2; d += ds;
+		}
+		break;
+	    case ACAST_OP_SUBC: {
+		TYPE v = CONST_VALUE(p->src2);
+		while(n--) {
+		    *d = CAT2(diff_,TYPE)(*s1, v);
+		    s1 += ss1; d += ds;
+		}
+		break;
+	    }
+	    default:
+		while(n--) {
+		    *d = 0;
+		    d += ds;
+		}
+		break;
+	    }
+	}
+    }
+}
+
+// gain matrix, accumulate in TYPEM, integer results are rounded to
+// nearest even and saturated
+#ifdef TYPE_FLOAT
+static inline TYPE CAT2(from_acc_,TYPE)(TYPEM v)
+{
+    return v;
+}
+#else
+static inline TYPE CAT2(from_acc_,TYPE)(TYPEM v)
+{
+    if (v <= CAT2(TYPE_MIN_,TYPE)) return CAT2(TYPE_MIN_,TYPE);
+    else if (v >= CAT2(TYPE_MAX_,TYPE)) return CAT2(TYPE_MAX_,TYPE);
+    return (v + CAT2(ROUND_MAGIC_,TYPEM)) - CAT2(ROUND_MAGIC_,TYPEM);
+}
+#endif
+
+// 8 bit samples are taken as offset binary, flip is 0 for U8 and 0x80
+// for S8, the gains then apply to the signed value
+#ifdef TYPE_BIASED
+#define MATRIX_FLIP_ARG   , TYPE flip
+#define MATRIX_IN(v)      ((TYPEM)((v) ^ flip) - 0x80)
+#define MATRIX_OUT(acc)   (CAT2(from_acc_,TYPE)((acc) + 0x80) ^ flip)
+#else
+#define MATRIX_FLIP_ARG
+#define MATRIX_IN(v)      (v)
+#define MATRIX_OUT(acc)   CAT2(from_acc_,TYPE)(acc)
+#endif
+
+static void CAT2(matrix_ii_,TYPE)
+    (TYPE* src, size_t src_stride,
+     TYPE* dst, size_t dst_stride,
+     acast_matrix_t* mx,
+     size_t frames MATRIX_FLIP_ARG)
+{
+    while(frames--) {
+	int i, j;
+	for (i = 0; i < mx->nout; i++) {
+	    TYPEM acc = 0;
+	    for (j = 0; j < mx->nin; j++)
+		acc += MATRIX_IN(src[j])*mx->CAT2(MATRIX_GAIN_,TYPEM)[i][j];
+	    dst[i] = MATRIX_OUT(acc);
+	}
+	src += src_stride;
+	dst += dst_stride;
+    }
+}
+
+static void CAT2(matrix_ni_,TYPE)
+    (TYPE** src, size_t* src_stride,
+     TYPE* dst, size_t dst_stride,
+     acast_matrix_t* mx,
+     size_t frames MATRIX_FLIP_ARG)
+{
+    TYPE* src1[MAX_MATRIX_IN];
+    int i, j;
+
+    for (j = 0; j < mx->nin; j++) { src1[j] = src[j]; }
+
+    while(frames--) {
+	for (i = 0; i < mx->nout; i++) {
+	    TYPEM acc = 0;
+	    for (j = 0; j < mx->nin; j++)
+		acc += MATRIX_IN(*src1[j])*mx->CAT2(MATRIX_GAIN_,TYPEM)[i][j];
+	    dst[i] = MATRIX_OUT(acc);
+	}
+	for (j = 0; j < mx->nin; j++) { src1[j] += src_stride[j]; }
+	dst += dst_stride;
+    }
+}
+
+#undef MATRIX_FLIP_ARG
+#undef MATRIX_IN
+#undef MATRIX_OUT
+#undef CONST_VALUE
 
 #undef TYPE
 #undef TYPE2
+#undef TYPEM
+#undef TYPE_FLOAT
+#undef TYPE_BIASED
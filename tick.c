@@ -1,4 +1,6 @@
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include "tick.h"
@@ -35,6 +37,14 @@ tick_t time_tick_to_usec(tick_t tick)
     return tick;
 }
 
+// wall clock in micros, hosts are kept in sync by ntp or ptp
+uint64_t time_wall_usec()
+{
+    struct timeval t;
+    gettimeofday(&t, (struct timezone*) 0);
+    return t.tv_sec*1000000ULL + t.tv_usec;
+}
+
 uint64_t time_tick_wait_until(uint64_t end)
 {
     uint64_t now = time_tick_now();
@@ -47,3 +57,21 @@ uint64_t time_tick_wait_until(uint64_t end)
     }
     return now;
 }
+
+// monotonic clock in nanos, the clock used for SO_TXTIME
+uint64_t time_mono_nsec()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+// sleep until the monotonic time end (nanos) without spinning
+void time_mono_sleep_until(uint64_t end)
+{
+    struct timespec t;
+    t.tv_sec  = end / 1000000000ULL;
+    t.tv_nsec = end % 1000000000ULL;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+	;
+}
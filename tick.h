@@ -10,5 +10,8 @@ extern tick_t time_tick_now(void);
 extern tick_t time_tick_from_usec(uint64_t usec);
 extern tick_t time_tick_to_usec(tick_t tick);
 extern uint64_t time_tick_wait_until(uint64_t end);
+extern uint64_t time_wall_usec(void);
+extern uint64_t time_mono_nsec(void);
+extern void time_mono_sleep_until(uint64_t end);
 
 #endif
@@ -50,7 +50,8 @@ printf("usage: wav_sender [options] file\n"
 "  -t, --ttl       multicast ttl (%d)\n"
 "  -d, --device    playback device (\"%s\")\n"
 "  -c, --channels  number of output channels (%d)\n"
-"  -m, --map       channel map (\"%s\")\n",       
+"  -m, --map       channel map (\"%s\")\n"
+"                  dN is N in sample units, N/32768 for float formats\n",       
        MULTICAST_ADDR,
        INTERFACE_ADDR,
        MULTICAST_PORT,
@@ -212,7 +213,7 @@ int main(int argc, char** argv)
 				  multicast_ttl,
 				  multicast_loop,
 				  &addr, &addrlen,
-				  network_bufsize)) < 0) {
+				  network_bufsize, NULL)) < 0) {
 	fprintf(stderr, "unable to open multicast socket %s\n",
 		strerror(errno));
 	exit(1);
@@ -224,7 +225,8 @@ int main(int argc, char** argv)
     mparam.bytes_per_channel = snd_pcm_format_physical_width(fmt) / 8;
     mcast_bytes_per_frame =
 	mparam.bytes_per_channel*mparam.channels_per_frame;
-    mcast_frames_per_packet = acast_get_frames_per_packet(&mparam);
+    mcast_frames_per_packet = acast_get_frames_per_packet(&mparam,
+							  BYTES_PER_PACKET);
     frame_delay_us = (mcast_frames_per_packet*1000000) / mparam.sample_rate;
 
     if (verbose) {